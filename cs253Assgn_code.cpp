@@ -28,17 +28,106 @@
 *              Computed Status (determined at view time) is:
 *              "Available" if not borrowed;
 *              "Borrowed" if borrowed by the current user;
-*              "Reserved" if reserved by someone else and
-*              (shows "Reserved (For You)" if reserved by the current user).
+*              a user waiting for a title sees their place in its queue.
+*
+*    Reservations: when every copy of a title is lent out, any number of
+*    students and faculty can reserve it. Each title keeps a first-come,
+*    first-served queue; a returned copy is lent at once to the first user
+*    in it. Reservations are saved in the users' accounts and the queues
+*    are rebuilt from them on startup.
 *
 *    Default data consists of 10 titles with 5 copies each (50 records total).
 *    Each copy is assigned a unique Book ID.
 *
 *    Data is persisted immediately to files: books.txt, users.txt, and
-*    transactions.txt.
+*    transactions.txt. By default each change is appended as one record to
+*    a write-ahead journal (journal.wal) instead of rewriting books.txt and
+*    users.txt; the journal is replayed on startup and folded into fresh
+*    snapshots every 1000 records and on exit. Start with
+*    "--persistence snapshot" to rewrite the full files on every change.
+*    transactions.txt is an append-only log written through a buffered
+*    writer ("--log-flush every|batch:N|exit", "--log-fsync"); it is read
+*    back from disk only when the librarian views it.
+*    The files are written by a background writer thread (see
+*    BackgroundWriter): operations queue their records and snapshots and
+*    return, and the writer commits whatever has queued up as one group,
+*    with one fsync per group for "--journal-fsync". Fine payments and the
+*    fine sweep wait until their changes are on disk, and the library
+*    drains the writer when it closes. "--sync-writes" writes on the
+*    caller's thread instead.
+*    With "--catalog-format binary" the book snapshot is kept in books.bin,
+*    a memory-mapped binary format (see CatalogFileHeader) instead of
+*    books.txt. Convert between the two formats with
+*    "--convert-catalog text2bin|bin2text <input> <output>".
+*    At startup books and users load concurrently; each file is split into
+*    chunks on line boundaries that are parsed on a worker pool
+*    ("--threads N", default one per core).
+*
+*    The catalog is normalized: each title (keyed by ISBN) holds the
+*    bibliographic data once, and copies refer to it. In memory the copies
+*    are stored column-wise (see Catalog), so circulation state sits in
+*    dense arrays apart from the strings. books.txt and books.bin store
+*    titles and copies the same way; the older one-line-per-copy books.txt
+*    is still read.
+*
+*    Users live in one pool per role (see UserPool): large blocks that are
+*    sized once at load, instead of one heap object per user. Each user
+*    carries its role (UserRole), which drives saving, the portal menus
+*    and command permissions.
+*    Books and users are indexed by ID in hash tables, so lookups during
+*    borrowing, returning and reserving take constant time regardless of
+*    the catalog size. Users are also indexed by username for login, and
+*    usernames must be unique.
+*    The catalog also keeps, per user, the IDs of the copies they have
+*    borrowed, so account views cost O(items held), and per
+*    title a bitset of its copies that are not lent out (see AtomicBitset),
+*    so borrowing any copy by ISBN or title is a bit scan. Active
+*    loans are kept in a due-date index (see DueIndex) that answers
+*    "overdue now", "due within N days" and the faculty 60-day check.
+*    The librarian's fine sweep (or "--fine-sweep" on the command line)
+*    charges every fine-paying patron's overdue days in one parallel
+*    pass; each loan records the days already charged so none is charged
+*    twice.
+*
+*    Server mode ("--serve <socket>") serves many clients at once over a
+*    Unix-domain socket with a line protocol (see CommandSession). A
+*    reader/writer lock guards the set of books and users, and per-copy and
+*    per-account lock stripes guard circulation (see Library::Access and
+*    Library::ItemLocks). "--client <socket>" is a line client and
+*    "--load-test <socket>" measures throughput as clients scale.
+*    "--batch <script>" runs the same commands from a file without prompts
+*    and reports throughput and per-command latency.
+*    Book listings show one row per title, a page at a time, and read
+*    versioned copy-on-write snapshots of the circulation state (see
+*    CirculationVersion), so they take no locks that borrowing and
+*    returning wait for, and a page costs O(titles on it).
+*    "Search Books" and SEARCH rank titles by the words and word prefixes
+*    of their title, author, publisher and ISBN through an inverted index
+*    (see TitleSearchIndex), built on the worker pool after loading. When
+*    nothing matches, a trigram index (see TrigramIndex) finds the titles
+*    most like a misspelt query, with a vector kernel picked at run time.
 *
-*    Compile with: g++ -std=c++11 cs253Assgn.cpp -o cs253Assgn
+*    The hot paths are timed into lock-free latency histograms (see
+*    PerformanceStats), shown by the librarian's "Performance Stats" and
+*    written to perf_stats.txt on exit; "--no-stats" turns them off.
+*
+*    Compile with: g++ -std=c++17 -O2 -pthread cs253Assgn.cpp -o cs253Assgn
 *    Run with:     ./cs253Assgn
+*    Benchmarks:   ./cs253Assgn --bench lookup [maxCopies]
+*                  ./cs253Assgn --bench login [accounts]
+*                  ./cs253Assgn --bench persist [maxCopies]
+*                  ./cs253Assgn --bench txlog [historyLines]
+*                  ./cs253Assgn --bench startup [copies]
+*                  ./cs253Assgn --bench parse [copies]
+*                  ./cs253Assgn --bench load [copies]
+*                  ./cs253Assgn --bench scan [copies]
+*                  ./cs253Assgn --bench footprint [copies]
+*                  ./cs253Assgn --bench accounts [maxCopies]
+*                  ./cs253Assgn --bench server [maxClients]
+*                  ./cs253Assgn --bench snapshot [copies]
+*                  ./cs253Assgn --bench search [copies]
+*                  ./cs253Assgn --bench fuzzy [copies]
+*                  ./cs253Assgn --bench suite [maxCopies] [json|csv] [resultsFile]
 *
 **************************************************************************/
 
@@ -55,52 +144,385 @@
 #include <cstdlib>
 #include <iomanip>
 #include <cctype>
+#include <unordered_map>
+#include <chrono>
+#include <random>
+#include <filesystem>
+#include <cstdio>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <charconv>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <array>
+#include <memory>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+#include <queue>
+#include <map>
+#include <set>
+#include <tuple>
+#include <variant>
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 // ========== Utility Functions ==========
 
 // Function: trim()
-// Removes leading and trailing whitespace from a string.
+// Removes leading and trailing whitespace from a string. An empty or
+// all-whitespace string gives an empty string.
 string trim(const string & s)
 {
     auto start = s.begin();
-    while (start != s.end() && isspace(*start))
+    while (start != s.end() && isspace(static_cast<unsigned char>(*start)))
     {
         start++;
     }
 
     auto end = s.end();
-    if (start != s.end())
+    while (end != start && isspace(static_cast<unsigned char>(*(end - 1))))
+    {
+        end--;
+    }
+    return string(start, end);
+}
+
+
+// Function: isValidAccountField()
+// True if a username or password can be stored in users.txt and typed at
+// the prompts: not empty, with no whitespace, control characters or the
+// record delimiters ';' and ','.
+bool isValidAccountField(const string & field)
+{
+    if (field.empty())
+    {
+        return false;
+    }
+    for (char c : field)
     {
-        do
+        unsigned char byte = static_cast<unsigned char>(c);
+        if ((byte < 0x80 && !isgraph(byte)) || c == ';' || c == ',')     // Bytes of UTF-8 sequences are allowed.
         {
-            end--;
+            return false;
         }
-        while (distance(start, end) > 0 && isspace(*end));
     }
-    return string(start, end + 1);
+    return true;
+}
+
+
+// Function: checkAccountField()
+// Writes why and returns false if a new username or password (named by
+// what) cannot be stored; see isValidAccountField().
+bool checkAccountField(const string & field, const string & what, ostream & out)
+{
+    if (isValidAccountField(field))
+    {
+        return true;
+    }
+    out << "Invalid " << what << ": it must not be empty or contain spaces, control characters, ';' or ','." << endl;
+    return false;
 }
 
 
 // Function: getTimeString()
-// Converts a time_t value to a human-readable string using ctime().
-// Also removes the trailing newline character.
+// Converts a time_t value to a human-readable string in ctime()'s format,
+// without the trailing newline. Formats into a local buffer, since
+// ctime()'s shared static buffer is not safe across session threads.
 string getTimeString(time_t t)
 {
-    char * dt = ctime(&t);
-    string s(dt);
-    if (!s.empty() && s.back() == '\n')
+    tm local;
+    char buffer[32];
+    if (!localtime_r(&t, &local) || strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Y", &local) == 0)
+    {
+        return string();
+    }
+    return buffer;
+}
+
+
+// Function: trimView()
+// Like trim(), but returns a view into the original characters.
+string_view trimView(string_view s)
+{
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.front())))
+    {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && isspace(static_cast<unsigned char>(s.back())))
     {
-        s.pop_back();
+        s.remove_suffix(1);
     }
     return s;
 }
 
 
+// Function: parseNumber()
+// Parses an entire (trimmed) field as a number. Returns false if any character is left over.
+template <typename T>
+bool parseNumber(string_view field, T & value)
+{
+    field = trimView(field);
+    const char * first = field.data();
+    const char * last = first + field.size();
+    if (first != last && *first == '+')
+    {
+        first++;
+    }
+    if (first == last)
+    {
+        return false;
+    }
+    auto result = from_chars(first, last, value);
+    return result.ec == errc() && result.ptr == last;
+}
+
+
+// Function: shiftSlotIndex()
+// Updates an index from keys to vector slots (the first slot wins for
+// duplicate keys) after the element at slot was erased, without rehashing
+// every key: the entries of the elements behind it move down by one. The
+// erased element's key must already be out of the index; a later element
+// with the same key takes its place. keyOf(i) is the key at slot i.
+template <typename Key, typename KeyOf>
+void shiftSlotIndex(unordered_map<Key, size_t> & index, size_t slot, size_t size, KeyOf keyOf)
+{
+    for (size_t i = slot; i < size; i++)
+    {
+        auto it = index.find(keyOf(i));
+        if (it == index.end())
+        {
+            index.emplace(keyOf(i), i);
+        }
+        else if (it->second == i + 1)
+        {
+            it->second = i;
+        }
+    }
+}
+
+
+// Class: FieldReader
+// Walks the delimiter-separated fields of one record without allocating.
+// Fields are returned as views into the record and numbers are parsed with
+// from_chars. A trailing '\r' (files saved on Windows) is ignored.
+// The named overloads describe the problem in error when a field is bad.
+class FieldReader
+{
+private:
+    string_view rest;
+    bool done;
+    
+public:
+    explicit FieldReader(string_view record)
+    : rest(record)
+    , done(false)
+    {
+        if (!rest.empty() && rest.back() == '\r')
+        {
+            rest.remove_suffix(1);
+        }
+    }
+    
+    
+    bool atEnd() const
+    {
+        return done;
+    }
+    
+    
+    // Returns the unread part of the record.
+    string_view remainder() const
+    {
+        return done ? string_view() : rest;
+    }
+    
+    
+    // Reads the next field. Returns false once the record is used up.
+    bool next(string_view & field, char delim = ';')
+    {
+        if (done)
+        {
+            return false;
+        }
+        size_t pos = rest.find(delim);
+        if (pos == string_view::npos)
+        {
+            field = rest;
+            rest = string_view();
+            done = true;
+        }
+        else
+        {
+            field = rest.substr(0, pos);
+            rest.remove_prefix(pos + 1);
+        }
+        return true;
+    }
+    
+    
+    bool next(string_view & field, const char * name, string & error, char delim = ';')
+    {
+        if (!next(field, delim))
+        {
+            error = string("missing ") + name;
+            return false;
+        }
+        return true;
+    }
+    
+    
+    template <typename T>
+    bool nextNumber(T & value, const char * name, string & error, char delim = ';')
+    {
+        string_view field;
+        if (!next(field, name, error, delim))
+        {
+            return false;
+        }
+        if (!parseNumber(field, value))
+        {
+            error = string("invalid ") + name + " \"" + string(field) + "\"";
+            return false;
+        }
+        return true;
+    }
+};
+
+
+// ========== Concurrency Utilities ==========
+
+// Class: ThreadPool
+// A fixed set of worker threads that run submitted tasks in FIFO order.
+class ThreadPool
+{
+private:
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex queueMutex;
+    condition_variable queueReady;
+    bool stopping;
+    
+    
+    void workerLoop()
+    {
+        while (true)
+        {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                queueReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                {
+                    return;
+                }
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+    
+    
+public:
+    // threadCount 0 means one thread per hardware core.
+    explicit ThreadPool(size_t threadCount = 0)
+    : stopping(false)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = max(1u, thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < threadCount; i++)
+        {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+    
+    
+    // Finishes the queued tasks, then joins the workers.
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        for (auto & worker : workers)
+        {
+            worker.join();
+        }
+    }
+    
+    
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+    
+    
+    size_t size() const
+    {
+        return workers.size();
+    }
+    
+    
+    // Queues fn and returns a future for its result.
+    template <typename Fn>
+    auto submit(Fn fn) -> future<decltype(fn())>
+    {
+        using Result = decltype(fn());
+        auto task = make_shared<packaged_task<Result()>>(move(fn));
+        future<Result> result = task->get_future();
+        {
+            lock_guard<mutex> lock(queueMutex);
+            tasks.emplace_back([task]() { (*task)(); });
+        }
+        queueReady.notify_one();
+        return result;
+    }
+};
+
+
+// Function: parallelFor()
+// Calls fn(begin, end) on the pool for consecutive ranges covering [0, count)
+// and waits for all of them.
+template <typename Fn>
+void parallelFor(ThreadPool & pool, size_t count, Fn fn)
+{
+    size_t parts = min(count, pool.size() * 4);
+    vector<future<void>> pending;
+    for (size_t part = 0; part < parts; part++)
+    {
+        size_t begin = count * part / parts;
+        size_t end = count * (part + 1) / parts;
+        pending.push_back(pool.submit([&fn, begin, end]() { fn(begin, end); }));
+    }
+    for (auto & f : pending)
+    {
+        f.get();
+    }
+}
+
+
 // ========== Enumeration and Conversion Functions ==========
 
 // Enumeration: BookStatus
+// Reserved is only read from files written before reservation queues,
+// when a reserved copy was one still on loan; it is loaded as Borrowed.
 enum class BookStatus
 {
     Available,
@@ -133,25 +555,121 @@ string statusToString(BookStatus status)
 
 
 // Function: stringToStatus()
-// Converts a string to a BookStatus enum value.
-BookStatus stringToStatus(const string & str)
+// Converts a string to a BookStatus enum value. Returns false for an unknown status.
+bool stringToStatus(string_view str, BookStatus & status)
 {
+    str = trimView(str);
     if (str == "Available")
     {
-        return BookStatus::Available;
+        status = BookStatus::Available;
+        return true;
     }
     if (str == "Borrowed")
     {
-        return BookStatus::Borrowed;
+        status = BookStatus::Borrowed;
+        return true;
     }
     if (str == "Reserved")
     {
-        return BookStatus::Reserved;
+        status = BookStatus::Reserved;
+        return true;
+    }
+    return false;
+}
+
+
+// Enumeration: UserRole
+// Kind of user. Every User carries its role, so callers dispatch on it
+// instead of probing the class with dynamic_cast.
+enum class UserRole : uint8_t
+{
+    Student,
+    Faculty,
+    Librarian
+};
+
+
+// Function: roleToString()
+// Converts a UserRole to the type name written in front of each user record.
+string roleToString(UserRole role)
+{
+    switch (role)
+    {
+        case UserRole::Student:
+        {
+            return "Student";
+        }
+        case UserRole::Faculty:
+        {
+            return "Faculty";
+        }
+        case UserRole::Librarian:
+        {
+            return "Librarian";
+        }
+    }
+    return "Unknown";
+}
+
+
+// Function: stringToRole()
+// Converts a user record's type name to a UserRole. Returns false for an unknown type.
+bool stringToRole(string_view str, UserRole & role)
+{
+    str = trimView(str);
+    if (str == "Student")
+    {
+        role = UserRole::Student;
+        return true;
+    }
+    if (str == "Faculty")
+    {
+        role = UserRole::Faculty;
+        return true;
+    }
+    if (str == "Librarian")
+    {
+        role = UserRole::Librarian;
+        return true;
     }
-    return BookStatus::Available;
+    return false;
 }
 
 
+// ========== Role Policies ==========
+// Borrowing rules of each patron role as compile-time constants. A
+// Patron<Policy> (see below) applies them; adding a role takes a policy,
+// a UserRole value with its name (roleToString(), stringToRole()) and the
+// Patron<Policy> alternative in ParsedUser. The Library reaches a role's
+// rules and pool only through the user's virtual functions and
+// visitUserClass().
+
+// Struct: StudentPolicy
+struct StudentPolicy
+{
+    static constexpr UserRole role = UserRole::Student;
+    static constexpr const char * name = "Student";    // In portal headers and log entries.
+    static constexpr const char * group = "students";  // In messages about the whole role.
+    static constexpr size_t maxBooks = 3;
+    static constexpr int maxDays = 15;
+    static constexpr double fineRate = 10.0;            // Rupees per day kept beyond maxDays.
+    static constexpr int overdueBlockDays = 0;          // No overdue-loan check.
+};
+
+
+// Struct: FacultyPolicy
+struct FacultyPolicy
+{
+    static constexpr UserRole role = UserRole::Faculty;
+    static constexpr const char * name = "Faculty";
+    static constexpr const char * group = "faculty";
+    static constexpr size_t maxBooks = 5;
+    static constexpr int maxDays = 30;
+    static constexpr double fineRate = 0.0;             // Faculty pay no fines.
+    static constexpr int overdueBlockDays = 60;         // No borrowing while a loan is this many days overdue.
+};
+
+
 // ========== Class Definitions ==========
 
 // Class: Book
@@ -168,7 +686,9 @@ private:
     string ISBN;
     BookStatus status;
     int borrowedBy;     // 0 if not borrowed.
-    int reservedBy;     // 0 if not reserved.
+    int reservedBy;     // Only set when read from an old file (see Catalog::appendCopy()); 0 otherwise.
+    
+    friend class Catalog;   // Reads the fields directly when interning them.
     
 public:
     // Default constructor.
@@ -214,6 +734,12 @@ public:
     }
     
     
+    string getAuthor() const
+    {
+        return author;
+    }
+    
+    
     string getPublisher() const
     {
         return publisher;
@@ -300,15 +826,15 @@ public:
     
     
     // Prints book details (without stored status).
-    void printDetails() const
+    void printDetails(ostream & out) const
     {
-        cout << "---------------------------------------" << endl;
-        cout << "Book ID: " << id << endl;
-        cout << "Title: " << title << endl;
-        cout << "Publisher: " << publisher << endl;
-        cout << "Year: " << year << endl;
-        cout << "ISBN: " << ISBN << endl;
-        cout << "---------------------------------------" << endl;
+        out << "---------------------------------------\n";
+        out << "Book ID: " << id << '\n';
+        out << "Title: " << title << '\n';
+        out << "Publisher: " << publisher << '\n';
+        out << "Year: " << year << '\n';
+        out << "ISBN: " << ISBN << '\n';
+        out << "---------------------------------------\n";
     }
     
     
@@ -324,1772 +850,10038 @@ public:
     
     
     // Deserializes book data.
-    void deserialize(const string & data)
-    {
-        try
-        {
-            istringstream iss(data);
-            string token;
-            getline(iss, token, ';');
-            id = stoi(token);
-            getline(iss, title, ';');
-            getline(iss, author, ';');
-            getline(iss, publisher, ';');
-            getline(iss, token, ';');
-            year = stoi(token);
-            getline(iss, ISBN, ';');
-            getline(iss, token, ';');
-            status = stringToStatus(token);
-            getline(iss, token, ';');
-            borrowedBy = stoi(token);
-            getline(iss, token, ';');
-            reservedBy = stoi(token);
-        }
-        catch (exception & e)
-        {
-            id = 0;
-            title = "";
-            author = "";
-            publisher = "";
-            year = 0;
-            ISBN = "";
-            status = BookStatus::Available;
-            borrowedBy = 0;
-            reservedBy = 0;
+    // On failure the book is left unchanged and error describes the bad field.
+    bool deserialize(string_view data, string & error)
+    {
+        FieldReader reader(data);
+        int newId, newYear, newBorrowedBy, newReservedBy;
+        string_view newTitle, newAuthor, newPublisher, newISBN, statusField;
+        BookStatus newStatus;
+        if (!reader.nextNumber(newId, "book ID", error)
+            || !reader.next(newTitle, "title", error)
+            || !reader.next(newAuthor, "author", error)
+            || !reader.next(newPublisher, "publisher", error)
+            || !reader.nextNumber(newYear, "year", error)
+            || !reader.next(newISBN, "ISBN", error)
+            || !reader.next(statusField, "status", error))
+        {
+            return false;
         }
+        if (!stringToStatus(statusField, newStatus))
+        {
+            error = "unknown status \"" + string(statusField) + "\"";
+            return false;
+        }
+        if (!reader.nextNumber(newBorrowedBy, "borrower ID", error)
+            || !reader.nextNumber(newReservedBy, "reserver ID", error))
+        {
+            return false;
+        }
+        id = newId;
+        title.assign(newTitle);
+        author.assign(newAuthor);
+        publisher.assign(newPublisher);
+        year = newYear;
+        ISBN.assign(newISBN);
+        status = newStatus;
+        borrowedBy = newBorrowedBy;
+        reservedBy = newReservedBy;
+        return true;
     }
 };
 
 
-// Class: BorrowRecord
-// Stores a borrow record.
-struct BorrowRecord
+// Function: stringHeapBytes()
+// Heap memory owned by a string (zero if it fits in the small-string buffer).
+size_t stringHeapBytes(const string & s)
 {
-    int bookId;
-    time_t borrowTimestamp;
-    int borrowDays;
-};
+    const char * data = s.data();
+    const char * self = reinterpret_cast<const char *>(&s);
+    bool isInline = data >= self && data < self + sizeof(s);
+    return isInline ? 0 : s.capacity() + 1;
+}
 
-    
-// Class: Account
-// Manages borrow records and fines.
-class Account
+
+// Function: hashTableBytes()
+// Approximate memory used by an unordered container: the bucket array plus
+// one node (value and next pointer) per element.
+template <typename Table>
+size_t hashTableBytes(const Table & table)
+{
+    return table.bucket_count() * sizeof(void *) + table.size() * (sizeof(typename Table::value_type) + 2 * sizeof(void *));
+}
+
+
+// Class: StringPool
+// Interns strings: each distinct string is stored once and referred to by a
+// small integer. References returned by get() stay valid as the pool grows.
+class StringPool
 {
 private:
-    vector<BorrowRecord> borrowRecords;
-    double fineDue;
+    deque<string> strings;
+    unordered_map<string_view, uint32_t> index;    // Views into strings.
     
 public:
-    // Default constructor.
-    Account()
-    : fineDue(0.0)
+    uint32_t intern(string_view str)
     {
+        auto it = index.find(str);
+        if (it != index.end())
+        {
+            return it->second;
+        }
+        strings.emplace_back(str);
+        uint32_t id = static_cast<uint32_t>(strings.size() - 1);
+        index.emplace(strings.back(), id);
+        return id;
     }
     
     
-    // Returns borrow records.
-    vector<BorrowRecord> getBorrowRecords() const
+    const string & get(uint32_t id) const
     {
-        return borrowRecords;
+        return strings[id];
     }
     
     
-    // Returns current fine.
-    double getFine() const
+    size_t size() const
     {
-        return fineDue;
+        return strings.size();
     }
     
     
-    // Adds a new borrow record.
-    void addBorrowedBook(int bookId, int borrowDays)
+    void clear()
     {
-        BorrowRecord record;
-        record.bookId = bookId;
-        record.borrowTimestamp = time(0);
-        record.borrowDays = borrowDays;
-        borrowRecords.push_back(record);
+        index.clear();
+        strings.clear();
     }
     
     
-    // Removes a borrow record.
-    void removeBorrowedBook(int bookId)
+    size_t footprintBytes() const
     {
-        auto it = remove_if(borrowRecords.begin(), borrowRecords.end(),
-            [bookId](const BorrowRecord & r)
-            {
-                return r.bookId == bookId;
-            }
-        );
-        if (it != borrowRecords.end())
+        size_t bytes = strings.size() * sizeof(string) + hashTableBytes(index);
+        for (const auto & s : strings)
         {
-            borrowRecords.erase(it, borrowRecords.end());
+            bytes += stringHeapBytes(s);
         }
+        return bytes;
     }
+};
+
+
+// Struct: TitleRecord
+// Bibliographic data shared by every copy of a title.
+struct TitleRecord
+{
+    string title;
+    uint32_t author;        // Index into the catalog's name pool.
+    uint32_t publisher;     // Index into the catalog's name pool.
+    int year;
+    string ISBN;
+};
+
+
+// Struct: SearchHit
+// A title matched by a search and its relevance score.
+struct SearchHit
+{
+    uint32_t title;
+    int score;
+};
+
+
+// Class: TitleSearchIndex
+// Inverted index from the words of each title's title, author, publisher
+// and ISBN to the titles that contain them. Words are lower-cased, split
+// on anything but letters, digits and hyphens, and hyphens are dropped (so
+// "978-0-13" and "978013" are the same word). '+' and '#' after the start
+// of a word stay part of it, so "C++" and "C#" are words of their own and
+// do not turn into the prefix "c". Tokens are kept sorted, so a
+// query word matches every token it is a prefix of with one range scan.
+class TitleSearchIndex
+{
+private:
+    // Fields a token occurs in, as bits of Posting::fields.
+    static constexpr uint8_t titleField = 1;
+    static constexpr uint8_t authorField = 2;
+    static constexpr uint8_t publisherField = 4;
+    static constexpr uint8_t isbnField = 8;
     
-    
-    // Adds a fine.
-    void addFine(double fine)
+    struct Posting
     {
-        fineDue += fine;
-    }
+        uint32_t title;
+        uint8_t fields;
+    };
     
+    map<string, vector<Posting>, less<>> postings;     // Token -> postings in title order.
     
-    // Resets the fine amount.
-    void resetFine()
+    
+    // Appends the words of text to out, lower-cased.
+    template <typename Out>
+    static void splitWords(string_view text, Out & out)
     {
-        fineDue = 0;
+        string word;
+        for (char ch : text)
+        {
+            unsigned char c = static_cast<unsigned char>(ch);
+            if (isalnum(c) || ((c == '+' || c == '#') && !word.empty()))
+            {
+                word += static_cast<char>(tolower(c));
+            }
+            else if (c != '-' && !word.empty())
+            {
+                out.push_back(move(word));
+                word.clear();
+            }
+        }
+        if (!word.empty())
+        {
+            out.push_back(move(word));
+        }
     }
     
     
-    // Resets borrow timestamps to current time.
-    void resetBorrowTimestamps()
+    // Collects the distinct tokens of one title, with the fields they occur in, into tokens.
+    static void titleTokens(string_view title, string_view author, string_view publisher, string_view ISBN,
+                            vector<pair<string, uint8_t>> & tokens)
     {
-        time_t now = time(0);
-        for (auto & record : borrowRecords)
+        struct Tagged
         {
-            record.borrowTimestamp = now;
+            vector<pair<string, uint8_t>> & tokens;
+            uint8_t field;
+            
+            void push_back(string && word)
+            {
+                tokens.emplace_back(move(word), field);
+            }
+        };
+        tokens.clear();
+        for (auto field : { make_pair(title, titleField), make_pair(author, authorField),
+                            make_pair(publisher, publisherField), make_pair(ISBN, isbnField) })
+        {
+            Tagged out{ tokens, field.second };
+            splitWords(field.first, out);
+        }
+        sort(tokens.begin(), tokens.end());
+        size_t kept = 0;
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            if (kept > 0 && tokens[kept - 1].first == tokens[i].first)
+            {
+                tokens[kept - 1].second |= tokens[i].second;
+            }
+            else if (kept++ != i)
+            {
+                tokens[kept - 1] = move(tokens[i]);
+            }
         }
+        tokens.resize(kept);
     }
     
     
-    // Prints account details.
-    void printAccountDetails() const
+    // A match in a more specific field ranks higher.
+    static int fieldWeight(uint8_t fields)
     {
-        cout << "Borrowed Books:" << endl;
-        time_t now = time(0);
-        bool nonOverdueFound = false;
-        for (const auto & record : borrowRecords)
+        return (fields & isbnField) ? 8 : (fields & titleField) ? 4 : (fields & authorField) ? 3 : 1;
+    }
+    
+    
+public:
+    // Splits text into lower-case search words.
+    static vector<string> words(string_view text)
+    {
+        vector<string> result;
+        splitWords(text, result);
+        return result;
+    }
+    
+    
+    void add(uint32_t t, string_view title, string_view author, string_view publisher, string_view ISBN)
+    {
+        vector<pair<string, uint8_t>> tokens;
+        titleTokens(title, author, publisher, ISBN, tokens);
+        for (auto & token : tokens)
         {
-            int daysElapsed = static_cast<int>(difftime(now, record.borrowTimestamp) / 86400);
-            if (daysElapsed <= record.borrowDays)
+            auto it = postings.find(token.first);
+            if (it == postings.end())
             {
-                cout << "Book ID: " << record.bookId
-                     << ", Borrow Date: " << getTimeString(record.borrowTimestamp)
-                     << ", Intended Borrow Days: " << record.borrowDays
-                     << ", Days Elapsed: " << daysElapsed << endl;
-                nonOverdueFound = true;
+                it = postings.emplace(move(token.first), vector<Posting>()).first;
             }
+            vector<Posting> & list = it->second;
+            auto pos = lower_bound(list.begin(), list.end(), t, [](const Posting & p, uint32_t title) { return p.title < title; });
+            list.insert(pos, Posting{ t, token.second });
         }
-        if (!nonOverdueFound)
+    }
+    
+    
+    // Removes title t; the fields must be the ones it was added with.
+    void remove(uint32_t t, string_view title, string_view author, string_view publisher, string_view ISBN)
+    {
+        vector<pair<string, uint8_t>> tokens;
+        titleTokens(title, author, publisher, ISBN, tokens);
+        for (const auto & token : tokens)
         {
-            cout << "No currently borrowed (non-overdue) books." << endl;
+            auto it = postings.find(token.first);
+            if (it == postings.end())
+            {
+                continue;
+            }
+            vector<Posting> & list = it->second;
+            auto pos = lower_bound(list.begin(), list.end(), t, [](const Posting & p, uint32_t title) { return p.title < title; });
+            if (pos != list.end() && pos->title == t)
+            {
+                list.erase(pos);
+            }
+            if (list.empty())
+            {
+                postings.erase(it);
+            }
         }
-        cout << "\nOverdue Books:" << endl;
-        bool overdueFound = false;
-        for (const auto & record : borrowRecords)
+    }
+    
+    
+    void clear()
+    {
+        postings.clear();
+    }
+    
+    
+    // Replaces the contents with titles 0 .. count-1 in one pass, which is
+    // much cheaper than adding them one at a time. fieldsOf(t) returns
+    // title t's title, author, publisher and ISBN as a tuple of string_views.
+    template <typename FieldsFn>
+    void rebuild(uint32_t count, FieldsFn fieldsOf)
+    {
+        unordered_map<string, vector<Posting>> byToken;
+        byToken.reserve(count * 2);
+        vector<pair<string, uint8_t>> tokens;
+        for (uint32_t t = 0; t < count; t++)
         {
-            int daysElapsed = static_cast<int>(difftime(now, record.borrowTimestamp) / 86400);
-            if (daysElapsed > record.borrowDays)
+            auto fields = fieldsOf(t);
+            titleTokens(get<0>(fields), get<1>(fields), get<2>(fields), get<3>(fields), tokens);
+            for (auto & token : tokens)
             {
-                cout << "Book ID: " << record.bookId
-                     << ", Borrow Date: " << getTimeString(record.borrowTimestamp)
-                     << ", Intended Borrow Days: " << record.borrowDays
-                     << ", Days Elapsed: " << daysElapsed << endl;
-                overdueFound = true;
+                byToken[move(token.first)].push_back(Posting{ t, token.second });
             }
         }
-        if (!overdueFound)
+        vector<pair<string, vector<Posting>>> sorted(make_move_iterator(byToken.begin()), make_move_iterator(byToken.end()));
+        byToken.clear();
+        sort(sorted.begin(), sorted.end(), [](const auto & a, const auto & b) { return a.first < b.first; });
+        postings.clear();
+        for (auto & entry : sorted)
         {
-            cout << "No overdue books." << endl;
+            postings.emplace_hint(postings.end(), move(entry.first), move(entry.second));
         }
-        cout << "Fine Due: " << fineDue << " rupees" << endl;
     }
     
     
-    // Serializes account data.
-    string serialize() const
+    size_t tokenCount() const
     {
-        ostringstream oss;
-        oss << fineDue;
-        for (const auto & record : borrowRecords)
-        {
-            oss << ";" << record.bookId << "," << record.borrowTimestamp << "," << record.borrowDays;
-        }
-        return oss.str();
+        return postings.size();
     }
     
     
-    // Deserializes account data.
-    void deserialize(const string & data)
+    // Returns the titles that match every word of query, in title order.
+    // A query word matches the tokens it is a prefix of; each word adds the
+    // weight of the best field it matched, doubled for a whole-word match.
+    vector<SearchHit> match(string_view query) const
     {
-        borrowRecords.clear();
-        try
+        vector<string> queryWords = words(query);
+        sort(queryWords.begin(), queryWords.end());
+        queryWords.erase(unique(queryWords.begin(), queryWords.end()), queryWords.end());
+        vector<SearchHit> result;
+        vector<SearchHit> hits;
+        vector<SearchHit> merged;
+        for (size_t w = 0; w < queryWords.size(); w++)
         {
-            istringstream iss(data);
-            string token;
-            getline(iss, token, ';');
-            fineDue = stod(token);
-            while (getline(iss, token, ';'))
+            const string & word = queryWords[w];
+            hits.clear();
+            size_t tokens = 0;
+            for (auto it = postings.lower_bound(word); it != postings.end() && it->first.compare(0, word.size(), word) == 0; ++it)
+            {
+                int exact = (it->first.size() == word.size()) ? 2 : 1;
+                for (const Posting & p : it->second)
+                {
+                    hits.push_back(SearchHit{ p.title, fieldWeight(p.fields) * exact });
+                }
+                tokens++;
+            }
+            if (tokens > 1)
+            {
+                // Several tokens share the prefix: keep each title once, with its best score.
+                sort(hits.begin(), hits.end(), [](const SearchHit & a, const SearchHit & b)
+                    {
+                        return a.title < b.title || (a.title == b.title && a.score > b.score);
+                    }
+                );
+                hits.erase(unique(hits.begin(), hits.end(), [](const SearchHit & a, const SearchHit & b) { return a.title == b.title; }),
+                           hits.end());
+            }
+            if (w == 0)
+            {
+                result.swap(hits);
+            }
+            else
+            {
+                merged.clear();
+                size_t i = 0;
+                size_t j = 0;
+                while (i < result.size() && j < hits.size())
+                {
+                    if (result[i].title < hits[j].title)
+                    {
+                        i++;
+                    }
+                    else if (hits[j].title < result[i].title)
+                    {
+                        j++;
+                    }
+                    else
+                    {
+                        merged.push_back(SearchHit{ result[i].title, result[i].score + hits[j].score });
+                        i++;
+                        j++;
+                    }
+                }
+                result.swap(merged);
+            }
+            if (result.empty())
             {
-                istringstream recordStream(token);
-                BorrowRecord record;
-                string part;
-                getline(recordStream, part, ',');
-                record.bookId = stoi(part);
-                getline(recordStream, part, ',');
-                record.borrowTimestamp = static_cast<time_t>(stoll(part));
-                getline(recordStream, part, ',');
-                record.borrowDays = stoi(part);
-                borrowRecords.push_back(record);
+                break;
             }
         }
-        catch (exception & e)
+        return result;
+    }
+    
+    
+    // Approximate memory used by the index.
+    size_t footprintBytes() const
+    {
+        size_t bytes = 0;
+        for (const auto & entry : postings)
         {
-            borrowRecords.clear();
-            fineDue = 0;
+            bytes += sizeof(entry) + 4 * sizeof(void*) + stringHeapBytes(entry.first) + entry.second.capacity() * sizeof(Posting);
         }
+        return bytes;
     }
 };
 
+// Struct: FuzzyHit
+// A title and its similarity to a typo-tolerant query, from 0 to 1.
+struct FuzzyHit
+{
+    uint32_t title;
+    float score;
+};
 
-// ========== Forward Declarations ==========
 
-class Library; // Forward declaration of Library for use in User display.
+// Struct: SharedCount
+// A title and the number of distinct trigrams it shares with a query.
+struct SharedCount
+{
+    uint32_t title;
+    uint16_t shared;
+};
 
-// ========== Class: User ==========
-class User
+
+// Struct: SimilarityKernel
+// Picks the candidates of a typo-tolerant query: appends every title
+// t < n with shared[t] >= minShared to out, in title order, and sets all
+// n counts back to zero for the next query.
+struct SimilarityKernel
 {
-protected:
-    int userId;
-    string username;
-    string password;
-    Account account;
-    
-public:
-    // Default constructor.
-    User()
-    : userId(0)
-    , username("")
-    , password("")
+    const char * name;
+    void (*collect)(uint16_t * shared, size_t n, uint16_t minShared, vector<SharedCount> & out);
+};
+
+
+// Function: collectSharedFrom()
+// The scalar loop, over titles from .. n-1.
+void collectSharedFrom(uint16_t * shared, size_t from, size_t n, uint16_t minShared, vector<SharedCount> & out)
+{
+    for (size_t t = from; t < n; t++)
     {
+        if (shared[t] >= minShared)
+        {
+            out.push_back(SharedCount{ static_cast<uint32_t>(t), shared[t] });
+        }
+        shared[t] = 0;
     }
-    
-    
-    // Parameterized constructor.
-    User(int id, const string & uname, const string & pwd)
-    : userId(id)
-    , username(uname)
-    , password(pwd)
-    {
+}
+
+
+// Function: collectSharedScalar()
+void collectSharedScalar(uint16_t * shared, size_t n, uint16_t minShared, vector<SharedCount> & out)
+{
+    collectSharedFrom(shared, 0, n, minShared, out);
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+// Function: collectSharedSSE2()
+// Compares eight counts at a time; most documents share nothing with the
+// query, so a block almost never needs a closer look.
+__attribute__((target("sse2")))
+void collectSharedSSE2(uint16_t * shared, size_t n, uint16_t minShared, vector<SharedCount> & out)
+{
+    const __m128i below = _mm_set1_epi16(static_cast<short>(minShared - 1));
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i * block = reinterpret_cast<__m128i *>(shared + i);
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpgt_epi16(_mm_loadu_si128(block), below)));
+        while (mask != 0)
+        {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            out.push_back(SharedCount{ static_cast<uint32_t>(i + bit / 2), shared[i + bit / 2] });
+            mask &= ~(3u << bit);
+        }
+        _mm_storeu_si128(block, zero);
+    }
+    collectSharedFrom(shared, i, n, minShared, out);
+}
+
+
+// Function: collectSharedAVX2()
+// As collectSharedSSE2(), sixteen counts at a time.
+__attribute__((target("avx2")))
+void collectSharedAVX2(uint16_t * shared, size_t n, uint16_t minShared, vector<SharedCount> & out)
+{
+    const __m256i below = _mm256_set1_epi16(static_cast<short>(minShared - 1));
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i * block = reinterpret_cast<__m256i *>(shared + i);
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpgt_epi16(_mm256_loadu_si256(block), below)));
+        while (mask != 0)
+        {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            out.push_back(SharedCount{ static_cast<uint32_t>(i + bit / 2), shared[i + bit / 2] });
+            mask &= ~(3u << bit);
+        }
+        _mm256_storeu_si256(block, zero);
     }
+    collectSharedFrom(shared, i, n, minShared, out);
+}
+#endif
+
+
+// Function: similarityKernels()
+// The kernels this CPU can run, best first; the last is always the scalar one.
+const vector<SimilarityKernel> & similarityKernels()
+{
+    static const vector<SimilarityKernel> kernels = []()
+    {
+        vector<SimilarityKernel> found;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            found.push_back(SimilarityKernel{ "avx2", &collectSharedAVX2 });
+        }
+        if (__builtin_cpu_supports("sse2"))
+        {
+            found.push_back(SimilarityKernel{ "sse2", &collectSharedSSE2 });
+        }
+#endif
+        found.push_back(SimilarityKernel{ "scalar", &collectSharedScalar });
+        return found;
+    }();
+    return kernels;
+}
+
+
+// Class: TrigramIndex
+// Typo-tolerant index over each title's title and author. Every word is
+// padded with a space at both ends and cut into overlapping three-letter
+// trigrams (" re", "ref", ..., "ng "), so a misspelt word still shares
+// most of its trigrams with the right one. A query counts, per title, the
+// distinct trigrams it shares with the query from the posting lists; a
+// SimilarityKernel keeps the titles sharing at least half of the query's
+// trigrams, which are scored by Dice similarity 2 * shared / (query + title).
+class TrigramIndex
+{
+private:
+    static const size_t maxQueryTrigrams = 256;     // Keeps shared counts far below 2^15.
     
+    unordered_map<uint32_t, vector<uint32_t>> postings;     // Trigram -> titles, ascending.
+    vector<uint16_t> trigramCounts;                         // Title -> distinct trigrams (0 if not indexed).
     
-    virtual ~User()
+    
+    // Sets grams to the distinct trigrams of the given texts' words.
+    static void trigrams(initializer_list<string_view> texts, vector<uint32_t> & grams)
     {
+        grams.clear();
+        for (string_view text : texts)
+        {
+            for (const string & word : TitleSearchIndex::words(text))
+            {
+                string padded = " " + word + " ";
+                for (size_t i = 0; i + 3 <= padded.size(); i++)
+                {
+                    grams.push_back(static_cast<uint32_t>(static_cast<unsigned char>(padded[i])) << 16
+                                    | static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 8
+                                    | static_cast<unsigned char>(padded[i + 2]));
+                }
+            }
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
     }
     
     
-    int getUserId() const
+public:
+    void add(uint32_t t, string_view title, string_view author)
     {
-        return userId;
+        vector<uint32_t> grams;
+        trigrams({ title, author }, grams);
+        if (trigramCounts.size() <= t)
+        {
+            trigramCounts.resize(t + 1, 0);
+        }
+        trigramCounts[t] = static_cast<uint16_t>(min<size_t>(grams.size(), UINT16_MAX));
+        for (uint32_t gram : grams)
+        {
+            vector<uint32_t> & list = postings[gram];
+            auto pos = lower_bound(list.begin(), list.end(), t);
+            if (pos == list.end() || *pos != t)
+            {
+                list.insert(pos, t);
+            }
+        }
     }
     
     
-    string getUsername() const
+    // Removes title t; the fields must be the ones it was added with.
+    void remove(uint32_t t, string_view title, string_view author)
     {
-        return username;
+        vector<uint32_t> grams;
+        trigrams({ title, author }, grams);
+        for (uint32_t gram : grams)
+        {
+            auto it = postings.find(gram);
+            if (it == postings.end())
+            {
+                continue;
+            }
+            vector<uint32_t> & list = it->second;
+            auto pos = lower_bound(list.begin(), list.end(), t);
+            if (pos != list.end() && *pos == t)
+            {
+                list.erase(pos);
+            }
+            if (list.empty())
+            {
+                postings.erase(it);
+            }
+        }
+        if (t < trigramCounts.size())
+        {
+            trigramCounts[t] = 0;
+        }
     }
     
     
-    bool checkPassword(const string & pwd) const
+    void clear()
     {
-        return password == pwd;
+        postings.clear();
+        trigramCounts.clear();
     }
     
     
-    Account & getAccount()
+    // Replaces the contents with titles 0 .. count-1; fieldsOf(t) returns
+    // title t's title and author as a pair of string_views. Titles are
+    // added in order, so every posting list is appended to, never searched.
+    template <typename FieldsFn>
+    void rebuild(uint32_t count, FieldsFn fieldsOf)
     {
-        return account;
+        postings.clear();
+        trigramCounts.assign(count, 0);
+        vector<uint32_t> grams;
+        for (uint32_t t = 0; t < count; t++)
+        {
+            auto fields = fieldsOf(t);
+            trigrams({ fields.first, fields.second }, grams);
+            trigramCounts[t] = static_cast<uint16_t>(min<size_t>(grams.size(), UINT16_MAX));
+            for (uint32_t gram : grams)
+            {
+                postings[gram].push_back(t);
+            }
+        }
     }
     
     
-    // Declaration: Display user details, account info, and reserved books.
-    virtual void display(const Library & lib) const;
-    
-    
-    // Pure virtual functions for borrowing and returning books.
-    virtual void borrowBook(Library & lib) = 0;
-    virtual void returnBook(Library & lib) = 0;
-    
-    
-    // Serializes user data.
-    virtual string serialize() const
+    size_t trigramCount() const
     {
-        ostringstream oss;
-        oss << userId << ";" << username << ";" << password << ";" << account.serialize();
-        return oss.str();
+        return postings.size();
     }
     
     
-    // Deserializes user data.
-    virtual void deserialize(const string & data)
+    // Returns the titles similar to query, in title order, with their scores.
+    vector<FuzzyHit> match(string_view query, const SimilarityKernel & kernel) const
     {
-        istringstream iss(data);
-        string token;
-        getline(iss, token, ';');
-        userId = stoi(token);
-        getline(iss, username, ';');
-        username = trim(username);
-        getline(iss, password, ';');
-        password = trim(password);
-        string accData;
-        getline(iss, accData);
-        account.deserialize(accData);
+        vector<uint32_t> grams;
+        trigrams({ query }, grams);
+        if (grams.size() > maxQueryTrigrams)
+        {
+            grams.resize(maxQueryTrigrams);
+        }
+        vector<FuzzyHit> hits;
+        if (grams.empty())
+        {
+            return hits;
+        }
+        // Per-thread scratch counts, all zero between queries (the kernel clears them).
+        thread_local vector<uint16_t> shared;
+        if (shared.size() < trigramCounts.size())
+        {
+            shared.resize(trigramCounts.size(), 0);
+        }
+        for (uint32_t gram : grams)
+        {
+            auto it = postings.find(gram);
+            if (it != postings.end())
+            {
+                for (uint32_t t : it->second)
+                {
+                    shared[t]++;
+                }
+            }
+        }
+        vector<SharedCount> candidates;
+        uint16_t minShared = static_cast<uint16_t>((grams.size() + 1) / 2);
+        kernel.collect(shared.data(), trigramCounts.size(), minShared, candidates);
+        hits.reserve(candidates.size());
+        for (const SharedCount & c : candidates)
+        {
+            float score = 2.0f * c.shared / static_cast<float>(grams.size() + trigramCounts[c.title]);
+            hits.push_back(FuzzyHit{ c.title, score });
+        }
+        return hits;
     }
     
     
-    // Setters.
-    void setUsername(const string & uname)
+    // Approximate memory used by the index.
+    size_t footprintBytes() const
     {
-        username = uname;
+        size_t bytes = hashTableBytes(postings) + trigramCounts.capacity() * sizeof(uint16_t);
+        for (const auto & entry : postings)
+        {
+            bytes += entry.second.capacity() * sizeof(uint32_t);
+        }
+        return bytes;
     }
+};
+
+
+
+// Struct: CirculationState
+// One copy's circulation state as published to readers.
+struct CirculationState
+{
+    BookStatus status;
+    int borrowedBy;
+};
+
+
+// Struct: CirculationVersion
+// An immutable version of every copy's circulation state, in slot order.
+// Versions share pages: publishing a change copies only the page holding
+// the copy and the page table, so a version costs little to publish and
+// nothing to keep while readers hold older ones.
+struct CirculationVersion
+{
+    static const size_t pageSize = 1024;
+    uint64_t number = 0;
+    size_t copies = 0;
+    vector<shared_ptr<const vector<CirculationState>>> pages;
     
     
-    void setPassword(const string & pwd)
+    const CirculationState & at(size_t slot) const
     {
-        password = pwd;
+        return (*pages[slot / pageSize])[slot % pageSize];
     }
 };
 
 
-// ========== Class: Student ==========
-class Student : public User
+// Class: AtomicBitset
+// A resizable set of bits that threads may set and clear concurrently:
+// every word is atomic. Resizing needs exclusive use. The first 64 bits
+// live in the object, so small sets need no allocation.
+class AtomicBitset
 {
 private:
-    int maxBooks;    // 3 books maximum.
-    int maxDays;     // 15 days maximum.
-    double fineRate; // 10 rupees per overdue day.
+    atomic<uint64_t> first{ 0 };
+    unique_ptr<atomic<uint64_t>[]> rest;    // Words 1 .. wordCount()-1.
+    size_t bits = 0;
     
-public:
-    // Default constructor.
-    Student()
-    : User()
-    , maxBooks(3)
-    , maxDays(15)
-    , fineRate(10.0)
+    
+    static size_t wordsFor(size_t size)
     {
+        return max<size_t>(1, (size + 63) / 64);
     }
     
     
-    // Parameterized constructor.
-    Student(int id, const string & uname, const string & pwd)
-    : User(id, uname, pwd)
-    , maxBooks(3)
-    , maxDays(15)
-    , fineRate(10.0)
+    atomic<uint64_t> & word(size_t w)
     {
+        return w == 0 ? first : rest[w - 1];
     }
     
     
-    virtual void borrowBook(Library & lib) override;
-    virtual void returnBook(Library & lib) override;
+    const atomic<uint64_t> & word(size_t w) const
+    {
+        return w == 0 ? first : rest[w - 1];
+    }
     
-    // Function to reserve a book.
-    void reserveBook(Library & lib);
     
+public:
+    static const size_t npos = SIZE_MAX;
     
-    // Declaration: Display student details along with computed fine and reserved books.
-    virtual void display(const Library & lib) const override;
-};
-
-
-// ========== Class: Faculty ==========
-class Faculty : public User
-{
-private:
-    int maxBooks;    // 5 books maximum.
-    int maxDays;     // 30 days maximum.
     
-public:
-    // Default constructor.
-    Faculty()
-    : User()
-    , maxBooks(5)
-    , maxDays(30)
-    {
-    }
+    AtomicBitset() = default;
     
     
-    // Parameterized constructor.
-    Faculty(int id, const string & uname, const string & pwd)
-    : User(id, uname, pwd)
-    , maxBooks(5)
-    , maxDays(30)
+    AtomicBitset(AtomicBitset && other) noexcept
+    : first(other.first.load(memory_order_relaxed)), rest(move(other.rest)), bits(other.bits)
     {
+        other.bits = 0;
     }
     
     
-    virtual void borrowBook(Library & lib) override;
-    virtual void returnBook(Library & lib) override;
-    void reserveBook(Library & lib);
-    
-    // Declaration: Display faculty details.
-    virtual void display(const Library & lib) const override;
-};
-
-
-// ========== Class: Librarian ==========
-class Librarian : public User
-{
-public:
-    // Default constructor.
-    Librarian()
-    : User()
+    AtomicBitset & operator=(AtomicBitset && other) noexcept
     {
+        first.store(other.first.load(memory_order_relaxed), memory_order_relaxed);
+        rest = move(other.rest);
+        bits = other.bits;
+        other.bits = 0;
+        return *this;
     }
     
     
-    // Parameterized constructor.
-    Librarian(int id, const string & uname, const string & pwd)
-    : User(id, uname, pwd)
+    size_t size() const
     {
+        return bits;
     }
     
     
-    virtual void borrowBook(Library & lib) override
+    // Keeps bits below newSize; new bits are clear.
+    void resize(size_t newSize)
     {
-        cout << "Librarian cannot borrow books." << endl;
+        size_t oldWords = wordsFor(bits);
+        size_t newWords = wordsFor(newSize);
+        if (newWords != oldWords)
+        {
+            unique_ptr<atomic<uint64_t>[]> words;
+            if (newWords > 1)
+            {
+                words.reset(new atomic<uint64_t>[newWords - 1]);
+                for (size_t w = 1; w < newWords; w++)
+                {
+                    words[w - 1].store(w < oldWords ? rest[w - 1].load(memory_order_relaxed) : 0, memory_order_relaxed);
+                }
+            }
+            rest = move(words);
+        }
+        if (newSize < bits && newSize % 64 != 0)
+        {
+            word(newSize / 64).fetch_and((uint64_t(1) << (newSize % 64)) - 1, memory_order_relaxed);
+        }
+        bits = newSize;
     }
     
     
-    virtual void returnBook(Library & lib) override
+    void set(size_t i, bool value)
     {
-        cout << "Librarian does not return books." << endl;
+        uint64_t mask = uint64_t(1) << (i % 64);
+        if (value)
+        {
+            word(i / 64).fetch_or(mask, memory_order_relaxed);
+        }
+        else
+        {
+            word(i / 64).fetch_and(~mask, memory_order_relaxed);
+        }
     }
     
     
-    // Declaration: Display librarian details.
-    virtual void display(const Library & lib) const override;
+    bool test(size_t i) const
+    {
+        return (word(i / 64).load(memory_order_relaxed) >> (i % 64)) & 1;
+    }
     
     
-    // Administrative functions.
-    void addBook(Library & lib);
-    void removeBook(Library & lib);
-    void updateBook(Library & lib);
-    void addUser(Library & lib);
-    void removeUser(Library & lib);
-    void updateUser(Library & lib);
-};
-
-
-// ========== Forward Declarations for Portal Menus ==========
-void userPortalMenu(User * user, Library & lib);
-void librarianPortalMenu(Librarian * libUser, Library & lib);
-
-
-// ========== Class: Library ==========
-class Library
-{
-private:
-    vector<Book> books;         // Collection of books.
-    vector<User*> users;        // Collection of users.
-    vector<string> transactionLog;
-    const string booksFile = "books.txt";
-    const string usersFile = "users.txt";
-    const string logFile = "transactions.txt";
+    // Number of set bits, one popcount per word.
+    size_t count() const
+    {
+        size_t total = 0;
+        for (size_t w = 0, n = wordsFor(bits); w < n; w++)
+        {
+            total += static_cast<size_t>(__builtin_popcountll(word(w).load(memory_order_relaxed)));
+        }
+        return total;
+    }
     
     
-    // Loads default book data.
-    void loadDefaultBooks()
+    // Index of the lowest set bit, or npos.
+    size_t findFirst() const
     {
-        books.clear();
-        
-        vector<tuple<string, string, string, int, string>> defaultTitles = {
-            make_tuple("The C++ Programming Language", "Bjarne Stroustrup", "Addison-Wesley", 2013, "9780321563842"),
-            make_tuple("Effective C++", "Scott Meyers", "O'Reilly", 2005, "9780321334879"),
-            make_tuple("Clean Code", "Robert C. Martin", "Prentice Hall", 2008, "9780132350884"),
-            make_tuple("Design Patterns", "Erich Gamma et al.", "Addison-Wesley", 1994, "9780201633610"),
-            make_tuple("Modern Operating Systems", "Andrew Tanenbaum", "Pearson", 2014, "9780133591620"),
-            make_tuple("Introduction to Algorithms", "Cormen et al.", "MIT Press", 2009, "9780262033848"),
-            make_tuple("Artificial Intelligence: A Modern Approach", "Stuart Russell", "Pearson", 2009, "9780136042594"),
-            make_tuple("The Pragmatic Programmer", "Andrew Hunt", "Addison-Wesley", 1999, "9780201616224"),
-            make_tuple("Code Complete", "Steve McConnell", "Microsoft Press", 2004, "9780735619678"),
-            make_tuple("Refactoring", "Martin Fowler", "Addison-Wesley", 1999, "9780201485677")
-        };
-        
-        int newId = 1;
-        for (auto & tpl : defaultTitles)
+        for (size_t w = 0, n = wordsFor(bits); w < n; w++)
         {
-            for (int i = 0; i < 5; i++)
+            uint64_t value = word(w).load(memory_order_relaxed);
+            if (value != 0)
             {
-                Book book(newId, get<0>(tpl), get<1>(tpl), get<2>(tpl), get<3>(tpl), get<4>(tpl), BookStatus::Available);
-                books.push_back(book);
-                newId++;
+                return w * 64 + static_cast<size_t>(__builtin_ctzll(value));
             }
         }
+        return npos;
     }
     
     
-public:
-    // Constructor: Loads books, users, and transaction log.
-    Library()
+    // Heap memory beyond the object itself.
+    size_t heapBytes() const
     {
-        loadBooks();
-        loadUsers();
-        loadTransactionLog();
+        return (wordsFor(bits) - 1) * sizeof(uint64_t);
+    }
+};
+
+
+// Class: Catalog
+// Stores every copy column-wise. The circulation state that borrowing,
+// returning and most scans touch lives in dense parallel arrays (ids,
+// statuses, borrowers); each copy refers to a TitleRecord that holds the
+// bibliographic data once for all of its copies, and the title's
+// reservation queue. Titles are keyed by ISBN ("#" + title for books
+// without one), and author and publisher names are interned. A slot is a
+// copy's index in every column.
+class Catalog
+{
+private:
+    // Hot columns, one entry per copy.
+    vector<int> ids;
+    vector<BookStatus> statuses;
+    vector<int> borrowers;
+    vector<uint32_t> titleIds;              // Index into titles.
+    // Cold data, one entry per title.
+    vector<TitleRecord> titles;
+    unordered_multimap<string, uint32_t> titleByKey;   // titleKey() -> title. A key repeats only if the other fields disagree.
+    StringPool names;                       // Authors and publishers.
+    TitleSearchIndex searchIndex;           // Words of every title's fields (see search()).
+    TrigramIndex fuzzyIndex;                // Trigrams of every title's title and author (see fuzzySearch()).
+    bool searchStale = false;               // searchIndex and fuzzyIndex are out of date until rebuildSearchIndex().
+    unordered_map<int, size_t> slotById;    // Book ID -> slot. The first copy wins for duplicate IDs.
+    // Listing order: the copy IDs of each title (ascending), and the titles
+    // that have copies ordered by their lowest copy ID. Kept in step by
+    // every method that adds, removes or moves copies.
+    vector<vector<int>> copiesByTitle;
+    std::set<pair<int, uint32_t>> titleOrder;   // (lowest copy ID, title). Qualified: Catalog has a member named set.
+    // Bit i of availableByTitle[t] is set while copiesByTitle[t][i] is not
+    // lent out. Kept in step with the borrower column by setBorrowedBy();
+    // borrows of different copies of a title change it concurrently.
+    vector<AtomicBitset> availableByTitle;
+    // Per-user view of the borrower column, kept in step by every method
+    // that changes it.
+    unordered_map<int, vector<int>> loansByUser;          // Borrower ID -> book IDs.
+    // Guards the map itself: copies held by different users change
+    // concurrently in server mode. Each user's list is guarded by that
+    // user's lock in the Library (see Library::ItemLocks).
+    mutable mutex userIndexMutex;
+    // Reservation queues: the IDs of the users waiting for each title, in
+    // the order they reserved it. Only titles with someone waiting have an
+    // entry. The reservations themselves are kept in the users' accounts
+    // (see Account::addReservation()), which the Library rebuilds the
+    // queues from on loading. queueMutex guards the map; which queue
+    // entries may change under which item locks is described at enqueue().
+    unordered_map<uint32_t, deque<int>> queuesByTitle;
+    mutable mutex queueMutex;
+    // Reservations read from a catalog written before reservation queues,
+    // when each copy could be reserved for one user: book ID -> user ID.
+    // The Library moves them into the queues (see takeLegacyReservations()).
+    map<int, int> legacyReservations;
+    // The latest published circulation version (see snapshot()). Read and
+    // replaced with atomic_load()/atomic_store(); publishMutex serializes
+    // the publishers.
+    shared_ptr<const CirculationVersion> published = make_shared<const CirculationVersion>();
+    mutable mutex publishMutex;
+    bool publishStale = false;  // Copies were added, removed or overwritten since publishAll().
+    
+    
+    // Old files mark a reserved copy Reserved and name its reserver; the copy
+    // is simply on loan now and the reservation waits for the Library.
+    void noteLegacyReservation(int id, BookStatus & status, int reservedBy)
+    {
+        if (status == BookStatus::Reserved)
+        {
+            status = BookStatus::Borrowed;
+        }
+        if (reservedBy != 0)
+        {
+            legacyReservations[id] = reservedBy;
+        }
+        else if (!legacyReservations.empty())
+        {
+            legacyReservations.erase(id);
+        }
     }
     
     
-    // Destructor: Saves data and cleans up.
-    ~Library()
+    void addToUserIndex(unordered_map<int, vector<int>> & index, int userId, int bookId)
     {
-        saveBooks();
-        saveUsers();
-        saveTransactionLog();
-        for (auto user : users)
+        if (userId != 0)
         {
-            delete user;
+            lock_guard<mutex> lock(userIndexMutex);
+            index[userId].push_back(bookId);
         }
     }
     
     
-    // Loads books from file or defaults.
-    void loadBooks()
+    void removeFromUserIndex(unordered_map<int, vector<int>> & index, int userId, int bookId)
     {
-        books.clear();
-        ifstream fin(booksFile);
-        if (!fin || fin.peek() == ifstream::traits_type::eof())
+        lock_guard<mutex> lock(userIndexMutex);
+        auto it = index.find(userId);
+        if (userId == 0 || it == index.end())
         {
-            cout << "Books file not found or empty. Loading default books." << endl;
-            loadDefaultBooks();
             return;
         }
-        string line;
-        vector<Book> tempBooks;
-        while (getline(fin, line))
-        {
-            if (line.empty())
-            {
-                continue;
-            }
-            Book book;
-            book.deserialize(line);
-            tempBooks.push_back(book);
-        }
-        fin.close();
-        if (tempBooks.empty() || tempBooks[0].getTitle().empty())
+        vector<int> & bookIds = it->second;
+        auto pos = find(bookIds.begin(), bookIds.end(), bookId);
+        if (pos != bookIds.end())
         {
-            cout << "Books file data invalid. Loading default books." << endl;
-            loadDefaultBooks();
+            bookIds.erase(pos);
         }
-        else
+        if (bookIds.empty())
         {
-            books = tempBooks;
+            index.erase(it);
         }
     }
     
     
-    // Saves books to file.
-    void saveBooks()
+    const vector<int> & userIndexEntry(const unordered_map<int, vector<int>> & index, int userId) const
     {
-        ofstream fout(booksFile);
-        for (auto & book : books)
-        {
-            fout << book.serialize() << "\n";
-        }
-        fout.close();
+        static const vector<int> none;
+        lock_guard<mutex> lock(userIndexMutex);
+        auto it = index.find(userId);
+        return it == index.end() ? none : it->second;
     }
     
     
-    // Returns all reserved books for a given user.
-    vector<Book> getReservedBooksByUser(int userId) const
+    // An ISBN without its dashes and spaces, so "111-222" and "111222" meet.
+    static string isbnKey(string_view ISBN)
     {
-        vector<Book> reservedBooks;
-        for (const auto & book : books)
+        string key;
+        for (char c : ISBN)
         {
-            if (book.getReservedBy() == userId)
+            if (c != '-' && !isspace(static_cast<unsigned char>(c)))
             {
-                reservedBooks.push_back(book);
+                key += c;
             }
         }
-        return reservedBooks;
+        return key;
     }
     
     
-    // Prints book list with computed status.
-    void printBooksForUser(int currentUserId) const
+    // Key of a title in titleByKey: its isbnKey(), or "#" and the title if it has no ISBN.
+    static string titleKey(string_view title, string_view ISBN)
     {
-        cout << "\n********** Books List **********\n";
-        for (const auto & book : books)
+        return ISBN.empty() ? "#" + string(title) : isbnKey(ISBN);
+    }
+    
+    
+    // While the search index is stale (during a load) titles are not
+    // indexed one by one; rebuildSearchIndex() indexes them all at the end.
+    void indexWords(uint32_t t)
+    {
+        if (!searchStale)
         {
-            cout << "---------------------------------------" << endl;
-            cout << "Book ID: " << book.getId() << endl;
-            cout << "Title: " << book.getTitle() << endl;
-            cout << "Publisher: " << book.getPublisher() << endl;
-            cout << "Year: " << book.getYear() << endl;
-            cout << "ISBN: " << book.getISBN() << endl;
-            cout << "Status: ";
-            if (book.getBorrowedBy() == 0)
-            {
-                cout << "Available";
-            }
-            else if (book.getBorrowedBy() == currentUserId)
-            {
-                cout << "Borrowed";
-            }
-            else if (book.getReservedBy() != 0)
-            {
-                if (book.getReservedBy() == currentUserId)
-                {
-                    cout << "Reserved (For You)";
-                }
-                else
-                {
-                    cout << "Reserved";
-                }
-            }
-            else
-            {
-                cout << "Borrowed";
-            }
-            cout << "\n---------------------------------------\n";
+            const TitleRecord & rec = titles[t];
+            searchIndex.add(t, rec.title, names.get(rec.author), names.get(rec.publisher), rec.ISBN);
+            fuzzyIndex.add(t, rec.title, names.get(rec.author));
         }
     }
     
     
-    // Prints books currently borrowed by a user.
-    void printBorrowedBooksByUser(User * user) const
+    void unindexWords(uint32_t t)
     {
-        cout << "\n********** Your Borrowed Books **********\n";
-        vector<BorrowRecord> records = user->getAccount().getBorrowRecords();
-        bool found = false;
-        for (const auto & record : records)
+        if (!searchStale)
+        {
+            const TitleRecord & rec = titles[t];
+            searchIndex.remove(t, rec.title, names.get(rec.author), names.get(rec.publisher), rec.ISBN);
+            fuzzyIndex.remove(t, rec.title, names.get(rec.author));
+        }
+    }
+    
+    
+    void indexTitle(uint32_t t)
+    {
+        titleByKey.emplace(titleKey(titles[t].title, titles[t].ISBN), t);
+        indexWords(t);
+    }
+    
+    
+    void unindexTitle(uint32_t t)
+    {
+        unindexWords(t);
+        auto range = titleByKey.equal_range(titleKey(titles[t].title, titles[t].ISBN));
+        for (auto it = range.first; it != range.second; ++it)
         {
-            for (const auto & book : books)
+            if (it->second == t)
             {
-                if (book.getId() == record.bookId)
-                {
-                    book.printDetails();
-                    cout << "Borrow Date: " << getTimeString(record.borrowTimestamp)
-                         << ", Intended Borrow Days: " << record.borrowDays << endl;
-                    found = true;
-                }
+                titleByKey.erase(it);
+                return;
             }
         }
-        if (!found)
+    }
+    
+    
+    // Recomputes availableByTitle[t] from the borrower column.
+    void refreshAvailability(uint32_t t)
+    {
+        const vector<int> & copies = copiesByTitle[t];
+        AtomicBitset & available = availableByTitle[t];
+        available.resize(0);
+        available.resize(copies.size());
+        for (size_t i = 0; i < copies.size(); i++)
         {
-            cout << "You have not borrowed any books." << endl;
+            available.set(i, borrowers[slotOf(copies[i])] == 0);
         }
     }
     
     
-    // Loads users from file or default data.
-    void loadUsers()
+    // Adding copies in ID order (as loading does) only appends a bit.
+    void addToTitle(uint32_t t, int id)
     {
-        for (auto user : users)
+        if (copiesByTitle.size() <= t)
         {
-            delete user;
+            copiesByTitle.resize(t + 1);
+            availableByTitle.resize(t + 1);
         }
-        users.clear();
-        ifstream fin(usersFile);
-        if (!fin || fin.peek() == ifstream::traits_type::eof())
+        vector<int> & copies = copiesByTitle[t];
+        if (!copies.empty())
         {
-            cout << "Users file not found or empty. Loading default users." << endl;
-            users.push_back(new Student(1, "alice", "pass1"));
-            users.push_back(new Student(2, "bob", "pass2"));
-            users.push_back(new Student(3, "charlie", "pass3"));
-            users.push_back(new Student(4, "diana", "pass4"));
-            users.push_back(new Student(5, "eric", "pass5"));
-            users.push_back(new Faculty(6, "profX", "pass6"));
-            users.push_back(new Faculty(7, "drY", "pass7"));
-            users.push_back(new Faculty(8, "mrZ", "pass8"));
-            // Modified default librarians: three librarians with specified credentials.
-            users.push_back(new Librarian(9, "librarian1", "admin1"));
-            users.push_back(new Librarian(10, "librarian2", "admin2"));
-            users.push_back(new Librarian(11, "librarian3", "admin3"));
-            return;
+            titleOrder.erase({ copies.front(), t });
         }
-        string line;
-        while (getline(fin, line))
+        auto pos = copies.insert(upper_bound(copies.begin(), copies.end(), id), id);
+        titleOrder.insert({ copies.front(), t });
+        if (pos + 1 == copies.end())
         {
-            if (line.empty())
-            {
-                continue;
-            }
-            istringstream iss(line);
-            string type;
-            getline(iss, type, ';');
-            User * user = nullptr;
-            if (type == "Student")
-            {
-                user = new Student();
-            }
-            else if (type == "Faculty")
-            {
-                user = new Faculty();
-            }
-            else if (type == "Librarian")
-            {
-                user = new Librarian();
-            }
-            if (user)
-            {
-                string userData;
-                getline(iss, userData);
-                user->deserialize(userData);
-                users.push_back(user);
-            }
+            availableByTitle[t].resize(copies.size());
+            availableByTitle[t].set(copies.size() - 1, borrowers[slotOf(id)] == 0);
         }
-        fin.close();
-    }
-    
-    
-    void saveUsers()
-    {
-        ofstream fout(usersFile);
-        for (auto user : users)
+        else
         {
-            string type;
-            if (dynamic_cast<Student*>(user))
-            {
-                type = "Student";
-            }
-            else if (dynamic_cast<Faculty*>(user))
-            {
-                type = "Faculty";
-            }
-            else if (dynamic_cast<Librarian*>(user))
-            {
-                type = "Librarian";
-            }
-            fout << type << ";" << user->serialize() << "\n";
+            refreshAvailability(t);
         }
-        fout.close();
     }
     
     
-    // Loads transaction log.
-    void loadTransactionLog()
+    void removeFromTitle(uint32_t t, int id)
     {
-        transactionLog.clear();
-        ifstream fin(logFile);
-        if (!fin)
+        vector<int> & copies = copiesByTitle[t];
+        auto pos = lower_bound(copies.begin(), copies.end(), id);
+        if (pos == copies.end() || *pos != id)
         {
-            cout << "Transaction log file not found. Starting new log." << endl;
             return;
         }
-        string line;
-        while (getline(fin, line))
+        titleOrder.erase({ copies.front(), t });
+        bool last = (pos + 1 == copies.end());
+        copies.erase(pos);
+        if (!copies.empty())
         {
-            if (!line.empty())
-            {
-                transactionLog.push_back(line);
-            }
+            titleOrder.insert({ copies.front(), t });
+        }
+        if (last)
+        {
+            availableByTitle[t].resize(copies.size());
+        }
+        else
+        {
+            refreshAvailability(t);
         }
-        fin.close();
     }
     
     
-    void saveTransactionLog()
+public:
+    static const size_t npos = SIZE_MAX;
+    
+    
+    // Number of copies.
+    size_t size() const
     {
-        ofstream fout(logFile);
-        for (auto & entry : transactionLog)
-        {
-            fout << entry << "\n";
-        }
-        fout.close();
+        return ids.size();
     }
     
     
-    void logTransaction(const string & entry)
+    size_t titleCount() const
     {
-        time_t now = time(0);
-        string dt = getTimeString(now);
-        ostringstream oss;
-        oss << "[" << dt << "] " << entry;
-        transactionLog.push_back(oss.str());
-        saveTransactionLog();
+        return titles.size();
     }
     
     
-    void viewTransactionLog()
+    void clear()
     {
-        cout << "--------- Transaction Log ---------" << endl;
-        for (auto & entry : transactionLog)
-        {
-            cout << entry << endl;
-        }
-        cout << "-------------------------------------" << endl;
+        ids.clear();
+        statuses.clear();
+        borrowers.clear();
+        titleIds.clear();
+        titles.clear();
+        titleByKey.clear();
+        names.clear();
+        searchIndex.clear();
+        fuzzyIndex.clear();
+        searchStale = true;
+        slotById.clear();
+        copiesByTitle.clear();
+        titleOrder.clear();
+        availableByTitle.clear();
+        loansByUser.clear();
+        clearQueues();
+        legacyReservations.clear();
+        publishStale = true;
     }
     
     
-    void addBookToLibrary(const Book & book)
+    void reserve(size_t copies)
     {
-        books.push_back(book);
-        logTransaction("Book added: " + book.getTitle());
-        saveBooks();
+        ids.reserve(copies);
+        statuses.reserve(copies);
+        borrowers.reserve(copies);
+        titleIds.reserve(copies);
+        slotById.reserve(copies);
     }
     
     
-    void removeBookFromLibrary(int bookId)
+    // Returns the title with exactly these fields, adding it if it is new.
+    uint32_t internTitle(string_view title, string_view author, string_view publisher, int year, string_view ISBN)
     {
-        auto it = remove_if(books.begin(), books.end(),
-            [bookId](const Book & b)
+        auto range = titleByKey.equal_range(titleKey(title, ISBN));
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            const TitleRecord & rec = titles[it->second];
+            if (rec.title == title && names.get(rec.author) == author && names.get(rec.publisher) == publisher
+                && rec.year == year && rec.ISBN == ISBN)
             {
-                return b.getId() == bookId;
+                return it->second;
             }
-        );
-        if (it != books.end())
-        {
-            logTransaction("Book removed (ID): " + to_string(bookId));
-            books.erase(it, books.end());
-            saveBooks();
-        }
-        else
-        {
-            cout << "Book with ID " << bookId << " not found." << endl;
         }
+        titles.push_back(TitleRecord{ string(title), names.intern(author), names.intern(publisher), year, string(ISBN) });
+        uint32_t t = static_cast<uint32_t>(titles.size() - 1);
+        indexTitle(t);
+        return t;
+    }
+    
+    
+    // Appends a copy of title t and returns its slot. reservedBy is nonzero
+    // only for copies read from an old file (see takeLegacyReservations()).
+    size_t appendCopy(int id, uint32_t t, BookStatus status, int borrowedBy, int reservedBy)
+    {
+        noteLegacyReservation(id, status, reservedBy);
+        ids.push_back(id);
+        statuses.push_back(status);
+        borrowers.push_back(borrowedBy);
+        titleIds.push_back(t);
+        slotById.emplace(id, ids.size() - 1);
+        addToTitle(t, id);
+        addToUserIndex(loansByUser, borrowedBy, id);
+        publishStale = true;
+        return ids.size() - 1;
+    }
+    
+    
+    // Appends a copy and returns its slot.
+    size_t append(const Book & book)
+    {
+        uint32_t t = internTitle(book.title, book.author, book.publisher, book.year, book.ISBN);
+        return appendCopy(book.id, t, book.status, book.borrowedBy, book.reservedBy);
     }
     
     
-    Book* findBookByTitle(const string & title)
+    // Replaces the contents with books.
+    void assign(vector<Book> && books)
     {
-        for (auto & book : books)
+        clear();
+        reserve(books.size());
+        for (const auto & book : books)
         {
-            if (book.getTitle() == title)
-            {
-                return &book;
-            }
+            append(book);
         }
-        return nullptr;
+        books.clear();
     }
     
     
-    Book* findBookById(int id)
+    // Overwrites the copy in slot (which must hold the same ID).
+    void set(size_t slot, const Book & book)
     {
-        for (auto & book : books)
+        BookStatus status = book.status;
+        noteLegacyReservation(ids[slot], status, book.reservedBy);
+        statuses[slot] = status;
+        setBorrowedBy(slot, book.borrowedBy);
+        uint32_t t = internTitle(book.title, book.author, book.publisher, book.year, book.ISBN);
+        if (t != titleIds[slot])
         {
-            if (book.getId() == id)
-            {
-                return &book;
-            }
+            removeFromTitle(titleIds[slot], ids[slot]);
+            addToTitle(t, ids[slot]);
+            titleIds[slot] = t;
         }
-        return nullptr;
+        publishStale = true;
     }
     
     
-    int generateBookId()
+    // Removes a copy by ID. Returns false if it does not exist.
+    // The title stays; titles without copies are not saved.
+    bool remove(int id)
     {
-        int maxId = 0;
-        for (auto & book : books)
+        size_t slot = slotOf(id);
+        if (slot == npos)
         {
-            maxId = max(maxId, book.getId());
+            return false;
         }
-        return maxId + 1;
+        removeFromUserIndex(loansByUser, borrowers[slot], id);
+        legacyReservations.erase(id);
+        removeFromTitle(titleIds[slot], id);
+        slotById.erase(id);
+        ids.erase(ids.begin() + slot);
+        statuses.erase(statuses.begin() + slot);
+        borrowers.erase(borrowers.begin() + slot);
+        titleIds.erase(titleIds.begin() + slot);
+        shiftSlotIndex(slotById, slot, ids.size(), [this](size_t i) { return ids[i]; });
+        publishStale = true;
+        return true;
     }
     
     
-    void addUserToLibrary(User * user)
+    // Returns the slot holding a book ID, or npos.
+    size_t slotOf(int id) const
     {
-        users.push_back(user);
-        logTransaction("User added: " + user->getUsername());
-        saveUsers();
+        auto it = slotById.find(id);
+        return it == slotById.end() ? npos : it->second;
     }
     
     
-    void removeUserFromLibrary(int userId)
+    // Copies a slot out into a Book.
+    Book get(size_t slot) const
     {
-        auto it = remove_if(users.begin(), users.end(),
-            [userId](User * u)
-            {
-                return u->getUserId() == userId;
-            }
-        );
-        if (it != users.end())
-        {
-            for (auto itr = it; itr != users.end(); ++itr)
-            {
-                logTransaction("User removed: " + (*itr)->getUsername());
-                delete *itr;
-            }
-            users.erase(it, users.end());
-            saveUsers();
-        }
-        else
+        const TitleRecord & rec = titles[titleIds[slot]];
+        Book book(ids[slot], rec.title, names.get(rec.author), names.get(rec.publisher), rec.year, rec.ISBN, statuses[slot]);
+        book.borrowedBy = borrowers[slot];
+        return book;
+    }
+    
+    
+    // Column access.
+    const vector<int> & idColumn() const
+    {
+        return ids;
+    }
+    
+    
+    const vector<BookStatus> & statusColumn() const
+    {
+        return statuses;
+    }
+    
+    
+    const vector<int> & borrowerColumn() const
+    {
+        return borrowers;
+    }
+    
+    
+
+    const vector<uint32_t> & titleColumn() const
+    {
+        return titleIds;
+    }
+    
+    
+    int id(size_t slot) const
+    {
+        return ids[slot];
+    }
+    
+    
+    BookStatus status(size_t slot) const
+    {
+        return statuses[slot];
+    }
+    
+    
+    int borrowedBy(size_t slot) const
+    {
+        return borrowers[slot];
+    }
+    
+    
+
+    uint32_t titleOf(size_t slot) const
+    {
+        return titleIds[slot];
+    }
+    
+    
+    const TitleRecord & titleAt(uint32_t t) const
+    {
+        return titles[t];
+    }
+    
+    
+    // Returns an interned author or publisher name.
+    const string & name(uint32_t n) const
+    {
+        return names.get(n);
+    }
+    
+    
+    // Number of copies of title t.
+    size_t copyCount(uint32_t t) const
+    {
+        return t < copiesByTitle.size() ? copiesByTitle[t].size() : 0;
+    }
+    
+    
+    // IDs of the copies of title t, ascending.
+    const vector<int> & copiesOf(uint32_t t) const
+    {
+        static const vector<int> none;
+        return t < copiesByTitle.size() ? copiesByTitle[t] : none;
+    }
+    
+    
+    // Number of copies of title t that are not lent out (a popcount of its bits).
+    size_t availableCount(uint32_t t) const
+    {
+        return t < availableByTitle.size() ? availableByTitle[t].count() : 0;
+    }
+    
+    
+    // ID of the lowest copy of title t that is not lent out, or 0. Another
+    // borrower may take it before the caller locks it, so check again then.
+    int availableCopy(uint32_t t) const
+    {
+        if (t >= availableByTitle.size())
         {
-            cout << "User with ID " << userId << " not found." << endl;
+            return 0;
         }
+        size_t i = availableByTitle[t].findFirst();
+        return i == AtomicBitset::npos ? 0 : copiesByTitle[t][i];
     }
     
     
-    void updateUserInLibrary(int userId, const string & newUsername, const string & newPassword)
+    // Returns the titles with copies whose ISBN is key (dashes and spaces
+    // ignored) or, failing that, whose title is key ignoring case, in
+    // listing order. Titles are found through the search index, which must
+    // be up to date.
+    vector<uint32_t> titlesNamed(string_view key) const
     {
-        for (auto user : users)
+        vector<uint32_t> found;
+        auto range = titleByKey.equal_range(isbnKey(key));
+        for (auto it = range.first; it != range.second; ++it)
         {
-            if (user->getUserId() == userId)
+            if (!titles[it->second].ISBN.empty() && copyCount(it->second) > 0)
             {
-                if (!newUsername.empty())
-                {
-                    user->setUsername(newUsername);
-                }
-                if (!newPassword.empty())
+                found.push_back(it->second);
+            }
+        }
+        if (found.empty())
+        {
+            auto sameText = [key](const string & title)
+            {
+                return title.size() == key.size()
+                    && equal(title.begin(), title.end(), key.begin(), [](unsigned char a, unsigned char b) { return tolower(a) == tolower(b); });
+            };
+            for (const SearchHit & hit : searchIndex.match(key))
+            {
+                if (sameText(titles[hit.title].title) && copyCount(hit.title) > 0)
                 {
-                    user->setPassword(newPassword);
+                    found.push_back(hit.title);
                 }
-                logTransaction("User updated: " + user->getUsername());
-                saveUsers();
-                return;
             }
         }
-        cout << "User with ID " << userId << " not found." << endl;
+        sort(found.begin(), found.end(), [this](uint32_t a, uint32_t b) { return copiesByTitle[a].front() < copiesByTitle[b].front(); });
+        found.erase(unique(found.begin(), found.end()), found.end());
+        return found;
     }
     
     
-    User* authenticateUser(const string & uname, const string & pwd)
+    // Number of titles that have copies.
+    size_t listedTitleCount() const
     {
-        string tUname = trim(uname);
-        string tPwd = trim(pwd);
-        for (auto user : users)
-        {
-            if (user->getUsername() == tUname && user->checkPassword(tPwd))
-            {
-                return user;
-            }
-        }
-        return nullptr;
+        return titleOrder.size();
     }
     
     
-    void printAllBooks() const
+    // Listing order is by each title's lowest copy ID. Returns up to count
+    // titles whose lowest copy ID is above afterId, in order.
+    vector<uint32_t> titlesAfter(int afterId, size_t count) const
     {
-        cout << "\n********** Library Books **********\n";
-        for (const auto & book : books)
+        vector<uint32_t> page;
+        for (auto it = titleOrder.upper_bound({ afterId, UINT32_MAX }); it != titleOrder.end() && page.size() < count; ++it)
         {
-            book.printDetails();
-            cout << "Status: " << statusToString(book.getStatus()) << endl;
+            page.push_back(it->second);
         }
+        return page;
     }
     
     
-    void printAllUsers() const
+    // Returns up to count titles whose lowest copy ID is below beforeId, in order.
+    vector<uint32_t> titlesBefore(int beforeId, size_t count) const
     {
-        cout << "\n********** Library Users **********\n";
-        for (auto user : users)
+        vector<uint32_t> page;
+        for (auto it = titleOrder.lower_bound({ beforeId, 0 }); it != titleOrder.begin() && page.size() < count; )
         {
-            user->display(*this);
+            --it;
+            page.push_back(it->second);
         }
+        reverse(page.begin(), page.end());
+        return page;
     }
     
     
-    int generateUserId()
+    // True after clear() until rebuildSearchIndex().
+    bool needsSearchRebuild() const
     {
-        int maxId = 0;
-        for (auto user : users)
+        return searchStale;
+    }
+    
+    
+    // Indexes the words and trigrams of every title. Needs exclusive use of
+    // the titles; circulation may change meanwhile.
+    void rebuildSearchIndex()
+    {
+        searchIndex.rebuild(static_cast<uint32_t>(titles.size()), [this](uint32_t t)
+            {
+                const TitleRecord & rec = titles[t];
+                return make_tuple(string_view(rec.title), string_view(names.get(rec.author)),
+                                  string_view(names.get(rec.publisher)), string_view(rec.ISBN));
+            }
+        );
+        fuzzyIndex.rebuild(static_cast<uint32_t>(titles.size()), [this](uint32_t t)
+            {
+                return make_pair(string_view(titles[t].title), string_view(names.get(titles[t].author)));
+            }
+        );
+        searchStale = false;
+    }
+    
+    
+    // Returns up to limit titles with copies that match query (see
+    // TitleSearchIndex::match()), best first and ties in listing order,
+    // and sets matched to the number of such titles.
+    vector<uint32_t> search(string_view query, size_t limit, size_t & matched) const
+    {
+        vector<SearchHit> hits = searchIndex.match(query);
+        hits.erase(remove_if(hits.begin(), hits.end(), [this](const SearchHit & h) { return copyCount(h.title) == 0; }),
+                   hits.end());
+        matched = hits.size();
+        size_t shown = min(limit, hits.size());
+        partial_sort(hits.begin(), hits.begin() + shown, hits.end(), [this](const SearchHit & a, const SearchHit & b)
+            {
+                return a.score > b.score || (a.score == b.score && copiesByTitle[a.title].front() < copiesByTitle[b.title].front());
+            }
+        );
+        vector<uint32_t> result;
+        result.reserve(shown);
+        for (size_t i = 0; i < shown; i++)
         {
-            maxId = max(maxId, user->getUserId());
+            result.push_back(hits[i].title);
         }
-        return maxId + 1;
+        return result;
     }
     
     
-    User* findUserById(int id)
+    // Returns the limit titles with copies whose title and author are most
+    // like query despite typos (see TrigramIndex), best first and ties in
+    // listing order. A bounded heap keeps the best limit candidates seen.
+    vector<uint32_t> fuzzySearch(string_view query, size_t limit,
+                                 const SimilarityKernel & kernel = similarityKernels().front()) const
     {
-        for (auto user : users)
+        auto better = [this](const FuzzyHit & a, const FuzzyHit & b)
+        {
+            return a.score > b.score || (a.score == b.score && copiesByTitle[a.title].front() < copiesByTitle[b.title].front());
+        };
+        // The worst kept hit is on top.
+        priority_queue<FuzzyHit, vector<FuzzyHit>, decltype(better)> best(better);
+        for (const FuzzyHit & hit : fuzzyIndex.match(query, kernel))
         {
-            if (user->getUserId() == id)
+            if (limit == 0 || copyCount(hit.title) == 0)
+            {
+                continue;
+            }
+            if (best.size() < limit)
+            {
+                best.push(hit);
+            }
+            else if (better(hit, best.top()))
             {
-                return user;
+                best.pop();
+                best.push(hit);
             }
         }
-        return nullptr;
+        vector<uint32_t> result(best.size());
+        for (size_t i = result.size(); i-- > 0; best.pop())
+        {
+            result[i] = best.top().title;
+        }
+        return result;
     }
-};
-
-
-// ========== Out-of-line Definitions for Display Functions ==========
-
-void User::display(const Library & lib) const
-{
-    cout << "=====================================" << endl;
-    cout << "User ID: " << userId << endl;
-    cout << "Username: " << username << endl;
-    account.printAccountDetails();
-    vector<Book> reservedBooks = lib.getReservedBooksByUser(userId);
-    cout << "\nReserved Books:" << endl;
-    if (reservedBooks.empty())
+    
+    
+    void setStatus(size_t slot, BookStatus status)
     {
-        cout << "No reserved books." << endl;
+        statuses[slot] = status;
     }
-    else
+    
+    
+    void setBorrowedBy(size_t slot, int userId)
     {
-        for (const auto & book : reservedBooks)
+        if (borrowers[slot] != userId)
         {
-            cout << "Book ID: " << book.getId() << ", Title: " << book.getTitle() << endl;
+            removeFromUserIndex(loansByUser, borrowers[slot], ids[slot]);
+            addToUserIndex(loansByUser, userId, ids[slot]);
+            if ((borrowers[slot] == 0) != (userId == 0))
+            {
+                const vector<int> & copies = copiesByTitle[titleIds[slot]];
+                size_t i = static_cast<size_t>(lower_bound(copies.begin(), copies.end(), ids[slot]) - copies.begin());
+                if (i < copies.size() && copies[i] == ids[slot])
+                {
+                    availableByTitle[titleIds[slot]].set(i, userId == 0);
+                }
+            }
+            borrowers[slot] = userId;
         }
     }
-    cout << "=====================================" << endl;
-}
-
-void Student::display(const Library & lib) const
-{
-    cout << "----- Student Portal -----" << endl;
-    time_t now = time(0);
-    double computedFine = 0;
-    for (const auto & record : account.getBorrowRecords())
+    
+    
+    // IDs of the copies a user has borrowed, in the order they were taken.
+    const vector<int> & booksBorrowedBy(int userId) const
     {
-        int daysElapsed = static_cast<int>(difftime(now, record.borrowTimestamp) / 86400);
-        if (daysElapsed > 15)
-        {
-            computedFine += (daysElapsed - 15) * fineRate;
-        }
+        return userIndexEntry(loansByUser, userId);
     }
-    cout << "User ID: " << userId << "\nUsername: " << username << endl;
-    account.printAccountDetails();
-    cout << "Computed Overdue Fine (for active borrows): " << computedFine << " rupees" << endl;
-    vector<Book> reservedBooks = lib.getReservedBooksByUser(userId);
-    cout << "\nReserved Books:" << endl;
-    if (reservedBooks.empty())
+    
+    
+    // ---------- Reservation queues ----------
+    // The Library's item locks keep each queue consistent with its title's
+    // copies: a user joins a queue holding the locks of every copy of the
+    // title (so no copy comes back meanwhile), and the head leaves it when
+    // a copy is handed to them, under that user's lock. queueMutex only
+    // guards the map against changes to other titles' queues.
+    
+    // Adds a user to the back of title t's queue. Returns their position (from 1).
+    size_t enqueue(uint32_t t, int userId)
     {
-        cout << "No reserved books." << endl;
+        lock_guard<mutex> lock(queueMutex);
+        deque<int> & queue = queuesByTitle[t];
+        queue.push_back(userId);
+        return queue.size();
     }
-    else
+    
+    
+    // Removes a user from title t's queue: O(1) for the head. Returns false
+    // if they were not in it.
+    bool dequeue(uint32_t t, int userId)
     {
-        for (const auto & book : reservedBooks)
+        lock_guard<mutex> lock(queueMutex);
+        auto it = queuesByTitle.find(t);
+        if (it == queuesByTitle.end())
+        {
+            return false;
+        }
+        deque<int> & queue = it->second;
+        auto pos = find(queue.begin(), queue.end(), userId);
+        if (pos == queue.end())
+        {
+            return false;
+        }
+        queue.erase(pos);
+        if (queue.empty())
         {
-            cout << "Book ID: " << book.getId() << ", Title: " << book.getTitle() << endl;
+            queuesByTitle.erase(it);
         }
+        return true;
     }
-    cout << "-------------------------------------" << endl;
-}
-
-void Faculty::display(const Library & lib) const
-{
-    cout << "----- Faculty Portal -----" << endl;
-    User::display(lib);
-}
-
-void Librarian::display(const Library & lib) const
-{
-    cout << "----- Librarian Portal -----" << endl;
-    User::display(lib);
-}
-
-
-// ========== Implementation of Student Member Functions ==========
-
-void Student::borrowBook(Library & lib)
-{
-    if (account.getFine() > 0)
+    
+    
+    // The user first in title t's queue, or 0 if nobody is waiting.
+    int queueHead(uint32_t t) const
     {
-        cout << "Outstanding fine of " << account.getFine() << " rupees. Please pay fine before borrowing." << endl;
-        return;
+        lock_guard<mutex> lock(queueMutex);
+        auto it = queuesByTitle.find(t);
+        return it == queuesByTitle.end() ? 0 : it->second.front();
     }
-    if (account.getBorrowRecords().size() >= (size_t)maxBooks)
+    
+    
+    size_t queueLength(uint32_t t) const
     {
-        cout << "Borrowing limit reached (" << maxBooks << " books maximum). No further books can be borrowed." << endl;
-        return;
+        lock_guard<mutex> lock(queueMutex);
+        auto it = queuesByTitle.find(t);
+        return it == queuesByTitle.end() ? 0 : it->second.size();
     }
-    cout << "Enter the Book ID to borrow: ";
-    int bookId;
-    cin >> bookId;
-    Book* book = lib.findBookById(bookId);
-    if (!book)
+    
+    
+    // A user's position in title t's queue (from 1), or 0 if they are not
+    // in it. length is set to the queue's length.
+    size_t queuePosition(uint32_t t, int userId, size_t & length) const
     {
-        cout << "Book not found." << endl;
-        return;
+        lock_guard<mutex> lock(queueMutex);
+        auto it = queuesByTitle.find(t);
+        length = 0;
+        if (it == queuesByTitle.end())
+        {
+            return 0;
+        }
+        const deque<int> & queue = it->second;
+        length = queue.size();
+        auto pos = find(queue.begin(), queue.end(), userId);
+        return pos == queue.end() ? 0 : static_cast<size_t>(pos - queue.begin()) + 1;
     }
-    if (book->getBorrowedBy() != 0)
+    
+    
+    // The users waiting for title t, head first.
+    vector<int> queueOf(uint32_t t) const
     {
-        cout << "Book is not available." << endl;
-        return;
+        lock_guard<mutex> lock(queueMutex);
+        auto it = queuesByTitle.find(t);
+        return it == queuesByTitle.end() ? vector<int>() : vector<int>(it->second.begin(), it->second.end());
     }
-    cout << "Enter number of days to borrow (maximum " << maxDays << "): ";
-    int days;
-    cin >> days;
-    if (days > maxDays)
+    
+    
+    // Empties title t's queue (when its last copy is removed).
+    void dropQueue(uint32_t t)
     {
-        cout << "Borrowing period exceeds the maximum allowed for students." << endl;
-        return;
+        lock_guard<mutex> lock(queueMutex);
+        queuesByTitle.erase(t);
     }
-    book->updateStatus(BookStatus::Borrowed);
-    book->updateBorrowedBy(this->getUserId());
-    account.addBorrowedBook(book->getId(), days);
-    cout << "Book \"" << book->getTitle() << "\" successfully borrowed for " << days << " days." << endl;
-    lib.logTransaction("Student " + getUsername() + " borrowed book \"" + book->getTitle() + "\" for " + to_string(days) + " days.");
-    lib.saveBooks();
-}
-
-void Student::reserveBook(Library & lib)
-{
-    cout << "Enter the Book ID to reserve: ";
-    int bookId;
-    cin >> bookId;
-    Book* book = lib.findBookById(bookId);
-    if (!book)
+    
+    
+    void clearQueues()
     {
-        cout << "Book not found." << endl;
-        return;
+        lock_guard<mutex> lock(queueMutex);
+        queuesByTitle.clear();
     }
-    if (book->getStatus() != BookStatus::Borrowed)
+    
+    
+    // Hands over the reservations read from an old catalog as (book ID,
+    // user ID) pairs in book ID order, and forgets them.
+    vector<pair<int, int>> takeLegacyReservations()
     {
-        cout << "You can only reserve a book that is currently borrowed." << endl;
-        return;
+        vector<pair<int, int>> taken(legacyReservations.begin(), legacyReservations.end());
+        legacyReservations.clear();
+        return taken;
     }
-    if (book->getReservedBy() != 0)
+    
+    
+    // Title edits apply to every copy of the title.
+    void setTitleText(uint32_t t, const string & newTitle)
     {
-        cout << "Book is already reserved by another user." << endl;
-        return;
+        unindexTitle(t);
+        titles[t].title = newTitle;
+        indexTitle(t);
     }
-    if (book->getBorrowedBy() == this->getUserId())
+    
+    
+    void setAuthor(uint32_t t, const string & newAuthor)
     {
-        cout << "You have already borrowed this book; reservation not allowed." << endl;
-        return;
+        unindexWords(t);
+        titles[t].author = names.intern(newAuthor);
+        indexWords(t);
     }
-    book->updateReservedBy(this->getUserId());
-    book->updateStatus(BookStatus::Reserved);
-    cout << "Book \"" << book->getTitle() << "\" reserved successfully. It will be automatically borrowed for you upon return." << endl;
-    lib.logTransaction("Student " + getUsername() + " reserved book \"" + book->getTitle() + "\".");
-    lib.saveBooks();
-}
-
-void Student::returnBook(Library & lib)
-{
-    lib.printBorrowedBooksByUser(this);
-    cout << "Enter the Book ID to return: ";
-    int bookId;
-    cin >> bookId;
-    Book* book = lib.findBookById(bookId);
-    if (!book)
+    
+    
+    void setPublisher(uint32_t t, const string & newPublisher)
     {
-        cout << "Book not found." << endl;
-        return;
+        unindexWords(t);
+        titles[t].publisher = names.intern(newPublisher);
+        indexWords(t);
     }
-    vector<BorrowRecord> records = account.getBorrowRecords();
-    bool found = false;
-    int intendedDays = -1;
-    time_t borrowTime;
-    for (const auto & record : records)
+    
+    
+    void setYear(uint32_t t, int newYear)
+    {
+        titles[t].year = newYear;
+    }
+    
+    
+    // Moves the copy in slot to the title with newISBN. If there is no such
+    // title yet, one is created from the copy's current title.
+    void relinkISBN(size_t slot, const string & newISBN)
     {
-        if (record.bookId == book->getId())
+        const TitleRecord current = titles[titleIds[slot]];
+        auto range = titleByKey.equal_range(titleKey(current.title, newISBN));
+        auto it = find_if(range.first, range.second, [this, &newISBN](const pair<const string, uint32_t> & entry)
+            {
+                return titles[entry.second].ISBN == newISBN;
+            }
+        );
+        removeFromTitle(titleIds[slot], ids[slot]);
+        if (it != range.second)
         {
-            intendedDays = record.borrowDays;
-            borrowTime = record.borrowTimestamp;
-            found = true;
-            break;
+            titleIds[slot] = it->second;
         }
+        else
+        {
+            titles.push_back(TitleRecord{ current.title, current.author, current.publisher, current.year, newISBN });
+            titleIds[slot] = static_cast<uint32_t>(titles.size() - 1);
+            indexTitle(titleIds[slot]);
+        }
+        addToTitle(titleIds[slot], ids[slot]);
     }
-    if (!found)
+    
+    
+    // ---------- Snapshots ----------
+    // Readers take the latest CirculationVersion with snapshot() and iterate
+    // it without locks. Writers change the columns as usual and then publish
+    // the copy they changed, so each version holds whole operations.
+    
+    // Publishes the current state of the copy in slot as a new version.
+    // The caller holds the copy's lock and no copies are being added or removed.
+    void publish(size_t slot)
     {
-        cout << "You did not borrow this book." << endl;
-        return;
+        lock_guard<mutex> lock(publishMutex);
+        shared_ptr<const CirculationVersion> current = atomic_load(&published);
+        if (publishStale || slot >= current->copies)
+        {
+            return;     // publishAll() will pick it up.
+        }
+        size_t page = slot / CirculationVersion::pageSize;
+        auto copy = make_shared<vector<CirculationState>>(*current->pages[page]);
+        (*copy)[slot % CirculationVersion::pageSize] = CirculationState{ statuses[slot], borrowers[slot] };
+        auto next = make_shared<CirculationVersion>(*current);
+        next->number++;
+        next->pages[page] = move(copy);
+        atomic_store(&published, shared_ptr<const CirculationVersion>(move(next)));
     }
-    time_t now = time(0);
-    int elapsedDays = static_cast<int>(difftime(now, borrowTime) / 86400);
-    cout << "Book was kept for " << elapsedDays << " days." << endl;
-    int allowedDays = 15;
-    if (elapsedDays > allowedDays)
+    
+    
+    // True if copies were added, removed or overwritten since the last publishAll().
+    bool needsPublishAll() const
     {
-        int overdue = elapsedDays - allowedDays;
-        double fine = overdue * 10;
-        account.addFine(fine);
-        cout << "Book is overdue by " << overdue << " days. Fine of " << fine << " rupees imposed." << endl;
+        return publishStale;
     }
-    if (book->getReservedBy() != 0)
+    
+    
+    // Publishes every copy as a new version. Needs exclusive use of the catalog.
+    void publishAll()
     {
-        User* reservingUser = lib.findUserById(book->getReservedBy());
-        if (reservingUser != nullptr)
+        lock_guard<mutex> lock(publishMutex);
+        auto next = make_shared<CirculationVersion>();
+        next->number = atomic_load(&published)->number + 1;
+        next->copies = ids.size();
+        for (size_t first = 0; first < ids.size(); first += CirculationVersion::pageSize)
         {
-            int defaultDays = 15;
-            if (dynamic_cast<Faculty*>(reservingUser))
+            size_t last = min(ids.size(), first + CirculationVersion::pageSize);
+            auto page = make_shared<vector<CirculationState>>();
+            page->reserve(last - first);
+            for (size_t slot = first; slot < last; slot++)
             {
-                defaultDays = 30;
+                page->push_back(CirculationState{ statuses[slot], borrowers[slot] });
             }
-            book->updateStatus(BookStatus::Borrowed);
-            book->updateBorrowedBy(reservingUser->getUserId());
-            book->updateReservedBy(0);
-            reservingUser->getAccount().addBorrowedBook(book->getId(), defaultDays);
-            lib.logTransaction("Book \"" + book->getTitle() + "\" automatically borrowed by reserving user " + reservingUser->getUsername() + " for " + to_string(defaultDays) + " days upon return.");
-            cout << "Book reserved for you has been automatically borrowed upon return." << endl;
-        }
-        else
-        {
-            book->updateStatus(BookStatus::Available);
-            book->updateBorrowedBy(0);
+            next->pages.push_back(move(page));
+        }
+        atomic_store(&published, shared_ptr<const CirculationVersion>(move(next)));
+        publishStale = false;
+    }
+    
+    
+    // Returns the latest published version. It never changes, so it can be
+    // read without locks for as long as it is held.
+    shared_ptr<const CirculationVersion> snapshot() const
+    {
+        return atomic_load(&published);
+    }
+    
+    
+    // Approximate heap and object memory used by the catalog.
+    size_t footprintBytes() const
+    {
+        size_t bytes = ids.capacity() * sizeof(int) + statuses.capacity() * sizeof(BookStatus)
+                     + borrowers.capacity() * sizeof(int)
+                     + titleIds.capacity() * sizeof(uint32_t) + titles.capacity() * sizeof(TitleRecord)
+                     + hashTableBytes(titleByKey) + hashTableBytes(slotById) + names.footprintBytes()
+                     + hashTableBytes(loansByUser) + hashTableBytes(queuesByTitle) + searchIndex.footprintBytes()
+                     + fuzzyIndex.footprintBytes();
+        for (const auto & rec : titles)
+        {
+            bytes += stringHeapBytes(rec.title) + stringHeapBytes(rec.ISBN);
+        }
+        for (const auto & key : titleByKey)
+        {
+            bytes += stringHeapBytes(key.first);
+        }
+        for (const auto & entry : loansByUser)
+        {
+            bytes += entry.second.capacity() * sizeof(int);
+        }
+        {
+            lock_guard<mutex> lock(queueMutex);
+            for (const auto & entry : queuesByTitle)
+            {
+                bytes += entry.second.size() * sizeof(int);
+            }
+        }
+        bytes += copiesByTitle.capacity() * sizeof(vector<int>) + titleOrder.size() * (sizeof(pair<int, uint32_t>) + 4 * sizeof(void*));
+        for (const auto & copies : copiesByTitle)
+        {
+            bytes += copies.capacity() * sizeof(int);
+        }
+        bytes += availableByTitle.capacity() * sizeof(AtomicBitset);
+        for (const auto & available : availableByTitle)
+        {
+            bytes += available.heapBytes();
+        }
+        shared_ptr<const CirculationVersion> version = snapshot();
+        bytes += sizeof(CirculationVersion) + version->pages.capacity() * sizeof(version->pages[0]);
+        for (const auto & page : version->pages)
+        {
+            bytes += sizeof(*page) + page->capacity() * sizeof(CirculationState);
+        }
+        return bytes;
+    }
+};
+
+
+// Class: BookRef
+// A handle to one copy stored in a Catalog, with the same accessors and
+// update methods as Book. Evaluates to false when no copy was found.
+// Valid until the catalog gains or loses copies.
+// Title, author, publisher and year belong to the copy's title, so updating
+// them changes every copy; updating the ISBN moves this copy to the title
+// with that ISBN.
+class BookRef
+{
+private:
+    Catalog * catalog;
+    size_t slot;
+    
+    
+    const TitleRecord & record() const
+    {
+        return catalog->titleAt(catalog->titleOf(slot));
+    }
+    
+    
+public:
+    BookRef()
+    : catalog(nullptr)
+    , slot(0)
+    {
+    }
+    
+    
+    BookRef(Catalog & cat, size_t bookSlot)
+    : catalog(&cat)
+    , slot(bookSlot)
+    {
+    }
+    
+    
+    explicit operator bool() const
+    {
+        return catalog != nullptr;
+    }
+    
+    
+    int getId() const
+    {
+        return catalog->id(slot);
+    }
+    
+    
+    const string & getTitle() const
+    {
+        return record().title;
+    }
+    
+    
+    const string & getAuthor() const
+    {
+        return catalog->name(record().author);
+    }
+    
+    
+    const string & getPublisher() const
+    {
+        return catalog->name(record().publisher);
+    }
+    
+    
+    int getYear() const
+    {
+        return record().year;
+    }
+    
+    
+    const string & getISBN() const
+    {
+        return record().ISBN;
+    }
+    
+    
+    BookStatus getStatus() const
+    {
+        return catalog->status(slot);
+    }
+    
+    
+    int getBorrowedBy() const
+    {
+        return catalog->borrowedBy(slot);
+    }
+    
+    
+    // Index of the copy's title in the catalog.
+    uint32_t getTitleId() const
+    {
+        return catalog->titleOf(slot);
+    }
+    
+    
+    // Number of copies sharing this copy's title (including this one).
+    size_t getCopiesOfTitle() const
+    {
+        return catalog->copyCount(catalog->titleOf(slot));
+    }
+    
+    
+    void updateTitle(const string & newTitle)
+    {
+        catalog->setTitleText(catalog->titleOf(slot), newTitle);
+    }
+    
+    
+    void updateAuthor(const string & newAuthor)
+    {
+        catalog->setAuthor(catalog->titleOf(slot), newAuthor);
+    }
+    
+    
+    void updatePublisher(const string & newPublisher)
+    {
+        catalog->setPublisher(catalog->titleOf(slot), newPublisher);
+    }
+    
+    
+    void updateYear(int newYear)
+    {
+        catalog->setYear(catalog->titleOf(slot), newYear);
+    }
+    
+    
+    void updateISBN(const string & newISBN)
+    {
+        catalog->relinkISBN(slot, newISBN);
+    }
+    
+    
+    void updateStatus(BookStatus newStatus)
+    {
+        catalog->setStatus(slot, newStatus);
+    }
+    
+    
+    void updateBorrowedBy(int userId)
+    {
+        catalog->setBorrowedBy(slot, userId);
+    }
+    
+    
+    // Publishes the copy's circulation state to snapshot readers (see Catalog::publish()).
+    void publish() const
+    {
+        catalog->publish(slot);
+    }
+    
+    
+    // Prints the same block as Book::printDetails(). Reads only the ID and
+    // title data, so it needs no lock on the copy.
+    void printDetails(ostream & out) const
+    {
+        const TitleRecord & rec = record();
+        out << "---------------------------------------\n";
+        out << "Book ID: " << getId() << '\n';
+        out << "Title: " << rec.title << '\n';
+        out << "Publisher: " << catalog->name(rec.publisher) << '\n';
+        out << "Year: " << rec.year << '\n';
+        out << "ISBN: " << rec.ISBN << '\n';
+        out << "---------------------------------------\n";
+    }
+};
+
+
+// Class: BorrowRecord
+// Stores a borrow record.
+struct BorrowRecord
+{
+    int bookId;
+    time_t borrowTimestamp;
+    int borrowDays;
+    int finedDays;      // Overdue days already charged by the fine sweep.
+};
+
+
+// Struct: Reservation
+// A place in a title's reservation queue. The title is named by one of its
+// copies; seq numbers reservations in the order they were made across all
+// titles, so the queues can be rebuilt in order when users are loaded.
+struct Reservation
+{
+    int bookId;
+    uint64_t seq;
+};
+
+    
+// Class: Account
+// Manages borrow records, reservations and fines.
+class Account
+{
+private:
+    vector<BorrowRecord> borrowRecords;
+    vector<Reservation> reservations;
+    double fineDue;
+    
+public:
+    // Default constructor.
+    Account()
+    : fineDue(0.0)
+    {
+    }
+    
+    
+    // Returns borrow records.
+    const vector<BorrowRecord> & getBorrowRecords() const
+    {
+        return borrowRecords;
+    }
+    
+    
+    // Returns reservations, oldest first.
+    const vector<Reservation> & getReservations() const
+    {
+        return reservations;
+    }
+    
+    
+    // Returns current fine.
+    double getFine() const
+    {
+        return fineDue;
+    }
+    
+    
+    // Adds a new borrow record.
+    void addBorrowedBook(int bookId, int borrowDays)
+    {
+        BorrowRecord record;
+        record.bookId = bookId;
+        record.borrowTimestamp = time(0);
+        record.borrowDays = borrowDays;
+        record.finedDays = 0;
+        borrowRecords.push_back(record);
+    }
+    
+    
+    // Removes a borrow record.
+    void removeBorrowedBook(int bookId)
+    {
+        auto it = remove_if(borrowRecords.begin(), borrowRecords.end(),
+            [bookId](const BorrowRecord & r)
+            {
+                return r.bookId == bookId;
+            }
+        );
+        if (it != borrowRecords.end())
+        {
+            borrowRecords.erase(it, borrowRecords.end());
+        }
+    }
+    
+    
+    void addReservation(int bookId, uint64_t seq)
+    {
+        reservations.push_back(Reservation{ bookId, seq });
+    }
+    
+    
+    // Points the reservation naming oldBookId at newBookId, or removes it if
+    // newBookId is 0. Returns false if there is no such reservation.
+    bool changeReservation(int oldBookId, int newBookId)
+    {
+        for (auto it = reservations.begin(); it != reservations.end(); ++it)
+        {
+            if (it->bookId == oldBookId)
+            {
+                if (newBookId == 0)
+                {
+                    reservations.erase(it);
+                }
+                else
+                {
+                    it->bookId = newBookId;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    
+    // Adds a fine.
+    void addFine(double fine)
+    {
+        fineDue += fine;
+    }
+    
+    
+    // Resets the fine amount.
+    void resetFine()
+    {
+        fineDue = 0;
+    }
+    
+    
+    // Resets borrow timestamps to current time.
+    void resetBorrowTimestamps()
+    {
+        time_t now = time(0);
+        for (auto & record : borrowRecords)
+        {
+            record.borrowTimestamp = now;
+            record.finedDays = 0;
+        }
+    }
+    
+    
+    // Charges `rate` per day for every day a loan has been kept beyond
+    // allowedDays that has not been charged yet, and remembers the days
+    // charged so a later sweep or the return does not charge them again.
+    // Loans whose copy is no longer lent to userId in catalog are skipped.
+    // Returns the amount charged; loans is set to the number of loans charged.
+    double accrueOverdueFines(time_t now, int allowedDays, double rate, const Catalog & catalog, int userId, size_t & loans)
+    {
+        double charged = 0;
+        loans = 0;
+        for (auto & record : borrowRecords)
+        {
+            size_t slot = catalog.slotOf(record.bookId);
+            if (slot == Catalog::npos || catalog.borrowedBy(slot) != userId)
+            {
+                continue;
+            }
+            int overdue = static_cast<int>(difftime(now, record.borrowTimestamp) / 86400) - allowedDays;
+            if (overdue > record.finedDays)
+            {
+                charged += (overdue - record.finedDays) * rate;
+                record.finedDays = overdue;
+                loans++;
+            }
+        }
+        fineDue += charged;
+        return charged;
+    }
+    
+    
+    // Prints account details.
+    void printAccountDetails(ostream & out) const
+    {
+        // One pass: overdue lines are collected and printed after the rest.
+        out << "Borrowed Books:" << endl;
+        time_t now = time(0);
+        bool nonOverdueFound = false;
+        ostringstream overdue;
+        for (const auto & record : borrowRecords)
+        {
+            int daysElapsed = static_cast<int>(difftime(now, record.borrowTimestamp) / 86400);
+            ostream & line = (daysElapsed > record.borrowDays) ? static_cast<ostream &>(overdue) : out;
+            line << "Book ID: " << record.bookId
+                << ", Borrow Date: " << getTimeString(record.borrowTimestamp)
+                << ", Intended Borrow Days: " << record.borrowDays
+                << ", Days Elapsed: " << daysElapsed << "\n";
+            nonOverdueFound = nonOverdueFound || daysElapsed <= record.borrowDays;
+        }
+        if (!nonOverdueFound)
+        {
+            out << "No currently borrowed (non-overdue) books." << endl;
+        }
+        out << "\nOverdue Books:" << endl;
+        if (overdue.tellp() > 0)
+        {
+            out << overdue.str();
+        }
+        else
+        {
+            out << "No overdue books." << endl;
+        }
+        out << "Fine Due: " << fineDue << " rupees" << endl;
+    }
+    
+    
+    // Serializes account data.
+    string serialize() const
+    {
+        ostringstream oss;
+        oss << fineDue;
+        for (const auto & record : borrowRecords)
+        {
+            oss << ";" << record.bookId << "," << record.borrowTimestamp << "," << record.borrowDays;
+            if (record.finedDays != 0)
+            {
+                oss << "," << record.finedDays;
+            }
+        }
+        for (const auto & reservation : reservations)
+        {
+            oss << ";R" << reservation.bookId << "," << reservation.seq;
+        }
+        return oss.str();
+    }
+    
+    
+    // Deserializes account data:
+    // "fine;bookId,timestamp,days[,finedDays];...;RbookId,seq;...".
+    // On failure the account is left unchanged and error describes the bad field.
+    bool deserialize(string_view data, string & error)
+    {
+        FieldReader reader(data);
+        double newFine;
+        if (!reader.nextNumber(newFine, "fine", error))
+        {
+            return false;
+        }
+        vector<BorrowRecord> newRecords;
+        vector<Reservation> newReservations;
+        string_view field;
+        while (reader.next(field))
+        {
+            field = trimView(field);
+            if (field.empty())
+            {
+                continue;
+            }
+            if (field[0] == 'R')
+            {
+                FieldReader reservationReader(field.substr(1));
+                Reservation reservation;
+                if (!reservationReader.nextNumber(reservation.bookId, "reserved book ID", error, ',')
+                    || !reservationReader.nextNumber(reservation.seq, "reservation number", error, ','))
+                {
+                    return false;
+                }
+                newReservations.push_back(reservation);
+                continue;
+            }
+            FieldReader recordReader(field);
+            BorrowRecord record;
+            long long timestamp;
+            if (!recordReader.nextNumber(record.bookId, "borrowed book ID", error, ',')
+                || !recordReader.nextNumber(timestamp, "borrow timestamp", error, ',')
+                || !recordReader.nextNumber(record.borrowDays, "borrow days", error, ','))
+            {
+                return false;
+            }
+            record.finedDays = 0;
+            if (!recordReader.atEnd() && !recordReader.nextNumber(record.finedDays, "fined days", error, ','))
+            {
+                return false;
+            }
+            record.borrowTimestamp = static_cast<time_t>(timestamp);
+            newRecords.push_back(record);
+        }
+        fineDue = newFine;
+        borrowRecords = move(newRecords);
+        reservations = move(newReservations);
+        return true;
+    }
+};
+
+
+// ========== Forward Declarations ==========
+
+class Library; // Forward declaration of Library for use in User display.
+
+// ========== Class: User ==========
+class User
+{
+protected:
+    UserRole role;
+    int userId;
+    string username;
+    string password;
+    Account account;
+    
+    
+    // Default constructor.
+    explicit User(UserRole r)
+    : role(r)
+    , userId(0)
+    , username("")
+    , password("")
+    {
+    }
+    
+    
+    // Parameterized constructor.
+    User(UserRole r, int id, const string & uname, const string & pwd)
+    : role(r)
+    , userId(id)
+    , username(uname)
+    , password(pwd)
+    {
+    }
+    
+    
+public:
+    // Users are moved into and out of the Library's role pools.
+    User(const User &) = default;
+    User(User &&) = default;
+    User & operator=(const User &) = default;
+    User & operator=(User &&) = default;
+    
+    
+    virtual ~User()
+    {
+    }
+    
+    
+    UserRole getRole() const
+    {
+        return role;
+    }
+    
+    
+    int getUserId() const
+    {
+        return userId;
+    }
+    
+    
+    string getUsername() const
+    {
+        return username;
+    }
+    
+    
+    bool checkPassword(const string & pwd) const
+    {
+        return password == pwd;
+    }
+    
+    
+    Account & getAccount()
+    {
+        return account;
+    }
+    
+    
+    const Account & getAccount() const
+    {
+        return account;
+    }
+    
+    
+    // Declaration: Display user details, account info, and reserved books.
+    virtual void display(const Library & lib, ostream & out) const;
+    
+    
+    // Pure virtual functions for borrowing and returning books. These
+    // prompt on the console; the overloads below take the answers as
+    // arguments instead.
+    virtual void borrowBook(Library & lib) = 0;
+    virtual void returnBook(Library & lib) = 0;
+    virtual void reserveBook(Library & lib) = 0;
+    
+    
+    // Pure virtual functions that carry out a borrow, return or reservation
+    // without prompting (the console versions and CommandSession share
+    // them). They lock the copy and account they change, write their
+    // messages to out and return false if the request was refused.
+    virtual bool borrowBook(Library & lib, int bookId, int days, ostream & out) = 0;
+    // Borrows any free copy of the title with this ISBN or exact title.
+    virtual bool borrowTitle(Library & lib, const string & titleOrISBN, int days, ostream & out) = 0;
+    virtual bool returnBook(Library & lib, int bookId, ostream & out) = 0;
+    virtual bool reserveBook(Library & lib, int bookId, ostream & out) = 0;
+    
+    
+    // Longest loan the user's role allows; 0 for roles that do not borrow.
+    virtual int maxLoanDays() const
+    {
+        return 0;
+    }
+    
+    
+    // True if the user's role charges fines for overdue loans.
+    virtual bool paysFines() const
+    {
+        return false;
+    }
+    
+    
+    // True if the user may take another book now (a fine, a long-overdue
+    // loan or the role's book limit stops them); otherwise writes the
+    // reason to out. Always false for roles that do not borrow.
+    virtual bool canBorrow(const Library &, ostream &) const
+    {
+        return false;
+    }
+    
+    
+    // Charges the overdue fines accrued since the last sweep (see
+    // Account::accrueOverdueFines()) and sets loans to the loans charged.
+    // Always 0 for roles that do not pay fines.
+    virtual double accrueOverdueFines(time_t /*now*/, const Catalog & /*catalog*/, size_t & loans)
+    {
+        loans = 0;
+        return 0;
+    }
+    
+    
+    // Serializes user data.
+    virtual string serialize() const
+    {
+        ostringstream oss;
+        oss << userId << ";" << username << ";" << password << ";" << account.serialize();
+        return oss.str();
+    }
+    
+    
+    // Deserializes user data.
+    // On failure error describes the bad field.
+    virtual bool deserialize(string_view data, string & error)
+    {
+        FieldReader reader(data);
+        int newId;
+        string_view newUsername, newPassword;
+        if (!reader.nextNumber(newId, "user ID", error)
+            || !reader.next(newUsername, "username", error)
+            || !reader.next(newPassword, "password", error))
+        {
+            return false;
+        }
+        if (!account.deserialize(reader.atEnd() ? string_view("0") : reader.remainder(), error))
+        {
+            return false;
+        }
+        userId = newId;
+        username.assign(trimView(newUsername));
+        password.assign(trimView(newPassword));
+        return true;
+    }
+    
+    
+    // Setters.
+    void setUsername(const string & uname)
+    {
+        username = uname;
+    }
+    
+    
+    void setPassword(const string & pwd)
+    {
+        password = pwd;
+    }
+};
+
+
+// ========== Class: Patron ==========
+// A user who borrows, returns and reserves books under the rules of Policy
+// (see StudentPolicy and FacultyPolicy). Every limit check reads the
+// policy's constants, so each instantiation compiles them to fixed values.
+template <typename Policy>
+class Patron : public User
+{
+public:
+    static constexpr UserRole classRole = Policy::role;    // Role of every user of this class.
+    
+private:
+    // Checks the fine, overdue-loan and borrowing limits; prints the reason to out if borrowing is not allowed.
+    bool checkBorrowLimits(const Library & lib, ostream & out) const;
+    
+    // Borrows copy bookId. If taken is given and someone else has the copy,
+    // sets *taken and returns false without a message.
+    bool borrowCopy(Library & lib, int bookId, int days, bool * taken, ostream & out);
+    
+public:
+    // Default constructor.
+    Patron()
+    : User(Policy::role)
+    {
+    }
+    
+    
+    // Parameterized constructor.
+    Patron(int id, const string & uname, const string & pwd)
+    : User(Policy::role, id, uname, pwd)
+    {
+    }
+    
+    
+    virtual void borrowBook(Library & lib) override;
+    virtual void returnBook(Library & lib) override;
+    virtual void reserveBook(Library & lib) override;
+    virtual bool borrowBook(Library & lib, int bookId, int days, ostream & out) override;
+    virtual bool borrowTitle(Library & lib, const string & titleOrISBN, int days, ostream & out) override;
+    virtual bool returnBook(Library & lib, int bookId, ostream & out) override;
+    virtual bool reserveBook(Library & lib, int bookId, ostream & out) override;
+    
+    
+    virtual int maxLoanDays() const override
+    {
+        return Policy::maxDays;
+    }
+    
+    
+    virtual bool paysFines() const override
+    {
+        return Policy::fineRate > 0;
+    }
+    
+    
+    virtual bool canBorrow(const Library & lib, ostream & out) const override
+    {
+        return checkBorrowLimits(lib, out);
+    }
+    
+    
+    virtual double accrueOverdueFines(time_t now, const Catalog & catalog, size_t & loans) override
+    {
+        if constexpr (Policy::fineRate > 0)
+        {
+            return account.accrueOverdueFines(now, Policy::maxDays, Policy::fineRate, catalog, getUserId(), loans);
+        }
+        else
+        {
+            loans = 0;
+            return 0;
+        }
+    }
+    
+    
+    // Declaration: Display the patron's details; roles that pay fines also
+    // see the fine accrued on their active loans.
+    virtual void display(const Library & lib, ostream & out) const override;
+};
+
+
+// Class: Student
+using Student = Patron<StudentPolicy>;
+
+
+// Class: Faculty
+using Faculty = Patron<FacultyPolicy>;
+
+
+// ========== Class: Librarian ==========
+class Librarian : public User
+{
+public:
+    static constexpr UserRole classRole = UserRole::Librarian;
+    
+    
+    // Default constructor.
+    Librarian()
+    : User(UserRole::Librarian)
+    {
+    }
+    
+    
+    // Parameterized constructor.
+    Librarian(int id, const string & uname, const string & pwd)
+    : User(UserRole::Librarian, id, uname, pwd)
+    {
+    }
+    
+    
+    virtual void borrowBook(Library & lib) override
+    {
+        cout << "Librarian cannot borrow books." << endl;
+    }
+    
+    
+    virtual void returnBook(Library & lib) override
+    {
+        cout << "Librarian does not return books." << endl;
+    }
+    
+    
+    virtual void reserveBook(Library &) override
+    {
+        cout << "Librarian cannot reserve books." << endl;
+    }
+    
+    
+    virtual bool borrowBook(Library &, int, int, ostream & out) override
+    {
+        out << "Librarian cannot borrow books." << endl;
+        return false;
+    }
+    
+    
+    virtual bool borrowTitle(Library &, const string &, int, ostream & out) override
+    {
+        out << "Librarian cannot borrow books." << endl;
+        return false;
+    }
+    
+    
+    virtual bool returnBook(Library &, int, ostream & out) override
+    {
+        out << "Librarian does not return books." << endl;
+        return false;
+    }
+    
+    
+    virtual bool reserveBook(Library &, int, ostream & out) override
+    {
+        out << "Librarian cannot reserve books." << endl;
+        return false;
+    }
+    
+    
+    // Declaration: Display librarian details.
+    virtual void display(const Library & lib, ostream & out) const override;
+    
+    
+    // Administrative functions. Each console version prompts and then calls
+    // the overload that takes the answers, which writes its messages to out
+    // and returns false if the change was refused.
+    void addBook(Library & lib);
+    bool addBook(Library & lib, const string & title, const string & author, const string & publisher,
+                 int year, const string & isbn, ostream & out);
+    void removeBook(Library & lib);
+    bool removeBook(Library & lib, int bookId, ostream & out);
+    void updateBook(Library & lib);
+    bool updateBook(Library & lib, int bookId, const string & newTitle, const string & newPublisher,
+                    const string & newYear, const string & newISBN, ostream & out);
+    void addUser(Library & lib);
+    bool addUser(Library & lib, int type, const string & uname, const string & pwd, ostream & out);
+    void removeUser(Library & lib);
+    bool removeUser(Library & lib, int userId, ostream & out);
+    void updateUser(Library & lib);
+    bool updateUser(Library & lib, int userId, const string & newUsername, const string & newPassword, ostream & out);
+    void viewOverdueLoans(Library & lib);
+    void printOverdueLoans(Library & lib, ostream & out);
+    void printLoansDueWithin(Library & lib, int days, ostream & out);
+    void runFineSweep(Library & lib);
+};
+
+
+// A user record parsed from users.txt or the journal, before it is stored
+// in the Library's pool for its role. Its alternatives are the user
+// classes: one per role, each naming its role as classRole.
+using ParsedUser = variant<Student, Faculty, Librarian>;
+
+
+// Function: visitUserClass()
+// Calls fn with a null pointer to the user class (alternative of
+// ParsedUser) of the given role, so code can dispatch on a role without a
+// switch over every role.
+template <typename Fn, size_t I = 0>
+void visitUserClass(UserRole role, Fn && fn)
+{
+    if constexpr (I < variant_size_v<ParsedUser>)
+    {
+        using UserClass = variant_alternative_t<I, ParsedUser>;
+        if (UserClass::classRole == role)
+        {
+            fn(static_cast<UserClass*>(nullptr));
+        }
+        else
+        {
+            visitUserClass<Fn, I + 1>(role, forward<Fn>(fn));
+        }
+    }
+}
+
+
+// Class: UserPool
+// Stores the users of one role in blocks that never move, so User pointers
+// stay valid for the user's lifetime. Blocks double in size (reserve() can
+// size the next one exactly), so loading n users costs a few allocations
+// instead of n. Slots freed by release() are reused by later adds.
+template <typename T>
+class UserPool
+{
+private:
+    struct Block
+    {
+        unique_ptr<T[]> slots;
+        size_t capacity;
+    };
+    
+    static constexpr size_t minBlockSize = 4096;
+    vector<Block> blocks;
+    size_t usedInLast;          // Slots handed out from the last block.
+    vector<T*> freeSlots;
+    
+    
+    size_t spareInLast() const
+    {
+        return blocks.empty() ? 0 : blocks.back().capacity - usedInLast;
+    }
+    
+    
+    void addBlock(size_t capacity)
+    {
+        blocks.push_back(Block{ unique_ptr<T[]>(new T[capacity]), capacity });
+        usedInLast = 0;
+    }
+    
+    
+public:
+    UserPool()
+    : usedInLast(0)
+    {
+    }
+    
+    
+    UserPool(const UserPool &) = delete;
+    UserPool & operator=(const UserPool &) = delete;
+    
+    
+    // Makes room for count more users in at most one new block.
+    void reserve(size_t count)
+    {
+        size_t spare = freeSlots.size() + spareInLast();
+        if (count > spare)
+        {
+            addBlock(max(count - spare, minBlockSize));
+        }
+    }
+    
+    
+    // Moves user into a free slot and returns its stable address.
+    T * add(T && user)
+    {
+        T * slot;
+        if (!freeSlots.empty())
+        {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            if (spareInLast() == 0)
+            {
+                addBlock(blocks.empty() ? minBlockSize : blocks.back().capacity * 2);
+            }
+            slot = &blocks.back().slots[usedInLast++];
+        }
+        *slot = move(user);
+        return slot;
+    }
+    
+    
+    // Empties the slot of a removed user (freeing its strings and loan list)
+    // and keeps it for reuse. user must have come from add().
+    void release(T * user)
+    {
+        *user = T();
+        freeSlots.push_back(user);
+    }
+    
+    
+    // Drops every user and frees the blocks.
+    void clear()
+    {
+        blocks.clear();
+        freeSlots.clear();
+        usedInLast = 0;
+    }
+    
+    
+    size_t blockCount() const
+    {
+        return blocks.size();
+    }
+};
+
+
+// Struct: UserPoolsOf
+// One UserPool per user class of a ParsedUser-like variant, as a tuple.
+template <typename Variant>
+struct UserPoolsOf;
+
+template <typename... Users>
+struct UserPoolsOf<variant<Users...>>
+{
+    using type = tuple<UserPool<Users>...>;
+};
+
+
+// ========== Persistence ==========
+
+// Enumeration: PersistenceMode
+// Snapshot rewrites books.txt / users.txt on every change.
+// Journaled appends one record per change to journal.wal and only
+// rewrites the snapshot files at checkpoints.
+enum class PersistenceMode
+{
+    Snapshot,
+    Journaled
+};
+
+
+// Enumeration: FlushPolicy
+// When an AppendFile hands buffered records to the operating system.
+enum class FlushPolicy
+{
+    EveryRecord,    // After each record.
+    Batched,        // After every batchSize records.
+    OnClose         // Only when the buffer fills or the file is closed.
+};
+
+
+// Enumeration: CatalogFormat
+// On-disk format of the book snapshot.
+enum class CatalogFormat
+{
+    Text,       // books.txt, one semicolon-separated line per copy.
+    Binary      // books.bin, see CatalogFileHeader.
+};
+
+
+// Struct: LibraryOptions
+// Settings used when constructing a Library.
+struct LibraryOptions
+{
+    string dataDir = ".";
+    CatalogFormat catalogFormat = CatalogFormat::Text;
+    PersistenceMode persistence = PersistenceMode::Journaled;
+    size_t checkpointInterval = 1000;   // Journal records between checkpoints.
+    FlushPolicy logFlush = FlushPolicy::EveryRecord;
+    size_t logFlushBatch = 64;          // Records per flush with FlushPolicy::Batched.
+    bool logSync = false;               // fsync() the transaction log on every flush.
+    bool journalSync = false;           // fsync() the journal once per group commit.
+    bool backgroundWrites = true;       // Write files on a BackgroundWriter thread.
+    size_t threads = 0;                 // Worker threads (0 = one per core).
+    bool collectStats = true;           // Time the hot paths (see PerformanceStats).
+};
+
+
+// Class: AppendFile
+// An append-only text file written through a stdio buffer.
+// The flush policy decides when buffered records reach the operating system;
+// with sync enabled every flush is followed by fsync().
+class AppendFile
+{
+private:
+    string path;
+    FILE * file;
+    FlushPolicy policy;
+    size_t batchSize;
+    bool syncOnFlush;
+    size_t pending;             // Records appended since the last flush.
+    
+    
+    void openWithMode(const char * mode)
+    {
+        file = fopen(path.c_str(), mode);
+        if (file)
+        {
+            setvbuf(file, nullptr, _IOFBF, 1 << 16);
+        }
+        pending = 0;
+    }
+    
+    
+public:
+    AppendFile()
+    : file(nullptr)
+    , policy(FlushPolicy::EveryRecord)
+    , batchSize(1)
+    , syncOnFlush(false)
+    , pending(0)
+    {
+    }
+    
+    
+    ~AppendFile()
+    {
+        close();
+    }
+    
+    
+    AppendFile(const AppendFile &) = delete;
+    AppendFile & operator=(const AppendFile &) = delete;
+    
+    
+    void setFlushPolicy(FlushPolicy newPolicy, size_t newBatchSize, bool sync)
+    {
+        policy = newPolicy;
+        batchSize = max<size_t>(1, newBatchSize);
+        syncOnFlush = sync;
+    }
+    
+    
+    bool open(const string & filePath)
+    {
+        close();
+        path = filePath;
+        openWithMode("a");
+        return file != nullptr;
+    }
+    
+    
+    bool isOpen() const
+    {
+        return file != nullptr;
+    }
+    
+    
+    void append(const string & line)
+    {
+        if (!file)
+        {
+            return;
+        }
+        fwrite(line.data(), 1, line.size(), file);
+        fputc('\n', file);
+        pending++;
+        if (policy == FlushPolicy::EveryRecord || (policy == FlushPolicy::Batched && pending >= batchSize))
+        {
+            flush();
+        }
+    }
+    
+    
+    // Appends several records with at most one flush.
+    void appendBatch(const vector<string> & lines)
+    {
+        if (!file || lines.empty())
+        {
+            return;
+        }
+        for (const auto & line : lines)
+        {
+            fwrite(line.data(), 1, line.size(), file);
+            fputc('\n', file);
+        }
+        pending += lines.size();
+        if (policy == FlushPolicy::EveryRecord || (policy == FlushPolicy::Batched && pending >= batchSize))
+        {
+            flush();
+        }
+    }
+    
+    
+    void flush()
+    {
+        if (!file)
+        {
+            return;
+        }
+        fflush(file);
+        if (syncOnFlush)
+        {
+            fsync(fileno(file));
+        }
+        pending = 0;
+    }
+    
+    
+    // Flushes and fsyncs whatever the flush policy.
+    void sync()
+    {
+        if (!file)
+        {
+            return;
+        }
+        fflush(file);
+        fsync(fileno(file));
+        pending = 0;
+    }
+    
+    
+    // Discards the contents of the file and keeps it open for appending.
+    void truncate()
+    {
+        close();
+        openWithMode("w");
+    }
+    
+    
+    void close()
+    {
+        if (file)
+        {
+            flush();
+            fclose(file);
+            file = nullptr;
+        }
+    }
+};
+
+
+// ========== Catalog Files ==========
+
+// Reports a record that failed to parse. Only the first few are printed;
+// the caller prints the total with reportSkippedRecords().
+void reportBadRecord(const string & path, size_t lineNo, const string & error, size_t & badCount)
+{
+    badCount++;
+    if (badCount <= 10)
+    {
+        cout << path << " line " << lineNo << ": " << error << "; record skipped." << endl;
+    }
+}
+
+
+void reportSkippedRecords(const string & path, size_t badCount)
+{
+    if (badCount > 10)
+    {
+        cout << path << ": " << badCount << " records skipped in total." << endl;
+    }
+}
+
+
+// Reads a whole file into data. Returns false if it is missing or empty.
+bool readWholeFile(const string & path, string & data)
+{
+    ifstream fin(path, ios::binary);
+    if (!fin)
+    {
+        return false;
+    }
+    fin.seekg(0, ios::end);
+    data.resize(static_cast<size_t>(fin.tellg()));
+    fin.seekg(0, ios::beg);
+    fin.read(&data[0], data.size());
+    return !data.empty();
+}
+
+
+// Splits text into at most `parts` pieces that each end on a line boundary.
+vector<string_view> splitOnLines(string_view text, size_t parts)
+{
+    vector<string_view> chunks;
+    size_t target = text.size() / max<size_t>(1, parts) + 1;
+    size_t begin = 0;
+    while (begin < text.size())
+    {
+        size_t end = min(text.size(), begin + target);
+        if (end < text.size())
+        {
+            size_t newline = text.find('\n', end - 1);
+            end = (newline == string_view::npos) ? text.size() : newline + 1;
+        }
+        chunks.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+    return chunks;
+}
+
+
+// Struct: ParsedChunk
+// Records parsed from one chunk of a text file.
+template <typename Record>
+struct ParsedChunk
+{
+    vector<Record> records;
+    vector<pair<size_t, string>> errors;    // (line within the chunk, message)
+    size_t lines = 0;
+};
+
+
+// Function: parseChunks()
+// Splits text on line boundaries and parses the pieces on the pool.
+// parse(line, record, error) returns false for a bad record. text must
+// outlive the returned futures.
+template <typename Record, typename ParseFn>
+vector<future<ParsedChunk<Record>>> parseChunks(ThreadPool & pool, const string & text, ParseFn parse)
+{
+    const size_t minChunkBytes = 64 * 1024;
+    size_t parts = min(pool.size() * 4, text.size() / minChunkBytes + 1);
+    vector<future<ParsedChunk<Record>>> chunks;
+    for (string_view piece : splitOnLines(text, parts))
+    {
+        chunks.push_back(pool.submit([piece, parse]()
+            {
+                ParsedChunk<Record> chunk;
+                chunk.records.reserve(piece.size() / 64);
+                string error;
+                size_t begin = 0;
+                while (begin < piece.size())
+                {
+                    size_t end = piece.find('\n', begin);
+                    if (end == string_view::npos)
+                    {
+                        end = piece.size();
+                    }
+                    string_view line = piece.substr(begin, end - begin);
+                    begin = end + 1;
+                    chunk.lines++;
+                    if (trimView(line).empty())
+                    {
+                        continue;
+                    }
+                    chunk.records.emplace_back();
+                    if (!parse(line, chunk.records.back(), error))
+                    {
+                        chunk.records.pop_back();
+                        chunk.errors.emplace_back(chunk.lines, error);
+                    }
+                }
+                return chunk;
+            }
+        ));
+    }
+    return chunks;
+}
+
+
+// Function: collectChunks()
+// Waits for parsed chunks, appends their records to out in file order and
+// reports bad records with their line numbers in the whole file. If the
+// records are not in ID order (idOf), they are stably sorted by ID.
+template <typename Record, typename IdFn>
+void collectChunks(vector<future<ParsedChunk<Record>>> & chunks, const string & path, vector<Record> & out, IdFn idOf)
+{
+    vector<ParsedChunk<Record>> parsed;
+    size_t total = 0;
+    for (auto & f : chunks)
+    {
+        parsed.push_back(f.get());
+        total += parsed.back().records.size();
+    }
+    out.clear();
+    out.reserve(total);
+    size_t firstLine = 0;
+    size_t badCount = 0;
+    for (auto & chunk : parsed)
+    {
+        move(chunk.records.begin(), chunk.records.end(), back_inserter(out));
+        for (const auto & e : chunk.errors)
+        {
+            reportBadRecord(path, firstLine + e.first, e.second, badCount);
+        }
+        firstLine += chunk.lines;
+    }
+    reportSkippedRecords(path, badCount);
+    auto byId = [&idOf](const Record & a, const Record & b)
+    {
+        return idOf(a) < idOf(b);
+    };
+    if (!is_sorted(out.begin(), out.end(), byId))
+    {
+        stable_sort(out.begin(), out.end(), byId);
+    }
+}
+
+
+// Text catalog format, version 2. After the header line, each title is
+// written once, just before its first copy:
+//   T;<title no>;<title>;<author>;<publisher>;<year>;<ISBN>
+//   C;<book ID>;<title no>;<status>;<borrowedBy>;<reservedBy>
+// Title numbers are local to the file. Files without the header are read as
+// the original one-line-per-copy format (see Book::serialize()).
+// reservedBy is written as 0: reservations are saved with the users (see
+// Account). A nonzero one from an older file is queued on loading.
+const string catalogTextHeader = "#LMS-CATALOG 2";
+
+
+// Struct: CatalogTextLine
+// One parsed line of a version 2 text catalog. Strings are views into the file.
+struct CatalogTextLine
+{
+    char kind = 0;          // 'T', 'C', or 0 for the header.
+    uint32_t titleNo = 0;
+    int id = 0;
+    string_view title;
+    string_view author;
+    string_view publisher;
+    int year = 0;
+    string_view ISBN;
+    BookStatus status = BookStatus::Available;
+    int borrowedBy = 0;
+    int reservedBy = 0;
+};
+
+
+bool parseCatalogTextLine(string_view line, CatalogTextLine & rec, string & error)
+{
+    if (line[0] == '#')
+    {
+        rec.kind = 0;
+        return true;
+    }
+    FieldReader reader(line);
+    string_view kind, statusField;
+    reader.next(kind);
+    if (kind == "T")
+    {
+        rec.kind = 'T';
+        return reader.nextNumber(rec.titleNo, "title number", error)
+            && reader.next(rec.title, "title", error)
+            && reader.next(rec.author, "author", error)
+            && reader.next(rec.publisher, "publisher", error)
+            && reader.nextNumber(rec.year, "year", error)
+            && reader.next(rec.ISBN, "ISBN", error);
+    }
+    if (kind == "C")
+    {
+        rec.kind = 'C';
+        if (!reader.nextNumber(rec.id, "book ID", error)
+            || !reader.nextNumber(rec.titleNo, "title number", error)
+            || !reader.next(statusField, "status", error))
+        {
+            return false;
+        }
+        if (!stringToStatus(statusField, rec.status))
+        {
+            error = "unknown status \"" + string(statusField) + "\"";
+            return false;
+        }
+        return reader.nextNumber(rec.borrowedBy, "borrower ID", error)
+            && reader.nextNumber(rec.reservedBy, "reserver ID", error);
+    }
+    error = "unknown record type \"" + string(kind) + "\"";
+    return false;
+}
+
+
+// Reads a text books file (either format) in parallel chunks, skipping (and
+// reporting) bad records. Returns false if the file is missing, empty or of
+// an unsupported version.
+bool readTextCatalog(const string & path, Catalog & out, ThreadPool & pool)
+{
+    out.clear();
+    string text;
+    if (!readWholeFile(path, text))
+    {
+        return false;
+    }
+    
+    if (text[0] != '#')
+    {
+        auto chunks = parseChunks<Book>(pool, text, [](string_view line, Book & book, string & error)
+            {
+                return book.deserialize(line, error);
+            }
+        );
+        vector<Book> books;
+        collectChunks(chunks, path, books, [](const Book & book) { return book.getId(); });
+        out.assign(move(books));
+        return true;
+    }
+    
+    string_view header = trimView(string_view(text).substr(0, text.find('\n')));
+    if (header != catalogTextHeader)
+    {
+        cout << path << ": unsupported catalog header \"" << header << "\"." << endl;
+        return false;
+    }
+    auto chunks = parseChunks<CatalogTextLine>(pool, text, parseCatalogTextLine);
+    vector<CatalogTextLine> lines;
+    // Copies follow their titles, so the file order is kept.
+    collectChunks(chunks, path, lines, [](const CatalogTextLine &) { return 0; });
+    
+    unordered_map<uint32_t, uint32_t> titleByNo;
+    size_t copies = 0;
+    for (const auto & rec : lines)
+    {
+        if (rec.kind == 'T')
+        {
+            titleByNo[rec.titleNo] = out.internTitle(rec.title, rec.author, rec.publisher, rec.year, rec.ISBN);
+        }
+        copies += rec.kind == 'C';
+    }
+    out.reserve(copies);
+    size_t badCount = 0;
+    for (const auto & rec : lines)
+    {
+        if (rec.kind != 'C')
+        {
+            continue;
+        }
+        auto it = titleByNo.find(rec.titleNo);
+        if (it == titleByNo.end())
+        {
+            if (++badCount <= 10)
+            {
+                cout << path << ": book " << rec.id << " refers to unknown title " << rec.titleNo << "; record skipped." << endl;
+            }
+            continue;
+        }
+        out.appendCopy(rec.id, it->second, rec.status, rec.borrowedBy, rec.reservedBy);
+    }
+    reportSkippedRecords(path, badCount);
+    return true;
+}
+
+
+// Writes the catalog in the version 2 text format. Titles without copies are dropped.
+void writeTextCatalog(ostream & out, const Catalog & catalog)
+{
+    out << catalogTextHeader << "\n";
+    vector<uint32_t> fileTitleNo(catalog.titleCount(), 0);     // 0 = not written yet.
+    uint32_t nextTitleNo = 1;
+    for (size_t slot = 0; slot < catalog.size(); slot++)
+    {
+        uint32_t t = catalog.titleOf(slot);
+        if (fileTitleNo[t] == 0)
+        {
+            fileTitleNo[t] = nextTitleNo++;
+            const TitleRecord & rec = catalog.titleAt(t);
+            out << "T;" << fileTitleNo[t] << ";" << rec.title << ";" << catalog.name(rec.author) << ";"
+                << catalog.name(rec.publisher) << ";" << rec.year << ";" << rec.ISBN << "\n";
+        }
+        out << "C;" << catalog.id(slot) << ";" << fileTitleNo[t] << ";" << statusToString(catalog.status(slot)) << ";"
+            << catalog.borrowedBy(slot) << ";0\n";
+    }
+}
+
+
+// Binary catalog layout, version 2 (native byte order):
+//   CatalogFileHeader
+//   titleCount x CatalogTitleRecord
+//   copyCount x CatalogCopyRecord
+//   string heap of heapSize bytes (strings are not NUL-terminated)
+// Records are fixed-size, so record i can be read in place from a mapping.
+// Identical strings (e.g. an author shared by several titles) are stored once.
+struct CatalogFileHeader
+{
+    char magic[8];          // "LMSBOOKS"
+    uint32_t version;
+    uint32_t titleRecordSize;
+    uint32_t copyRecordSize;
+    uint32_t reserved;      // Zero.
+    uint64_t titleCount;
+    uint64_t copyCount;
+    uint64_t heapSize;
+};
+
+struct CatalogStringRef
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct CatalogTitleRecord
+{
+    int32_t year;
+    CatalogStringRef title;
+    CatalogStringRef author;
+    CatalogStringRef publisher;
+    CatalogStringRef isbn;
+};
+
+struct CatalogCopyRecord
+{
+    int32_t id;
+    uint32_t title;         // Index into the title records.
+    int32_t borrowedBy;
+    int32_t reservedBy;     // Written as 0 (see catalogTextHeader).
+    uint32_t status;        // BookStatus value.
+};
+
+static_assert(sizeof(CatalogFileHeader) == 48, "CatalogFileHeader layout changed");
+static_assert(sizeof(CatalogTitleRecord) == 36, "CatalogTitleRecord layout changed");
+static_assert(sizeof(CatalogCopyRecord) == 20, "CatalogCopyRecord layout changed");
+
+const char catalogMagic[8] = { 'L', 'M', 'S', 'B', 'O', 'O', 'K', 'S' };
+const uint32_t catalogVersion = 2;
+
+
+// Writes the catalog in the binary format. Titles without copies are dropped.
+void writeBinaryCatalog(ostream & out, const Catalog & catalog)
+{
+    string heap;
+    unordered_map<string, CatalogStringRef> interned;
+    auto intern = [&heap, &interned](const string & str)
+    {
+        auto it = interned.find(str);
+        if (it != interned.end())
+        {
+            return it->second;
+        }
+        CatalogStringRef ref = { static_cast<uint32_t>(heap.size()), static_cast<uint32_t>(str.size()) };
+        heap += str;
+        interned.emplace(str, ref);
+        return ref;
+    };
+    
+    const uint32_t unwritten = UINT32_MAX;
+    vector<uint32_t> fileTitleNo(catalog.titleCount(), unwritten);
+    vector<CatalogTitleRecord> titles;
+    vector<CatalogCopyRecord> copies(catalog.size());
+    for (size_t slot = 0; slot < catalog.size(); slot++)
+    {
+        uint32_t t = catalog.titleOf(slot);
+        if (fileTitleNo[t] == unwritten)
+        {
+            fileTitleNo[t] = static_cast<uint32_t>(titles.size());
+            const TitleRecord & rec = catalog.titleAt(t);
+            titles.push_back(CatalogTitleRecord{ rec.year, intern(rec.title), intern(catalog.name(rec.author)),
+                                                 intern(catalog.name(rec.publisher)), intern(rec.ISBN) });
+        }
+        CatalogCopyRecord & copy = copies[slot];
+        copy.id = catalog.id(slot);
+        copy.title = fileTitleNo[t];
+        copy.borrowedBy = catalog.borrowedBy(slot);
+        copy.reservedBy = 0;
+        copy.status = static_cast<uint32_t>(catalog.status(slot));
+    }
+    
+    CatalogFileHeader header;
+    memcpy(header.magic, catalogMagic, sizeof(header.magic));
+    header.version = catalogVersion;
+    header.titleRecordSize = sizeof(CatalogTitleRecord);
+    header.copyRecordSize = sizeof(CatalogCopyRecord);
+    header.reserved = 0;
+    header.titleCount = titles.size();
+    header.copyCount = copies.size();
+    header.heapSize = heap.size();
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(titles.data()), titles.size() * sizeof(CatalogTitleRecord));
+    out.write(reinterpret_cast<const char *>(copies.data()), copies.size() * sizeof(CatalogCopyRecord));
+    out.write(heap.data(), heap.size());
+}
+
+
+// Class: MappedCatalog
+// Read-only memory mapping of a binary catalog file.
+// Fields are read in place; strings are returned as views into the mapping.
+class MappedCatalog
+{
+private:
+    void * mapping;
+    size_t mappingSize;
+    const CatalogTitleRecord * titles;
+    const CatalogCopyRecord * copies;
+    const char * heap;
+    size_t titleTotal;
+    size_t count;
+    
+    
+    string_view view(const CatalogStringRef & ref) const
+    {
+        return string_view(heap + ref.offset, ref.length);
+    }
+    
+    
+public:
+    MappedCatalog()
+    : mapping(nullptr)
+    , mappingSize(0)
+    , titles(nullptr)
+    , copies(nullptr)
+    , heap(nullptr)
+    , titleTotal(0)
+    , count(0)
+    {
+    }
+    
+    
+    ~MappedCatalog()
+    {
+        close();
+    }
+    
+    
+    MappedCatalog(const MappedCatalog &) = delete;
+    MappedCatalog & operator=(const MappedCatalog &) = delete;
+    
+    
+    // Maps and validates a catalog file. On failure returns false and sets error.
+    bool open(const string & path, string & error)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CatalogFileHeader))
+        {
+            ::close(fd);
+            error = path + " is too small to be a binary catalog";
+            return false;
+        }
+        mappingSize = st.st_size;
+        mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            mapping = nullptr;
+            error = "cannot map " + path;
+            return false;
+        }
+        
+        const CatalogFileHeader * header = static_cast<const CatalogFileHeader *>(mapping);
+        uint64_t titlesEnd = sizeof(CatalogFileHeader) + header->titleCount * sizeof(CatalogTitleRecord);
+        uint64_t copiesEnd = titlesEnd + header->copyCount * sizeof(CatalogCopyRecord);
+        if (memcmp(header->magic, catalogMagic, sizeof(catalogMagic)) != 0)
+        {
+            error = path + " is not a binary catalog";
+        }
+        else if (header->version != catalogVersion || header->titleRecordSize != sizeof(CatalogTitleRecord)
+                 || header->copyRecordSize != sizeof(CatalogCopyRecord))
+        {
+            error = path + " has unsupported catalog version " + to_string(header->version);
+        }
+        // The counts are bounded first, so titlesEnd and copiesEnd cannot wrap;
+        // heapSize is compared with what is left, as adding it could.
+        else if (header->titleCount > mappingSize / sizeof(CatalogTitleRecord) || header->copyCount > mappingSize / sizeof(CatalogCopyRecord)
+                 || copiesEnd > mappingSize || header->heapSize != mappingSize - copiesEnd)
+        {
+            error = path + " is truncated or corrupt";
+        }
+        if (!error.empty())
+        {
+            close();
+            return false;
+        }
+        
+        titleTotal = header->titleCount;
+        count = header->copyCount;
+        titles = reinterpret_cast<const CatalogTitleRecord *>(static_cast<const char *>(mapping) + sizeof(CatalogFileHeader));
+        copies = reinterpret_cast<const CatalogCopyRecord *>(static_cast<const char *>(mapping) + titlesEnd);
+        heap = static_cast<const char *>(mapping) + copiesEnd;
+        for (size_t t = 0; t < titleTotal; t++)
+        {
+            const CatalogTitleRecord & rec = titles[t];
+            for (const CatalogStringRef * ref : { &rec.title, &rec.author, &rec.publisher, &rec.isbn })
+            {
+                if (static_cast<uint64_t>(ref->offset) + ref->length > header->heapSize)
+                {
+                    error = path + ": title " + to_string(t) + " points outside the string heap";
+                    close();
+                    return false;
+                }
+            }
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            if (copies[i].title >= titleTotal || copies[i].status > static_cast<uint32_t>(BookStatus::Reserved))
+            {
+                error = path + ": copy " + to_string(i) + " is corrupt";
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    
+    void close()
+    {
+        if (mapping)
+        {
+            munmap(mapping, mappingSize);
+        }
+        mapping = nullptr;
+        mappingSize = 0;
+        titles = nullptr;
+        copies = nullptr;
+        heap = nullptr;
+        titleTotal = 0;
+        count = 0;
+    }
+    
+    
+    // Number of copies.
+    size_t size() const
+    {
+        return count;
+    }
+    
+    
+    size_t titleCount() const
+    {
+        return titleTotal;
+    }
+    
+    
+    // Copy fields.
+    int id(size_t i) const
+    {
+        return copies[i].id;
+    }
+    
+    
+    uint32_t titleOf(size_t i) const
+    {
+        return copies[i].title;
+    }
+    
+    
+    BookStatus status(size_t i) const
+    {
+        return static_cast<BookStatus>(copies[i].status);
+    }
+    
+    
+    int borrowedBy(size_t i) const
+    {
+        return copies[i].borrowedBy;
+    }
+    
+    
+    int reservedBy(size_t i) const
+    {
+        return copies[i].reservedBy;
+    }
+    
+    
+    // Title fields.
+    int year(uint32_t t) const
+    {
+        return titles[t].year;
+    }
+    
+    
+    string_view title(uint32_t t) const
+    {
+        return view(titles[t].title);
+    }
+    
+    
+    string_view author(uint32_t t) const
+    {
+        return view(titles[t].author);
+    }
+    
+    
+    string_view publisher(uint32_t t) const
+    {
+        return view(titles[t].publisher);
+    }
+    
+    
+    string_view isbn(uint32_t t) const
+    {
+        return view(titles[t].isbn);
+    }
+    
+    
+    // Copies copy i into a Book.
+    Book materialize(size_t i) const
+    {
+        uint32_t t = titleOf(i);
+        Book book(id(i), string(title(t)), string(author(t)), string(publisher(t)), year(t), string(isbn(t)), status(i));
+        book.updateBorrowedBy(borrowedBy(i));
+        book.updateReservedBy(reservedBy(i));
+        return book;
+    }
+};
+
+
+// Reads a binary catalog into out. Only the title records carry strings,
+// so the copies are appended directly from the mapping. Returns false (with
+// error set) if the file is missing or invalid.
+bool readBinaryCatalog(const string & path, Catalog & out, string & error)
+{
+    out.clear();
+    MappedCatalog mapped;
+    if (!mapped.open(path, error))
+    {
+        return false;
+    }
+    vector<uint32_t> titleIds(mapped.titleCount());
+    for (uint32_t t = 0; t < mapped.titleCount(); t++)
+    {
+        titleIds[t] = out.internTitle(mapped.title(t), mapped.author(t), mapped.publisher(t), mapped.year(t), mapped.isbn(t));
+    }
+    out.reserve(mapped.size());
+    for (size_t i = 0; i < mapped.size(); i++)
+    {
+        out.appendCopy(mapped.id(i), titleIds[mapped.titleOf(i)], mapped.status(i), mapped.borrowedBy(i), mapped.reservedBy(i));
+    }
+    return true;
+}
+
+
+// Converts a catalog between formats: "text2bin" or "bin2text".
+// Returns 0 on success, as for main().
+int convertCatalog(const string & direction, const string & inPath, const string & outPath)
+{
+    Catalog catalog;
+    string error;
+    ThreadPool pool;
+    if (direction == "text2bin")
+    {
+        if (!readTextCatalog(inPath, catalog, pool))
+        {
+            cout << "Cannot read books from " << inPath << endl;
+            return 1;
+        }
+        ofstream fout(outPath, ios::binary);
+        writeBinaryCatalog(fout, catalog);
+    }
+    else if (direction == "bin2text")
+    {
+        if (!readBinaryCatalog(inPath, catalog, error))
+        {
+            cout << "Cannot read books: " << error << endl;
+            return 1;
+        }
+        ofstream fout(outPath);
+        writeTextCatalog(fout, catalog);
+    }
+    else
+    {
+        cout << "Unknown conversion: " << direction << " (expected text2bin or bin2text)" << endl;
+        return 1;
+    }
+    cout << "Converted " << catalog.size() << " books (" << catalog.titleCount() << " titles) from " << inPath << " to " << outPath << "." << endl;
+    return 0;
+}
+
+
+// ========== Due-Date Index ==========
+
+// Struct: DueLoan
+// One active loan in the due-date index.
+struct DueLoan
+{
+    time_t due;         // Borrow time + borrow days.
+    int userId;
+    int bookId;
+    
+    bool operator<(const DueLoan & other) const
+    {
+        return tie(due, userId, bookId) < tie(other.due, other.userId, other.bookId);
+    }
+};
+
+
+// Class: DueIndex
+// Every active loan ordered by due time, plus the due times of each user's
+// loans. Adding or removing a loan costs O(log n); whether a user has a loan
+// overdue by some number of days is O(1); listing the loans overdue now or
+// due within a window costs O(log n + matches).
+class DueIndex
+{
+private:
+    set<DueLoan> loans;
+    unordered_map<int, multiset<time_t>> dueByUser;
+    
+public:
+    static time_t dueTime(const BorrowRecord & record)
+    {
+        return record.borrowTimestamp + static_cast<time_t>(record.borrowDays) * 86400;
+    }
+    
+    
+    void add(int userId, const BorrowRecord & record)
+    {
+        time_t due = dueTime(record);
+        loans.insert(DueLoan{ due, userId, record.bookId });
+        dueByUser[userId].insert(due);
+    }
+    
+    
+    void remove(int userId, const BorrowRecord & record)
+    {
+        time_t due = dueTime(record);
+        if (loans.erase(DueLoan{ due, userId, record.bookId }) == 0)
+        {
+            return;
+        }
+        auto it = dueByUser.find(userId);
+        it->second.erase(it->second.find(due));
+        if (it->second.empty())
+        {
+            dueByUser.erase(it);
+        }
+    }
+    
+    
+    void addAll(int userId, const vector<BorrowRecord> & records)
+    {
+        for (const auto & record : records)
+        {
+            add(userId, record);
+        }
+    }
+    
+    
+    void removeAll(int userId, const vector<BorrowRecord> & records)
+    {
+        for (const auto & record : records)
+        {
+            remove(userId, record);
+        }
+    }
+    
+    
+    void clear()
+    {
+        loans.clear();
+        dueByUser.clear();
+    }
+    
+    
+    size_t size() const
+    {
+        return loans.size();
+    }
+    
+    
+    // True if one of the user's loans was due more than `days` days before now.
+    bool hasOverdueBy(int userId, time_t now, int days) const
+    {
+        auto it = dueByUser.find(userId);
+        return it != dueByUser.end() && difftime(now, *it->second.begin()) > static_cast<double>(days) * 86400;
+    }
+    
+    
+    // Loans due before now, earliest first.
+    vector<DueLoan> overdue(time_t now) const
+    {
+        auto end = loans.lower_bound(DueLoan{ now, numeric_limits<int>::min(), numeric_limits<int>::min() });
+        return vector<DueLoan>(loans.begin(), end);
+    }
+    
+    
+    // Loans falling due from now until `days` days from now, earliest first.
+    vector<DueLoan> dueWithin(time_t now, int days) const
+    {
+        auto begin = loans.lower_bound(DueLoan{ now, numeric_limits<int>::min(), numeric_limits<int>::min() });
+        auto end = loans.lower_bound(DueLoan{ now + static_cast<time_t>(days) * 86400, numeric_limits<int>::min(), numeric_limits<int>::min() });
+        return vector<DueLoan>(begin, end);
+    }
+};
+
+
+// Struct: FineSweepReport
+// Outcome of Library::runFineSweep().
+struct FineSweepReport
+{
+    size_t usersScanned = 0;
+    size_t usersCharged = 0;
+    size_t loansCharged = 0;
+    double amount = 0;
+    double sweepMs = 0;     // Parallel pass over the accounts.
+    double totalMs = 0;     // Including logging and persistence.
+};
+
+
+// ========== Performance Statistics ==========
+// Latency histograms for the hot paths, shown by the librarian's
+// "Performance Stats" and written to perf_stats.txt when the library closes.
+
+// Operations the library times (see Library::timeOperation()).
+enum class TimedOperation
+{
+    Authenticate,
+    FindBook,
+    Borrow,
+    Return,
+    Reserve,
+    SaveBooks,
+    SaveUsers,
+    LogTransaction,
+    GroupCommit,    // One batch written by the BackgroundWriter.
+    Count           // Number of operations, not an operation.
+};
+
+
+// Function: operationToString()
+string operationToString(TimedOperation op)
+{
+    switch (op)
+    {
+        case TimedOperation::Authenticate:
+            return "authenticateUser";
+        case TimedOperation::FindBook:
+            return "findBookById";
+        case TimedOperation::Borrow:
+            return "borrowBook";
+        case TimedOperation::Return:
+            return "returnBook";
+        case TimedOperation::Reserve:
+            return "reserveBook";
+        case TimedOperation::SaveBooks:
+            return "saveBooks";
+        case TimedOperation::SaveUsers:
+            return "saveUsers";
+        case TimedOperation::LogTransaction:
+            return "logTransaction";
+        case TimedOperation::GroupCommit:
+            return "groupCommit";
+        default:
+            return "unknown";
+    }
+}
+
+
+// Struct: LatencySummary
+// Count, mean and percentiles of one histogram, in nanoseconds.
+struct LatencySummary
+{
+    uint64_t count = 0;
+    double mean = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    uint64_t max = 0;
+};
+
+
+// Class: LatencyHistogram
+// Counts latencies in nanoseconds in log-linear buckets, in the style of an
+// HDR histogram: each power of two is split into 16 linear sub-buckets, so
+// no bucket is wider than 1/16 of the values in it. Recording is a few
+// relaxed atomic updates, so threads never wait for one another; a reader
+// may see a record counted in one field and not yet in another.
+class LatencyHistogram
+{
+public:
+    static const int subBuckets = 16;
+    static const int bucketCount = 61 * subBuckets;     // Enough for any 64-bit value.
+    
+    
+private:
+    array<atomic<uint64_t>, bucketCount> counts;
+    atomic<uint64_t> total;
+    atomic<uint64_t> sum;
+    atomic<uint64_t> maximum;
+    
+    
+    static int bucketOf(uint64_t nanos)
+    {
+        if (nanos < subBuckets)
+        {
+            return static_cast<int>(nanos);
+        }
+        int shift = 63 - __builtin_clzll(nanos) - 4;    // Keeps the top five bits.
+        return (shift + 1) * subBuckets + static_cast<int>((nanos >> shift) & (subBuckets - 1));
+    }
+    
+    
+    // Highest value that falls into a bucket.
+    static uint64_t bucketLimit(int bucket)
+    {
+        if (bucket < subBuckets)
+        {
+            return bucket;
+        }
+        int shift = bucket / subBuckets - 1;
+        uint64_t lowest = static_cast<uint64_t>(subBuckets + bucket % subBuckets) << shift;
+        return lowest + ((uint64_t(1) << shift) - 1);
+    }
+    
+    
+public:
+    LatencyHistogram()
+    : total(0)
+    , sum(0)
+    , maximum(0)
+    {
+        for (auto & count : counts)
+        {
+            count.store(0, memory_order_relaxed);
+        }
+    }
+    
+    
+    void record(uint64_t nanos)
+    {
+        counts[bucketOf(nanos)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        sum.fetch_add(nanos, memory_order_relaxed);
+        uint64_t seen = maximum.load(memory_order_relaxed);
+        while (nanos > seen && !maximum.compare_exchange_weak(seen, nanos, memory_order_relaxed))
+        {
+        }
+    }
+    
+    
+    // Percentiles are reported as the highest value of their bucket.
+    LatencySummary summarize() const
+    {
+        LatencySummary summary;
+        vector<uint64_t> snapshot(bucketCount);
+        for (int b = 0; b < bucketCount; b++)
+        {
+            snapshot[b] = counts[b].load(memory_order_relaxed);
+            summary.count += snapshot[b];
+        }
+        if (summary.count == 0)
+        {
+            return summary;
+        }
+        summary.mean = static_cast<double>(sum.load(memory_order_relaxed)) / summary.count;
+        summary.max = maximum.load(memory_order_relaxed);
+        pair<uint64_t, uint64_t *> targets[] = {     // Per mille.
+            { 500, &summary.p50 }, { 900, &summary.p90 }, { 990, &summary.p99 }, { 999, &summary.p999 }
+        };
+        for (auto & target : targets)
+        {
+            uint64_t rank = max<uint64_t>(1, (target.first * summary.count + 999) / 1000);
+            uint64_t seen = 0;
+            for (int b = 0; b < bucketCount; b++)
+            {
+                seen += snapshot[b];
+                if (seen >= rank)
+                {
+                    *target.second = min(bucketLimit(b), summary.max);
+                    break;
+                }
+            }
+        }
+        return summary;
+    }
+};
+
+
+// Class: ScopedTimer
+// Records the time from its construction to its destruction in a
+// histogram. Does nothing (not even read the clock) without one.
+class ScopedTimer
+{
+private:
+    LatencyHistogram * histogram;
+    chrono::steady_clock::time_point start;
+    
+    
+public:
+    explicit ScopedTimer(LatencyHistogram * target)
+    : histogram(target)
+    {
+        if (histogram)
+        {
+            start = chrono::steady_clock::now();
+        }
+    }
+    
+    
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer & operator=(const ScopedTimer &) = delete;
+    
+    
+    ~ScopedTimer()
+    {
+        if (histogram)
+        {
+            histogram->record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+        }
+    }
+};
+
+
+// Class: PerformanceStats
+// One LatencyHistogram per TimedOperation.
+// findBookById is timed on one call in 64 only: it takes tens of
+// nanoseconds, and reading the clock around every call would stop the CPU
+// from overlapping the cache misses of consecutive lookups.
+class PerformanceStats
+{
+private:
+    array<LatencyHistogram, static_cast<size_t>(TimedOperation::Count)> histograms;
+    
+    
+public:
+    // Calls per timed call.
+    static unsigned sampleEvery(TimedOperation op)
+    {
+        return op == TimedOperation::FindBook ? 64 : 1;
+    }
+    
+    
+    LatencyHistogram & histogram(TimedOperation op)
+    {
+        return histograms[static_cast<size_t>(op)];
+    }
+    
+    
+    // Prints one row per operation: count, then mean and percentiles in microseconds.
+    void print(ostream & out) const
+    {
+        ios::fmtflags savedFlags = out.flags();
+        streamsize savedPrecision = out.precision();
+        out << left << setw(20) << "operation" << right << setw(10) << "timed" << setw(11) << "mean us" << setw(11) << "p50 us"
+            << setw(11) << "p90 us" << setw(11) << "p99 us" << setw(11) << "p99.9 us" << setw(11) << "max us" << '\n';
+        out << fixed << setprecision(1);
+        for (size_t op = 0; op < histograms.size(); op++)
+        {
+            LatencySummary s = histograms[op].summarize();
+            string name = operationToString(static_cast<TimedOperation>(op));
+            unsigned every = sampleEvery(static_cast<TimedOperation>(op));
+            if (every > 1)
+            {
+                name += " 1/" + to_string(every);
+            }
+            out << left << setw(20) << name << right << setw(10) << s.count
+                << setw(11) << s.mean / 1000 << setw(11) << s.p50 / 1000.0 << setw(11) << s.p90 / 1000.0
+                << setw(11) << s.p99 / 1000.0 << setw(11) << s.p999 / 1000.0 << setw(11) << s.max / 1000.0 << '\n';
+        }
+        out.flush();
+        out.flags(savedFlags);
+        out.precision(savedPrecision);
+    }
+};
+
+
+// ========== Background Writer ==========
+
+// Class: BackgroundWriter
+// Does the library's file writes on a dedicated thread, so an operation
+// only queues its writes and returns. Jobs are written in the order they
+// were submitted: journal records, transaction log entries, whole snapshot
+// files (written to a temporary file and renamed) and journal truncations.
+// The thread takes everything queued at once and writes it as one group
+// commit: the journal and log records of a group go out with one write and
+// one flush per file, and one fsync when enabled. Records queued behind
+// others of the same file join their job, and a queued snapshot is
+// replaced by a newer one of the same file, so at most one waits per file.
+// sync() is the durability barrier: it returns once every job submitted
+// before it is written and fsync'd. Without the thread (backgroundWrites
+// off) each job is written before submit() returns.
+class BackgroundWriter
+{
+private:
+    enum class JobKind
+    {
+        Journal,            // lines: journal records.
+        Log,                // lines: transaction log entries.
+        Snapshot,           // data: the whole file at path.
+        OpenJournal,        // path.
+        OpenLog,            // path.
+        TruncateJournal,    // path: the journal, truncated there if it is not open.
+        Sync                // Flush and fsync both files; snapshots are fsync'd as they are written.
+    };
+    
+    struct Job
+    {
+        JobKind kind;
+        string path;
+        string data;
+        vector<string> lines;
+    };
+    
+    AppendFile journal;             // The files are only used by the writing thread.
+    AppendFile log;
+    bool snapshotFailed;            // A snapshot since the last journal truncation was not saved.
+    LatencyHistogram * commitTimer; // Times each group commit, if set.
+    mutable mutex queueMutex;       // Everything below.
+    condition_variable workReady;
+    condition_variable jobsWritten;
+    deque<Job> queue;
+    uint64_t submitted;             // Jobs submitted so far.
+    uint64_t written;               // Jobs written so far.
+    uint64_t commits;               // Groups written so far.
+    bool idle;                      // The thread is waiting for work.
+    bool stopping;
+    thread worker;
+    
+    
+    // Replaces path with data via a temporary file. The temporary file is
+    // fsync'd before the rename and the directory after it, so a crash or
+    // a full disk leaves either the old file or the complete new one.
+    // Returns false if a step failed; path is then unchanged, or replaced
+    // by the complete new file without the rename being durable yet.
+    static bool writeFileAtomically(const string & path, const string & data)
+    {
+        string tmpPath = path + ".tmp";
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        bool ok = true;
+        string_view rest(data);
+        while (ok && !rest.empty())
+        {
+            ssize_t written = ::write(fd, rest.data(), rest.size());
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            ok = written > 0;
+            if (ok)
+            {
+                rest.remove_prefix(written);
+            }
+        }
+        ok = ok && fsync(fd) == 0;
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            int error = errno;
+            remove(tmpPath.c_str());
+            errno = error;
+            return false;
+        }
+        string dir = filesystem::path(path).parent_path().string();
+        int dirFd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+        if (dirFd < 0)
+        {
+            return false;
+        }
+        ok = fsync(dirFd) == 0;
+        ::close(dirFd);
+        return ok;
+    }
+    
+    
+    // Writes one group. Consecutive journal and log records are collected
+    // and appended together before the next job of another kind.
+    void writeGroup(deque<Job> & group)
+    {
+        ScopedTimer timer(commitTimer);
+        vector<string> journalLines;
+        vector<string> logLines;
+        auto appendCollected = [&]()
+        {
+            journal.appendBatch(journalLines);
+            journalLines.clear();
+            log.appendBatch(logLines);
+            logLines.clear();
+        };
+        for (Job & job : group)
+        {
+            if (job.kind == JobKind::Journal || job.kind == JobKind::Log)
+            {
+                vector<string> & lines = (job.kind == JobKind::Journal) ? journalLines : logLines;
+                move(job.lines.begin(), job.lines.end(), back_inserter(lines));
+                continue;
+            }
+            appendCollected();
+            switch (job.kind)
+            {
+                case JobKind::Snapshot:
+                    if (!writeFileAtomically(job.path, job.data))
+                    {
+                        snapshotFailed = true;
+                        cout << "Could not save " << job.path << ": " << strerror(errno)
+                             << ". The journal is kept until the next checkpoint." << endl;
+                    }
+                    break;
+                case JobKind::OpenJournal:
+                    journal.open(job.path);
+                    break;
+                case JobKind::OpenLog:
+                    log.open(job.path);
+                    break;
+                case JobKind::TruncateJournal:
+                    // The journal still holds the changes of a snapshot that was not saved.
+                    if (snapshotFailed)
+                    {
+                        snapshotFailed = false;
+                    }
+                    else if (journal.isOpen())
+                    {
+                        journal.truncate();
+                    }
+                    else
+                    {
+                        ofstream(job.path, ios::trunc);
+                    }
+                    break;
+                case JobKind::Sync:
+                    journal.sync();
+                    log.sync();
+                    break;
+                default:
+                    break;
+            }
+        }
+        appendCollected();
+    }
+    
+    
+    void run()
+    {
+        unique_lock<mutex> lock(queueMutex);
+        while (true)
+        {
+            idle = true;
+            workReady.wait(lock, [this]() { return stopping || !queue.empty(); });
+            idle = false;
+            if (queue.empty())
+            {
+                break;
+            }
+            deque<Job> group;
+            group.swap(queue);
+            uint64_t last = submitted;
+            lock.unlock();
+            writeGroup(group);
+            lock.lock();
+            written = last;
+            commits++;
+            jobsWritten.notify_all();
+        }
+    }
+    
+    
+    // Returns the job's number, for waitFor().
+    uint64_t submit(Job && job)
+    {
+        lock_guard<mutex> lock(queueMutex);
+        uint64_t number = ++submitted;
+        if (!worker.joinable())
+        {
+            deque<Job> group;
+            group.push_back(move(job));
+            writeGroup(group);
+            written = number;
+            commits++;
+            return number;
+        }
+        if ((job.kind == JobKind::Journal || job.kind == JobKind::Log) && !queue.empty() && queue.back().kind == job.kind)
+        {
+            move(job.lines.begin(), job.lines.end(), back_inserter(queue.back().lines));
+            return number;
+        }
+        if (job.kind == JobKind::Snapshot)
+        {
+            for (auto it = queue.rbegin(); it != queue.rend() && it->kind != JobKind::TruncateJournal; ++it)
+            {
+                if (it->kind == JobKind::Snapshot && it->path == job.path)
+                {
+                    it->data = move(job.data);
+                    return number;
+                }
+            }
+        }
+        queue.push_back(move(job));
+        if (idle)
+        {
+            workReady.notify_one();
+        }
+        return number;
+    }
+    
+    
+    void waitFor(uint64_t number)
+    {
+        unique_lock<mutex> lock(queueMutex);
+        jobsWritten.wait(lock, [this, number]() { return written >= number; });
+    }
+    
+    
+public:
+    BackgroundWriter(const LibraryOptions & options, LatencyHistogram * timer)
+    : snapshotFailed(false)
+    , commitTimer(timer)
+    , submitted(0)
+    , written(0)
+    , commits(0)
+    , idle(false)
+    , stopping(false)
+    {
+        journal.setFlushPolicy(FlushPolicy::EveryRecord, 1, options.journalSync);
+        log.setFlushPolicy(options.logFlush, options.logFlushBatch, options.logSync);
+        if (options.backgroundWrites)
+        {
+            worker = thread(&BackgroundWriter::run, this);
+        }
+    }
+    
+    
+    ~BackgroundWriter()
+    {
+        close();
+    }
+    
+    
+    BackgroundWriter(const BackgroundWriter &) = delete;
+    BackgroundWriter & operator=(const BackgroundWriter &) = delete;
+    
+    
+    void openJournal(const string & path)
+    {
+        submit(Job{ JobKind::OpenJournal, path, string(), {} });
+    }
+    
+    
+    void openLog(const string & path)
+    {
+        submit(Job{ JobKind::OpenLog, path, string(), {} });
+    }
+    
+    
+    void appendJournal(vector<string> records)
+    {
+        submit(Job{ JobKind::Journal, string(), string(), move(records) });
+    }
+    
+    
+    void appendLog(vector<string> entries)
+    {
+        submit(Job{ JobKind::Log, string(), string(), move(entries) });
+    }
+    
+    
+    void writeSnapshot(const string & path, string data)
+    {
+        submit(Job{ JobKind::Snapshot, path, move(data), {} });
+    }
+    
+    
+    void truncateJournal(const string & path)
+    {
+        submit(Job{ JobKind::TruncateJournal, path, string(), {} });
+    }
+    
+    
+    // Durability barrier: waits until every job submitted so far is written
+    // and fsync'd: the journal and log by the barrier itself, snapshot files
+    // (and their directory) by writeFileAtomically(). A snapshot that could
+    // not be written is reported when it fails, not here.
+    void sync()
+    {
+        waitFor(submit(Job{ JobKind::Sync, string(), string(), {} }));
+    }
+    
+    
+    uint64_t commitCount() const
+    {
+        lock_guard<mutex> lock(queueMutex);
+        return commits;
+    }
+    
+    
+    // Writes everything still queued, stops the thread and closes the files.
+    void close()
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        workReady.notify_all();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+        lock_guard<mutex> lock(queueMutex);
+        journal.close();
+        log.close();
+    }
+};
+
+
+// Struct: ListingPage
+// Where a page of the title listing starts and ends (see Library::printBookPage()).
+struct ListingPage
+{
+    size_t titles = 0;      // Titles shown.
+    int firstId = 0;        // Lowest copy ID of the first title shown.
+    int lastId = 0;         // Lowest copy ID of the last title shown.
+    bool previous = false;  // Titles come before this page.
+    bool more = false;      // Titles follow this page.
+};
+
+
+// ========== Forward Declarations for Portal Menus ==========
+void userPortalMenu(User * user, Library & lib);
+void librarianPortalMenu(Librarian * libUser, Library & lib);
+
+
+// How an operation holds the library's structure lock (see Library::Access).
+enum class AccessMode
+{
+    Shared,     // Circulation and views.
+    Exclusive   // Adding, removing or renaming books and users; title edits; the fine sweep.
+};
+
+
+// Which stripes ItemLocks takes to lock a whole kind of item (see Library::ItemLocks).
+enum class LockScope
+{
+    AllBooks,
+    AllUsers
+};
+
+
+// ========== Class: Library ==========
+// Concurrency: every operation runs under an Access, which holds the
+// structure lock shared or exclusive. Operations under a shared Access lock
+// the copies and accounts they change with ItemLocks; the due index, the
+// journal and the transaction log each have their own mutex. Snapshot
+// rewrites and checkpoints wait until an exclusive lock is held.
+class Library
+{
+private:
+    Catalog catalog;            // Collection of books.
+    UserPoolsOf<ParsedUser>::type pools;   // Storage for the users of each role.
+    vector<User*> users;        // Every user in ID order; owned by the pools above.
+    unordered_map<int, size_t> userSlotById;   // User ID -> index into users.
+    unordered_map<string, size_t> userSlotByName; // Username -> index into users.
+    DueIndex dueIndex;          // Active loans by due time.
+    const LibraryOptions options;
+    ThreadPool workerPool;
+    const string booksFile;
+    const string usersFile;
+    const string logFile;
+    const string journalFile;
+    size_t journalRecords;      // Records appended since the last checkpoint.
+    time_t logStampTime;        // Second for which logStamp was formatted.
+    string logStamp;            // Cached "[date] " prefix for log entries.
+    // Locks. The structure lock guards which books and users exist, their
+    // slots and the title data; each stripe guards the circulation state of
+    // the copies (or accounts) whose IDs hash to it.
+    static const size_t lockStripes = 64;
+    mutable shared_mutex structureMutex;
+    mutable array<mutex, lockStripes> bookStripes;
+    mutable array<mutex, lockStripes> userStripes;
+    mutable mutex dueMutex;     // dueIndex.
+    mutable mutex journalMutex; // journalRecords.
+    mutable mutex logMutex;     // logStamp and the order of log entries.
+    // Writes requested by appendJournal(), done when the operation's Access is released.
+    atomic<bool> booksDirty;
+    atomic<bool> usersDirty;
+    atomic<bool> checkpointDue;
+    atomic<uint64_t> reservationSeq;    // Number for the next reservation (see Reservation).
+    PerformanceStats performance;
+    BackgroundWriter writer;    // Does every file write after loading.
+    const string statsFile;
+    // The catalog's search index is built on the worker pool after loading;
+    // searches and exclusive Accesses wait for it (see waitForSearchIndex()).
+    shared_future<void> searchIndexReady;
+    
+    
+    void waitForSearchIndex() const
+    {
+        if (searchIndexReady.valid())
+        {
+            searchIndexReady.wait();
+        }
+    }
+    
+    
+    mutex * bookStripe(int bookId) const
+    {
+        return &bookStripes[static_cast<unsigned>(bookId) % lockStripes];
+    }
+    
+    
+    mutex * userStripe(int userId) const
+    {
+        return &userStripes[static_cast<unsigned>(userId) % lockStripes];
+    }
+    
+    
+    bool writesPending() const
+    {
+        return booksDirty || usersDirty || checkpointDue;
+    }
+    
+    
+    // Writes the snapshots and checkpoint requested since the last call.
+    // Needs the exclusive structure lock.
+    void writePendingSnapshots()
+    {
+        if (checkpointDue.exchange(false))
+        {
+            booksDirty = false;
+            usersDirty = false;
+            checkpoint();
+            return;
+        }
+        if (booksDirty.exchange(false))
+        {
+            saveBooks();
+        }
+        if (usersDirty.exchange(false))
+        {
+            saveUsers();
+        }
+    }
+    
+    
+    // Loads default book data.
+    void loadDefaultBooks()
+    {
+        catalog.clear();
+        
+        vector<tuple<string, string, string, int, string>> defaultTitles = {
+            make_tuple("The C++ Programming Language", "Bjarne Stroustrup", "Addison-Wesley", 2013, "9780321563842"),
+            make_tuple("Effective C++", "Scott Meyers", "O'Reilly", 2005, "9780321334879"),
+            make_tuple("Clean Code", "Robert C. Martin", "Prentice Hall", 2008, "9780132350884"),
+            make_tuple("Design Patterns", "Erich Gamma et al.", "Addison-Wesley", 1994, "9780201633610"),
+            make_tuple("Modern Operating Systems", "Andrew Tanenbaum", "Pearson", 2014, "9780133591620"),
+            make_tuple("Introduction to Algorithms", "Cormen et al.", "MIT Press", 2009, "9780262033848"),
+            make_tuple("Artificial Intelligence: A Modern Approach", "Stuart Russell", "Pearson", 2009, "9780136042594"),
+            make_tuple("The Pragmatic Programmer", "Andrew Hunt", "Addison-Wesley", 1999, "9780201616224"),
+            make_tuple("Code Complete", "Steve McConnell", "Microsoft Press", 2004, "9780735619678"),
+            make_tuple("Refactoring", "Martin Fowler", "Addison-Wesley", 1999, "9780201485677")
+        };
+        
+        int newId = 1;
+        for (auto & tpl : defaultTitles)
+        {
+            uint32_t title = catalog.internTitle(get<0>(tpl), get<1>(tpl), get<2>(tpl), get<3>(tpl), get<4>(tpl));
+            for (int i = 0; i < 5; i++)
+            {
+                catalog.appendCopy(newId, title, BookStatus::Available, 0, 0);
+                newId++;
+            }
+        }
+    }
+    
+    
+    // Rebuilds the user ID and username indexes from scratch.
+    void rebuildUserIndex()
+    {
+        userSlotById.clear();
+        userSlotById.reserve(users.size());
+        userSlotByName.clear();
+        userSlotByName.reserve(users.size());
+        for (size_t i = 0; i < users.size(); i++)
+        {
+            userSlotById.emplace(users[i]->getUserId(), i);
+            userSlotByName.emplace(users[i]->getUsername(), i);
+        }
+    }
+    
+    
+    // Parses a "Type;id;username;..." user record into record.
+    // Returns false (with error set) for an unknown type or a malformed record.
+    static bool parseUserRecord(string_view line, ParsedUser & record, string & error)
+    {
+        FieldReader reader(line);
+        string_view type;
+        reader.next(type);
+        UserRole role;
+        if (!stringToRole(type, role))
+        {
+            error = "unknown user type \"" + string(trimView(type)) + "\"";
+            return false;
+        }
+        visitUserClass(role, [&record](auto * userClass) { record.emplace<remove_pointer_t<decltype(userClass)>>(); });
+        return visit([&](User & user) { return user.deserialize(reader.remainder(), error); }, record);
+    }
+    
+    
+    static int parsedUserId(const ParsedUser & record)
+    {
+        return visit([](const User & user) { return user.getUserId(); }, record);
+    }
+    
+    
+    template <typename UserClass>
+    UserPool<UserClass> & poolFor(const UserClass * = nullptr)
+    {
+        return get<UserPool<UserClass>>(pools);
+    }
+    
+    
+    // Moves a parsed user into the pool for its role. The caller indexes it.
+    User * storeUser(ParsedUser && record)
+    {
+        return visit([this](auto & user) -> User * { return poolFor(&user).add(move(user)); }, record);
+    }
+    
+    
+    // Returns a removed user's slot to its pool. The caller unindexes it.
+    void releaseUser(User * user)
+    {
+        visitUserClass(user->getRole(), [this, user](auto * userClass)
+            {
+                poolFor(userClass).release(static_cast<decltype(userClass)>(user));
+            }
+        );
+    }
+    
+    
+    // Set by an operation that must be on disk before it returns; its
+    // Access waits for the writer when it is released (see requireDurability()).
+    static bool & durabilityRequested()
+    {
+        static thread_local bool requested = false;
+        return requested;
+    }
+    
+    
+    // Appends a journal record, or marks the snapshot file for rewriting in
+    // snapshot mode. Rewrites and checkpoints happen when the operation ends.
+    void appendJournal(const string & record, bool booksChanged)
+    {
+        if (options.persistence == PersistenceMode::Snapshot)
+        {
+            (booksChanged ? booksDirty : usersDirty) = true;
+            return;
+        }
+        lock_guard<mutex> lock(journalMutex);
+        writer.appendJournal({ record });
+        journalRecords++;
+        if (journalRecords >= options.checkpointInterval)
+        {
+            checkpointDue = true;
+        }
+    }
+    
+    
+    // Replays journal records on top of the loaded snapshot.
+    // Returns the number of records applied; a torn or corrupt record ends the replay.
+    size_t replayJournal()
+    {
+        ifstream fin(journalFile);
+        if (!fin)
+        {
+            return 0;
+        }
+        size_t applied = 0;
+        size_t lineNo = 0;
+        string line;
+        string error;
+        while (getline(fin, line))
+        {
+            lineNo++;
+            if (trimView(line).empty())
+            {
+                continue;
+            }
+            FieldReader reader(line);
+            string_view tag;
+            reader.next(tag);
+            string_view payload = reader.remainder();
+            int id = 0;
+            bool ok = true;
+            if (tag == "B")
+            {
+                Book book;
+                ok = book.deserialize(payload, error);
+                if (ok)
+                {
+                    size_t slot = catalog.slotOf(book.getId());
+                    if (slot != Catalog::npos)
+                    {
+                        catalog.set(slot, book);
+                    }
+                    else
+                    {
+                        catalog.append(book);
+                    }
+                }
+            }
+            else if (tag == "-B")
+            {
+                ok = FieldReader(payload).nextNumber(id, "book ID", error);
+                if (ok)
+                {
+                    eraseBook(id);
+                }
+            }
+            else if (tag == "U")
+            {
+                ParsedUser record;
+                ok = parseUserRecord(payload, record, error);
+                if (ok)
+                {
+                    User * user = storeUser(move(record));
+                    auto it = userSlotById.find(user->getUserId());
+                    if (it != userSlotById.end())
+                    {
+                        // Same slot: only the username index may change.
+                        size_t slot = it->second;
+                        if (users[slot]->getUsername() != user->getUsername())
+                        {
+                            userSlotByName.erase(users[slot]->getUsername());
+                            userSlotByName[user->getUsername()] = slot;
+                        }
+                        releaseUser(users[slot]);
+                        users[slot] = user;
+                    }
+                    else
+                    {
+                        users.push_back(user);
+                        userSlotById.emplace(user->getUserId(), users.size() - 1);
+                        userSlotByName.emplace(user->getUsername(), users.size() - 1);
+                    }
+                }
+            }
+            else if (tag == "-U")
+            {
+                ok = FieldReader(payload).nextNumber(id, "user ID", error);
+                if (ok)
+                {
+                    eraseUser(id);
+                }
+            }
+            else
+            {
+                ok = false;
+                error = "unknown record type \"" + string(tag) + "\"";
+            }
+            if (!ok)
+            {
+                // Usually a record torn by a crash while it was being written.
+                cout << journalFile << " line " << lineNo << ": " << error << "; replay stopped." << endl;
+                break;
+            }
+            applied++;
+        }
+        return applied;
+    }
+    
+    
+    // Removes a book by ID. Returns false if it does not exist.
+    bool eraseBook(int bookId)
+    {
+        return catalog.remove(bookId);
+    }
+    
+    
+    // Removes a user by ID, frees its slot and updates the indexes. Returns false if it does not exist.
+    bool eraseUser(int userId)
+    {
+        auto it = userSlotById.find(userId);
+        if (it == userSlotById.end())
+        {
+            return false;
+        }
+        {
+            lock_guard<mutex> lock(dueMutex);
+            dueIndex.removeAll(userId, users[it->second]->getAccount().getBorrowRecords());
+        }
+        for (const Reservation & reservation : users[it->second]->getAccount().getReservations())
+        {
+            size_t slot = catalog.slotOf(reservation.bookId);
+            if (slot != Catalog::npos)
+            {
+                catalog.dequeue(catalog.titleOf(slot), userId);
+            }
+        }
+        size_t slot = it->second;
+        userSlotById.erase(it);
+        auto named = userSlotByName.find(users[slot]->getUsername());
+        if (named != userSlotByName.end() && named->second == slot)
+        {
+            userSlotByName.erase(named);
+        }
+        releaseUser(users[slot]);
+        users.erase(users.begin() + slot);
+        shiftSlotIndex(userSlotById, slot, users.size(), [this](size_t i) { return users[i]->getUserId(); });
+        shiftSlotIndex(userSlotByName, slot, users.size(), [this](size_t i) { return users[i]->getUsername(); });
+        return true;
+    }
+    
+    
+public:
+    // Constructor: Loads books and users (plus any journaled changes) and the transaction log.
+    explicit Library(const LibraryOptions & opts = LibraryOptions())
+    : options(opts)
+    , workerPool(opts.threads)
+    , booksFile(opts.dataDir + (opts.catalogFormat == CatalogFormat::Binary ? "/books.bin" : "/books.txt"))
+    , usersFile(opts.dataDir + "/users.txt")
+    , logFile(opts.dataDir + "/transactions.txt")
+    , journalFile(opts.dataDir + "/journal.wal")
+    , journalRecords(0)
+    , logStampTime(0)
+    , booksDirty(false)
+    , usersDirty(false)
+    , checkpointDue(false)
+    , reservationSeq(1)
+    , writer(opts, opts.collectStats ? &performance.histogram(TimedOperation::GroupCommit) : nullptr)
+    , statsFile(opts.dataDir + "/perf_stats.txt")
+    {
+        // users.txt is parsed on the worker pool while books load, so both files load concurrently.
+        string usersText;
+        auto userChunks = startLoadUsers(usersText);
+        loadBooks();
+        finishLoadUsers(userChunks);
+        size_t replayed = replayJournal();
+        bool reservationsChanged = !rebuildReservationQueues().empty();
+        reservationsChanged = importLegacyReservations() > 0 || reservationsChanged;
+        if (replayed > 0 || reservationsChanged)
+        {
+            checkpoint();
+        }
+        for (User * user : users)
+        {
+            dueIndex.addAll(user->getUserId(), user->getAccount().getBorrowRecords());
+        }
+        catalog.publishAll();
+        searchIndexReady = workerPool.submit([this]() { catalog.rebuildSearchIndex(); }).share();
+        if (options.persistence == PersistenceMode::Journaled)
+        {
+            writer.openJournal(journalFile);
+        }
+        openTransactionLog();
+    }
+    
+    
+    // Destructor: Saves data, drains the writer and writes the performance
+    // statistics. The pools free the users.
+    ~Library()
+    {
+        waitForSearchIndex();
+        checkpoint();
+        writer.close();
+        if (options.collectStats)
+        {
+            ofstream fout(statsFile, ios::trunc);
+            fout << "Performance statistics at " << getTimeString(time(0)) << "\n";
+            performance.print(fout);
+        }
+    }
+    
+    
+    // ---------- Locking ----------
+    
+    // Class: Library::Access
+    // Holds the structure lock for the duration of one operation. When it
+    // is released, any snapshot rewrite or checkpoint the operation asked
+    // for is written under the exclusive lock, so it sees a consistent state.
+    // An exclusive operation that added or removed copies also publishes a
+    // new catalog version for snapshot readers.
+    class Access
+    {
+    private:
+        Library & lib;
+        bool exclusive;
+        
+    public:
+        Access(Library & library, AccessMode mode)
+        : lib(library)
+        , exclusive(mode == AccessMode::Exclusive)
+        {
+            if (exclusive)
+            {
+                lib.structureMutex.lock();
+                lib.waitForSearchIndex();
+            }
+            else
+            {
+                lib.structureMutex.lock_shared();
+            }
+        }
+        
+        
+        Access(const Access &) = delete;
+        Access & operator=(const Access &) = delete;
+        
+        
+        ~Access()
+        {
+            if (exclusive)
+            {
+                if (lib.catalog.needsPublishAll())
+                {
+                    lib.catalog.publishAll();
+                }
+                if (lib.catalog.needsSearchRebuild())
+                {
+                    lib.catalog.rebuildSearchIndex();
+                }
+                lib.writePendingSnapshots();
+                lib.structureMutex.unlock();
+            }
+            else
+            {
+                lib.structureMutex.unlock_shared();
+                if (lib.writesPending())
+                {
+                    unique_lock<shared_mutex> lock(lib.structureMutex);
+                    lib.writePendingSnapshots();
+                }
+            }
+            if (durabilityRequested())
+            {
+                durabilityRequested() = false;
+                lib.waitForWrites();
+            }
+        }
+    };
+    
+    
+    // Class: Library::ItemLocks
+    // Locks the stripes of the copies and accounts one operation reads or
+    // changes, under an Access. Stripes are always locked in address order,
+    // so operations that need several of them cannot deadlock.
+    class ItemLocks
+    {
+    private:
+        Library & lib;
+        vector<mutex*> held;    // Sorted by address.
+        
+        
+        void lockStripes(vector<mutex*> stripes)
+        {
+            sort(stripes.begin(), stripes.end(), less<mutex*>());
+            stripes.erase(unique(stripes.begin(), stripes.end()), stripes.end());
+            for (mutex * stripe : stripes)
+            {
+                stripe->lock();
+            }
+            held = move(stripes);
+        }
+        
+        
+        void unlockStripes()
+        {
+            for (auto it = held.rbegin(); it != held.rend(); ++it)
+            {
+                (*it)->unlock();
+            }
+            held.clear();
+        }
+        
+        
+    public:
+        ItemLocks(Library & library, initializer_list<int> bookIds, initializer_list<int> userIds)
+        : lib(library)
+        {
+            vector<mutex*> stripes;
+            for (int bookId : bookIds)
+            {
+                stripes.push_back(lib.bookStripe(bookId));
+            }
+            for (int userId : userIds)
+            {
+                stripes.push_back(lib.userStripe(userId));
+            }
+            lockStripes(move(stripes));
+        }
+        
+        
+        // Locks a set of copies known only at run time, such as every copy of a title.
+        ItemLocks(Library & library, const vector<int> & bookIds, initializer_list<int> userIds)
+        : lib(library)
+        {
+            vector<mutex*> stripes;
+            for (int bookId : bookIds)
+            {
+                stripes.push_back(lib.bookStripe(bookId));
+            }
+            for (int userId : userIds)
+            {
+                stripes.push_back(lib.userStripe(userId));
+            }
+            lockStripes(move(stripes));
+        }
+        
+        
+        // Locks every book or every user stripe, for views of the whole library.
+        ItemLocks(Library & library, LockScope scope)
+        : lib(library)
+        {
+            vector<mutex*> stripes;
+            auto & all = (scope == LockScope::AllBooks) ? lib.bookStripes : lib.userStripes;
+            for (mutex & stripe : all)
+            {
+                stripes.push_back(&stripe);
+            }
+            lockStripes(move(stripes));
+        }
+        
+        
+        ItemLocks(const ItemLocks &) = delete;
+        ItemLocks & operator=(const ItemLocks &) = delete;
+        
+        
+        ~ItemLocks()
+        {
+            unlockStripes();
+        }
+        
+        
+        bool holdsUser(int userId) const
+        {
+            return binary_search(held.begin(), held.end(), lib.userStripe(userId), less<mutex*>());
+        }
+        
+        
+        // Adds a user's stripe. Everything is unlocked and locked again in
+        // order, so the caller must re-check what it read before.
+        void addUser(int userId)
+        {
+            vector<mutex*> stripes = held;
+            stripes.push_back(lib.userStripe(userId));
+            unlockStripes();
+            lockStripes(move(stripes));
+        }
+    };
+    
+    
+    // Also locks the user first in the queue for the copy's title, whom
+    // takeBackBook() will lend it to. A head who may no longer borrow leaves
+    // the queue first (see dropIneligibleReservation()). Call with the copy's
+    // and the returning user's stripes held: nobody can then join an empty
+    // queue, and the head can only leave under its own lock, so the head
+    // read after the last wait is the one takeBackBook() sees.
+    void lockReservingUser(BookRef book, ItemLocks & locks)
+    {
+        int head;
+        while ((head = catalog.queueHead(book.getTitleId())) != 0)
+        {
+            if (!locks.holdsUser(head))
+            {
+                locks.addUser(head);
+                continue;
+            }
+            User * user = findUserById(head);
+            if (user == nullptr || !dropIneligibleReservation(book, user))
+            {
+                break;
+            }
+        }
+    }
+    
+    
+    // ---------- Persistence ----------
+    
+    // Writes fresh snapshots of books and users and empties the journal.
+    void checkpoint()
+    {
+        saveBooks();
+        saveUsers();
+        lock_guard<mutex> lock(journalMutex);
+        writer.truncateJournal(journalFile);
+        journalRecords = 0;
+    }
+    
+    
+    // Returns once every write requested so far is on disk.
+    void waitForWrites()
+    {
+        writer.sync();
+    }
+    
+    
+    // Groups of writes committed so far.
+    uint64_t groupCommits() const
+    {
+        return writer.commitCount();
+    }
+    
+    
+    // Makes the calling operation wait, when its Access is released, until
+    // its writes are on disk. For changes that must survive a crash the
+    // moment the user is told about them, such as fine payments.
+    void requireDurability()
+    {
+        durabilityRequested() = true;
+    }
+    
+    
+    // Persists the current state of one book.
+    void persistBook(int bookId)
+    {
+        size_t slot = catalog.slotOf(bookId);
+        if (slot != Catalog::npos)
+        {
+            appendJournal("B;" + catalog.get(slot).serialize(), true);
+        }
+    }
+    
+    
+    // Persists every copy that shares the title of one book, after a
+    // change to the title's bibliographic data.
+    void persistTitle(int bookId)
+    {
+        size_t slot = catalog.slotOf(bookId);
+        if (slot == Catalog::npos)
+        {
+            return;
+        }
+        if (options.persistence == PersistenceMode::Snapshot)
+        {
+            booksDirty = true;  // One rewrite instead of one per copy.
+            return;
+        }
+        for (int copyId : catalog.copiesOf(catalog.titleOf(slot)))
+        {
+            persistBook(copyId);
+        }
+    }
+    
+    
+    // Persists the current state of one user (including the account).
+    void persistUser(int userId)
+    {
+        User * user = findUserById(userId);
+        if (user)
+        {
+            appendJournal("U;" + roleToString(user->getRole()) + ";" + user->serialize(), false);
+        }
+    }
+    
+    
+    // Persists several users with one write: one users.txt rewrite in
+    // snapshot mode, or one batch of journal records.
+    void persistUsers(const vector<int> & userIds)
+    {
+        if (userIds.empty())
+        {
+            return;
+        }
+        if (options.persistence == PersistenceMode::Snapshot)
+        {
+            usersDirty = true;
+            return;
+        }
+        vector<string> records;
+        records.reserve(userIds.size());
+        for (int userId : userIds)
+        {
+            User * user = findUserById(userId);
+            if (user)
+            {
+                records.push_back("U;" + roleToString(user->getRole()) + ";" + user->serialize());
+            }
+        }
+        lock_guard<mutex> lock(journalMutex);
+        journalRecords += records.size();
+        writer.appendJournal(move(records));
+        if (journalRecords >= options.checkpointInterval)
+        {
+            checkpointDue = true;
+        }
+    }
+    
+    
+    // Loads books from file or defaults.
+    void loadBooks()
+    {
+        bool found = false;
+        if (options.catalogFormat == CatalogFormat::Binary)
+        {
+            string error;
+            found = readBinaryCatalog(booksFile, catalog, error);
+            if (!found && filesystem::exists(booksFile))
+            {
+                cout << "Binary catalog unreadable (" << error << ")." << endl;
+            }
+            if (!found && readTextCatalog(options.dataDir + "/books.txt", catalog, workerPool))
+            {
+                cout << "Importing books.txt into the binary catalog." << endl;
+                found = true;
+            }
+        }
+        else
+        {
+            found = readTextCatalog(booksFile, catalog, workerPool);
+        }
+        if (!found)
+        {
+            cout << "Books file not found or empty. Loading default books." << endl;
+            loadDefaultBooks();
+            return;
+        }
+        if (catalog.size() == 0 || catalog.titleAt(catalog.titleOf(0)).title.empty())
+        {
+            cout << "Books file data invalid. Loading default books." << endl;
+            loadDefaultBooks();
+        }
+    }
+    
+    
+    // Saves books to file. The catalog is serialized here; the writer
+    // writes it out.
+    void saveBooks()
+    {
+        ScopedTimer timer = timeOperation(TimedOperation::SaveBooks);
+        ostringstream out;
+        if (options.catalogFormat == CatalogFormat::Binary)
+        {
+            writeBinaryCatalog(out, catalog);
+        }
+        else
+        {
+            writeTextCatalog(out, catalog);
+        }
+        writer.writeSnapshot(booksFile, out.str());
+    }
+    
+    
+
+    // Returns a book's title, or an empty string if it does not exist.
+    const string & getBookTitle(int bookId) const
+    {
+        static const string none;
+        size_t slot = catalog.slotOf(bookId);
+        return slot == Catalog::npos ? none : catalog.titleAt(catalog.titleOf(slot)).title;
+    }
+    
+    
+    // ---------- Listings ----------
+    // Book listings show one row per title, a page at a time, in order of
+    // each title's lowest copy ID. A page reads one catalog snapshot, so it
+    // takes no item locks, and costs O(titles on the page) rather than
+    // O(catalog). It is rendered into one buffer and written with one flush.
+    
+    // Appends up to ten IDs to a row, then how many were left out.
+    static void appendIdList(ostringstream & row, const vector<int> & bookIds)
+    {
+        const size_t shown = 10;
+        for (size_t i = 0; i < bookIds.size() && i < shown; i++)
+        {
+            row << (i ? " " : "") << bookIds[i];
+        }
+        if (bookIds.size() > shown)
+        {
+            row << " ... (+" << bookIds.size() - shown << " more)";
+        }
+    }
+    
+    
+    // Appends the row for title t as of version. viewerId as for
+    // printBookPage(); available is scratch space.
+    void appendTitleRow(ostringstream & rows, uint32_t t, int viewerId, const CirculationVersion & version, vector<int> & available) const
+    {
+        const TitleRecord & rec = catalog.titleAt(t);
+        const vector<int> & copies = catalog.copiesOf(t);
+        size_t borrowed = 0;
+        available.clear();
+        ostringstream yours;
+        for (int bookId : copies)
+        {
+            const CirculationState & state = version.at(catalog.slotOf(bookId));
+            if (state.borrowedBy == 0)
+            {
+                available.push_back(bookId);
+            }
+            else
+            {
+                borrowed++;
+            }
+            if (viewerId != 0 && state.borrowedBy == viewerId)
+            {
+                yours << (yours.tellp() > 0 ? ", " : "") << bookId << " (Borrowed)";
+            }
+        }
+        size_t waiting = 0;
+        size_t position = viewerId != 0 ? catalog.queuePosition(t, viewerId, waiting) : 0;
+        if (viewerId == 0)
+        {
+            waiting = catalog.queueLength(t);
+        }
+        if (position != 0)
+        {
+            yours << (yours.tellp() > 0 ? ", " : "") << "reserved, number " << position << " of " << waiting << " in the queue";
+        }
+        rows << "---------------------------------------\n";
+        rows << "Title: " << rec.title << '\n';
+        rows << "Author: " << catalog.name(rec.author) << " | Publisher: " << catalog.name(rec.publisher)
+             << " | Year: " << rec.year << " | ISBN: " << rec.ISBN << '\n';
+        rows << "Copies: " << copies.size() << " | Available: " << available.size() << " | Borrowed: " << borrowed
+             << " | Waiting: " << waiting << '\n';
+        if (viewerId == 0)
+        {
+            rows << "Copy IDs: ";
+            appendIdList(rows, copies);
+            rows << '\n';
+        }
+        else if (!available.empty())
+        {
+            rows << "Available IDs: ";
+            appendIdList(rows, available);
+            rows << '\n';
+        }
+        if (yours.tellp() > 0)
+        {
+            rows << "Yours: " << yours.str() << '\n';
+        }
+    }
+    
+    
+    // Renders the rows for titles. viewerId as for printBookPage().
+    ListingPage renderTitles(const vector<uint32_t> & titles, int viewerId, ostream & out) const
+    {
+        ListingPage page;
+        shared_ptr<const CirculationVersion> version = catalog.snapshot();
+        ostringstream rows;
+        rows << (viewerId == 0 ? "\n********** Library Books **********\n" : "\n********** Books List **********\n");
+        vector<int> available;
+        for (uint32_t t : titles)
+        {
+            appendTitleRow(rows, t, viewerId, *version, available);
+        }
+        rows << "---------------------------------------\n";
+        if (titles.empty())
+        {
+            rows << "No books to show.\n";
+        }
+        else
+        {
+            page.titles = titles.size();
+            page.firstId = catalog.copiesOf(titles.front()).front();
+            page.lastId = catalog.copiesOf(titles.back()).front();
+            page.previous = !catalog.titlesBefore(page.firstId, 1).empty();
+            page.more = !catalog.titlesAfter(page.lastId, 1).empty();
+            rows << "Showing " << page.titles << " of " << catalog.listedTitleCount() << " titles (first copy IDs "
+                 << page.firstId << "-" << page.lastId << ")\n";
+        }
+        string text = rows.str();
+        out.write(text.data(), text.size());
+        out.flush();
+        return page;
+    }
+    
+    
+    // Prints the titles whose lowest copy ID is above afterId, at most
+    // pageSize of them. viewerId is the patron whose copies are marked, or
+    // 0 for the librarian's view, which lists every copy ID.
+    ListingPage printBookPage(int viewerId, int afterId, size_t pageSize, ostream & out) const
+    {
+        return renderTitles(catalog.titlesAfter(afterId, pageSize), viewerId, out);
+    }
+    
+    
+    // Prints the page that ends just before the title whose lowest copy ID is beforeId.
+    ListingPage printBookPageBefore(int viewerId, int beforeId, size_t pageSize, ostream & out) const
+    {
+        return renderTitles(catalog.titlesBefore(beforeId, pageSize), viewerId, out);
+    }
+    
+    
+    // Prints every title, a page at a time (for reports and benchmarks).
+    void printAllTitles(int viewerId, ostream & out) const
+    {
+        const size_t pageSize = 1000;
+        ListingPage page = printBookPage(viewerId, numeric_limits<int>::min(), pageSize, out);
+        while (page.more)
+        {
+            page = printBookPage(viewerId, page.lastId, pageSize, out);
+        }
+    }
+    
+    
+    // ---------- Search ----------
+    
+    // Most titles a search shows.
+    static const size_t searchLimit = 20;
+    
+    
+    // Prints the titles that best match query (see Catalog::search()) as
+    // listing rows with their copy counts, at most limit of them. viewerId
+    // as for printBookPage(). If no title matches, prints the titles most
+    // like query instead (see Catalog::fuzzySearch()), for misspellings.
+    // Returns the number of matching titles.
+    size_t printSearchResults(const string & query, int viewerId, size_t limit, ostream & out) const
+    {
+        waitForSearchIndex();
+        size_t matched = 0;
+        vector<uint32_t> titles = catalog.search(query, limit, matched);
+        bool fuzzy = titles.empty();
+        if (fuzzy)
+        {
+            titles = catalog.fuzzySearch(query, limit);
+        }
+        shared_ptr<const CirculationVersion> version = catalog.snapshot();
+        ostringstream rows;
+        rows << "\n********** Search Results **********\n";
+        vector<int> available;
+        for (uint32_t t : titles)
+        {
+            appendTitleRow(rows, t, viewerId, *version, available);
+        }
+        rows << "---------------------------------------\n";
+        if (titles.empty())
+        {
+            rows << "No books match \"" << query << "\".\n";
+        }
+        else if (fuzzy)
+        {
+            rows << "No books match \"" << query << "\"; showing the " << titles.size() << " closest titles instead.\n";
+        }
+        else
+        {
+            rows << "Showing " << titles.size() << " of " << matched << " matching titles, best match first.\n";
+        }
+        string text = rows.str();
+        out.write(text.data(), text.size());
+        out.flush();
+        return matched;
+    }
+    
+    
+    // Prints books currently borrowed by a user.
+    void printBorrowedBooksByUser(User * user) const
+    {
+        cout << "\n********** Your Borrowed Books **********\n";
+        const vector<BorrowRecord> & records = user->getAccount().getBorrowRecords();
+        bool found = false;
+        for (int bookId : catalog.booksBorrowedBy(user->getUserId()))
+        {
+            for (const auto & record : records)
+            {
+                if (record.bookId == bookId)
+                {
+                    catalog.get(catalog.slotOf(bookId)).printDetails(cout);
+                    cout << "Borrow Date: " << getTimeString(record.borrowTimestamp)
+                         << ", Intended Borrow Days: " << record.borrowDays << endl;
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (!found)
+        {
+            cout << "You have not borrowed any books." << endl;
+        }
+    }
+    
+    
+    // ---------- Circulation ----------
+    // Every change to who holds a copy or waits for a title goes through
+    // these, so the copy, the accounts, the queues and the per-user indexes
+    // stay in step.
+    // Callers hold the ItemLocks of the copy and the users involved, check
+    // eligibility first and log and persist afterwards.
+    
+    // Returns the copy if it exists and is not lent out; otherwise prints
+    // why to out and returns an empty reference.
+    BookRef findLendableBook(int bookId, ostream & out)
+    {
+        BookRef book = findBookById(bookId);
+        if (!book)
+        {
+            out << "Book not found." << endl;
+        }
+        else if (book.getBorrowedBy() != 0)
+        {
+            out << "Book is not available." << endl;
+            return BookRef();
+        }
+        return book;
+    }
+    
+    
+    // Returns the titles with copies that key names by ISBN or by exact
+    // title (see Catalog::titlesNamed()).
+    vector<uint32_t> findTitles(const string & key) const
+    {
+        waitForSearchIndex();
+        return catalog.titlesNamed(key);
+    }
+    
+    
+    // Returns the ID of a copy of one of titles that is not lent out, or
+    // prints that every copy is and returns 0. Takes one bit scan per
+    // title; the caller locks the copy and checks it again.
+    int findAvailableCopy(const vector<uint32_t> & titles, ostream & out) const
+    {
+        for (uint32_t t : titles)
+        {
+            int bookId = catalog.availableCopy(t);
+            if (bookId != 0)
+            {
+                return bookId;
+            }
+        }
+        if (!titles.empty())
+        {
+            out << "All copies of \"" << catalog.titleAt(titles.front()).title
+                << "\" are lent out. Reserve one by its Book ID to join the queue for the next copy returned." << endl;
+        }
+        return 0;
+    }
+    
+    
+    // Number of copies of titles that are not lent out.
+    size_t availableCopies(const vector<uint32_t> & titles) const
+    {
+        size_t count = 0;
+        for (uint32_t t : titles)
+        {
+            count += catalog.availableCount(t);
+        }
+        return count;
+    }
+    
+    
+    // Lends a copy to a user for the given number of days.
+    void lendBook(BookRef book, User * user, int days)
+    {
+        book.updateStatus(BookStatus::Borrowed);
+        book.updateBorrowedBy(user->getUserId());
+        book.publish();
+        user->getAccount().addBorrowedBook(book.getId(), days);
+        lock_guard<mutex> lock(dueMutex);
+        dueIndex.add(user->getUserId(), user->getAccount().getBorrowRecords().back());
+    }
+    
+    
+    // Puts a user at the back of the queue for the copy's title, naming the
+    // title by the copy in their account. Returns their position (from 1).
+    // The caller holds the locks of every copy of the title (see copiesOfTitle()).
+    size_t reserveBookFor(BookRef book, User * user)
+    {
+        user->getAccount().addReservation(book.getId(), reservationSeq++);
+        return catalog.enqueue(book.getTitleId(), user->getUserId());
+    }
+    
+    
+    // Takes a user out of title t's queue and drops the reservation from
+    // their account.
+    void leaveQueue(uint32_t t, User * user)
+    {
+        catalog.dequeue(t, user->getUserId());
+        user->getAccount().changeReservation(findReservationOf(user, t), 0);
+    }
+    
+    
+    // A waiting user who may no longer borrow (see User::canBorrow()) leaves
+    // the queue for the copy's title instead of being lent it, and the
+    // reason is logged. Returns false, changing nothing, if they may borrow.
+    // Call with the user's stripe held.
+    bool dropIneligibleReservation(BookRef book, User * user)
+    {
+        ostringstream reason;
+        if (user->canBorrow(*this, reason))
+        {
+            return false;
+        }
+        leaveQueue(book.getTitleId(), user);
+        string why = reason.str();
+        while (!why.empty() && why.back() == '\n')
+        {
+            why.pop_back();
+        }
+        logTransaction("Reservation of \"" + book.getTitle() + "\" by " + user->getUsername() + " cancelled: " + why);
+        persistUser(user->getUserId());
+        return true;
+    }
+    
+    
+    // Loan period for a reserved copy that is lent automatically on return:
+    // the longest loan the reserving user's role allows.
+    static int reservedLoanDays(const User * user)
+    {
+        return user->maxLoanDays();
+    }
+    
+    
+    // Takes a copy back from the user who borrowed it. If users are waiting
+    // for its title, it is lent to the first of them (see reservedLoanDays()),
+    // who leaves the queue, and that user is returned; otherwise returns
+    // nullptr. Call lockReservingUser() first.
+    User * takeBackBook(BookRef book, User * user)
+    {
+        User * reservingUser = nullptr;
+        int head = catalog.queueHead(book.getTitleId());
+        if (head != 0)
+        {
+            reservingUser = findUserById(head);
+        }
+        if (reservingUser != nullptr)
+        {
+            leaveQueue(book.getTitleId(), reservingUser);
+            lendBook(book, reservingUser, reservedLoanDays(reservingUser));
+        }
+        else
+        {
+            book.updateStatus(BookStatus::Available);
+            book.updateBorrowedBy(0);
+            book.publish();
+        }
+        {
+            lock_guard<mutex> lock(dueMutex);
+            for (const auto & record : user->getAccount().getBorrowRecords())
+            {
+                if (record.bookId == book.getId())
+                {
+                    dueIndex.remove(user->getUserId(), record);
+                }
+            }
+        }
+        user->getAccount().removeBorrowedBook(book.getId());
+        return reservingUser;
+    }
+    
+    
+    // Restarts the loan periods of all of a user's books from now (after a
+    // student pays a fine).
+    void resetBorrowTimestamps(User * user)
+    {
+        lock_guard<mutex> lock(dueMutex);
+        dueIndex.removeAll(user->getUserId(), user->getAccount().getBorrowRecords());
+        user->getAccount().resetBorrowTimestamps();
+        dueIndex.addAll(user->getUserId(), user->getAccount().getBorrowRecords());
+    }
+    
+    
+    // Clears a user's fine; for roles that pay fines the loan periods restart from now.
+    // Returns false if no fine was due.
+    bool payFine(User * user, ostream & out)
+    {
+        ItemLocks locks(*this, {}, { user->getUserId() });
+        double fine = user->getAccount().getFine();
+        if (fine <= 0)
+        {
+            out << "No fine due." << endl;
+            return false;
+        }
+        out << "Paying fine of " << fine << " rupees." << endl;
+        user->getAccount().resetFine();
+        if (user->paysFines())
+        {
+            resetBorrowTimestamps(user);
+        }
+        persistUser(user->getUserId());
+        requireDurability();
+        out << "Fine cleared." << endl;
+        return true;
+    }
+    
+    
+    // True if one of the user's loans is overdue by more than `days` days.
+    bool hasLoanOverdueBy(int userId, int days) const
+    {
+        lock_guard<mutex> lock(dueMutex);
+        return dueIndex.hasOverdueBy(userId, time(0), days);
+    }
+    
+    
+    // Loans overdue now, earliest first.
+    vector<DueLoan> overdueLoans() const
+    {
+        lock_guard<mutex> lock(dueMutex);
+        return dueIndex.overdue(time(0));
+    }
+    
+    
+    // Loans due within the next `days` days, earliest first.
+    vector<DueLoan> loansDueWithin(int days) const
+    {
+        lock_guard<mutex> lock(dueMutex);
+        return dueIndex.dueWithin(time(0), days);
+    }
+    
+    
+    // ---------- Reservation queues ----------
+    // Each title has a first-come, first-served queue of the users waiting
+    // for it (see Catalog::enqueue()). A user's reservations are kept in
+    // their account and saved with it, each naming the title by one of its
+    // copies, so joining or leaving a queue writes one user record. The
+    // queues are rebuilt from the accounts on loading.
+    
+    // Index of a book's title, or Catalog::npos if the book does not exist.
+    size_t titleOfBook(int bookId) const
+    {
+        size_t slot = catalog.slotOf(bookId);
+        return slot == Catalog::npos ? Catalog::npos : catalog.titleOf(slot);
+    }
+    
+    
+    // IDs of every copy of a book's title. Stable under a shared Access.
+    const vector<int> & copiesOfTitle(BookRef book) const
+    {
+        return catalog.copiesOf(book.getTitleId());
+    }
+    
+    
+    // A user's position in the queue for a book's title (from 1), or 0;
+    // length is set to the queue's length.
+    size_t queuePosition(BookRef book, int userId, size_t & length) const
+    {
+        return catalog.queuePosition(book.getTitleId(), userId, length);
+    }
+    
+    
+    // Prints a user's reservations with their places in the queues.
+    void printReservations(const User * user, ostream & out) const
+    {
+        const vector<Reservation> & reservations = user->getAccount().getReservations();
+        out << "\nReserved Books:" << endl;
+        if (reservations.empty())
+        {
+            out << "No reserved books." << endl;
+            return;
+        }
+        for (const Reservation & reservation : reservations)
+        {
+            size_t t = titleOfBook(reservation.bookId);
+            out << "Book ID: " << reservation.bookId << ", Title: " << getBookTitle(reservation.bookId);
+            size_t length = 0;
+            size_t position = (t == Catalog::npos) ? 0 : catalog.queuePosition(static_cast<uint32_t>(t), user->getUserId(), length);
+            if (position != 0)
+            {
+                out << ", Queue Position: " << position << " of " << length;
+            }
+            out << endl;
+        }
+    }
+    
+    
+    // Rebuilds every queue from the accounts, in the order the reservations
+    // were made. Reservations naming a copy that no longer exists are
+    // dropped; returns the IDs of the users who had any.
+    vector<int> rebuildReservationQueues()
+    {
+        vector<tuple<uint64_t, uint32_t, int>> entries;
+        vector<int> dropped;
+        uint64_t lastSeq = 0;
+        catalog.clearQueues();
+        for (User * user : users)
+        {
+            vector<int> missing;
+            for (const Reservation & reservation : user->getAccount().getReservations())
+            {
+                size_t t = titleOfBook(reservation.bookId);
+                if (t == Catalog::npos)
+                {
+                    missing.push_back(reservation.bookId);
+                }
+                else
+                {
+                    entries.emplace_back(reservation.seq, static_cast<uint32_t>(t), user->getUserId());
+                }
+                lastSeq = max(lastSeq, reservation.seq);
+            }
+            for (int bookId : missing)
+            {
+                user->getAccount().changeReservation(bookId, 0);
+            }
+            if (!missing.empty())
+            {
+                dropped.push_back(user->getUserId());
+            }
+        }
+        sort(entries.begin(), entries.end());
+        for (const auto & entry : entries)
+        {
+            catalog.enqueue(get<1>(entry), get<2>(entry));
+        }
+        reservationSeq = lastSeq + 1;
+        return dropped;
+    }
+    
+    
+    // Queues the reservations read from a catalog written before reservation
+    // queues, in book ID order, behind those already queued. Returns the
+    // number queued.
+    size_t importLegacyReservations()
+    {
+        size_t imported = 0;
+        for (const auto & entry : catalog.takeLegacyReservations())
+        {
+            size_t slot = catalog.slotOf(entry.first);
+            User * user = findUserById(entry.second);
+            size_t length = 0;
+            if (slot == Catalog::npos || user == nullptr || user->getRole() == UserRole::Librarian
+                || catalog.queuePosition(catalog.titleOf(slot), user->getUserId(), length) != 0)
+            {
+                continue;
+            }
+            reserveBookFor(BookRef(catalog, slot), user);
+            imported++;
+        }
+        return imported;
+    }
+    
+    
+    // After copy bookId has left title t (removed, or moved to another
+    // title), points the reservations that named it at another copy of t,
+    // or cancels t's queue if t has no copies left (every reservation then
+    // named bookId). Persists the users changed. Needs an exclusive Access.
+    void repointReservations(uint32_t t, int bookId, const string & title)
+    {
+        const vector<int> & copies = catalog.copiesOf(t);
+        int replacement = copies.empty() ? 0 : copies.front();
+        vector<int> changed;
+        vector<int> waiting = catalog.queueOf(t);
+        for (int userId : waiting)
+        {
+            User * user = findUserById(userId);
+            if (user != nullptr && user->getAccount().changeReservation(bookId, replacement))
+            {
+                changed.push_back(userId);
+            }
+        }
+        if (replacement == 0 && !waiting.empty())
+        {
+            catalog.dropQueue(t);
+            logTransaction("Reservation queue for \"" + title + "\" cancelled (" + to_string(waiting.size()) + " users): its last copy was removed.");
+        }
+        persistUsers(changed);
+    }
+    
+    
+    // Book ID of a user's reservation of title t, or 0.
+    int findReservationOf(const User * user, uint32_t t) const
+    {
+        for (const Reservation & reservation : user->getAccount().getReservations())
+        {
+            if (titleOfBook(reservation.bookId) == t)
+            {
+                return reservation.bookId;
+            }
+        }
+        return 0;
+    }
+    
+    
+    // Lends the copies of title t that are not lent out to the users waiting
+    // for it, first come first served, as when a copy is added to a title
+    // with a queue. Needs an exclusive Access.
+    void serveQueue(uint32_t t)
+    {
+        int head;
+        int bookId;
+        while ((head = catalog.queueHead(t)) != 0 && (bookId = catalog.availableCopy(t)) != 0)
+        {
+            User * user = findUserById(head);
+            if (user == nullptr)
+            {
+                catalog.dequeue(t, head);
+                continue;
+            }
+            BookRef book(catalog, catalog.slotOf(bookId));
+            if (dropIneligibleReservation(book, user))
+            {
+                continue;
+            }
+            leaveQueue(t, user);
+            lendBook(book, user, reservedLoanDays(user));
+            logTransaction("Book \"" + book.getTitle() + "\" automatically borrowed by reserving user " + user->getUsername()
+                           + " for " + to_string(reservedLoanDays(user)) + " days when a copy became available.");
+            persistBook(bookId);
+            persistUser(head);
+        }
+    }
+    
+    
+    // Moves a copy to the title with newISBN (see BookRef::updateISBN()),
+    // keeping the queues of both titles in step. Needs an exclusive Access.
+    void relinkBook(BookRef book, const string & newISBN)
+    {
+        uint32_t from = book.getTitleId();
+        string title = book.getTitle();
+        book.updateISBN(newISBN);
+        if (book.getTitleId() != from)
+        {
+            repointReservations(from, book.getId(), title);
+            serveQueue(book.getTitleId());
+        }
+    }
+    
+    
+    // Starts parsing users.txt on the worker pool; text must outlive the returned chunks.
+    // Returns no chunks if the file is missing or empty.
+    vector<future<ParsedChunk<ParsedUser>>> startLoadUsers(string & text)
+    {
+        if (!readWholeFile(usersFile, text))
+        {
+            return {};
+        }
+        return parseChunks<ParsedUser>(workerPool, text, parseUserRecord);
+    }
+    
+    
+    // Replaces the users with the parsed chunks, or with the default users if there are none.
+    // Each pool is sized once for its share of the file.
+    void finishLoadUsers(vector<future<ParsedChunk<ParsedUser>>> & chunks)
+    {
+        users.clear();
+        apply([](auto &... pool) { (pool.clear(), ...); }, pools);
+        if (chunks.empty())
+        {
+            cout << "Users file not found or empty. Loading default users." << endl;
+            users.push_back(poolFor<Student>().add(Student(1, "alice", "pass1")));
+            users.push_back(poolFor<Student>().add(Student(2, "bob", "pass2")));
+            users.push_back(poolFor<Student>().add(Student(3, "charlie", "pass3")));
+            users.push_back(poolFor<Student>().add(Student(4, "diana", "pass4")));
+            users.push_back(poolFor<Student>().add(Student(5, "eric", "pass5")));
+            users.push_back(poolFor<Faculty>().add(Faculty(6, "profX", "pass6")));
+            users.push_back(poolFor<Faculty>().add(Faculty(7, "drY", "pass7")));
+            users.push_back(poolFor<Faculty>().add(Faculty(8, "mrZ", "pass8")));
+            // Modified default librarians: three librarians with specified credentials.
+            users.push_back(poolFor<Librarian>().add(Librarian(9, "librarian1", "admin1")));
+            users.push_back(poolFor<Librarian>().add(Librarian(10, "librarian2", "admin2")));
+            users.push_back(poolFor<Librarian>().add(Librarian(11, "librarian3", "admin3")));
+            rebuildUserIndex();
+            return;
+        }
+        vector<ParsedUser> records;
+        collectChunks(chunks, usersFile, records, parsedUserId);
+        array<size_t, variant_size_v<ParsedUser>> perRole = {};
+        for (const auto & record : records)
+        {
+            perRole[record.index()]++;
+        }
+        apply([&perRole](auto &... pool)
+            {
+                size_t role = 0;
+                (pool.reserve(perRole[role++]), ...);
+            }, pools
+        );
+        users.reserve(records.size());
+        for (auto & record : records)
+        {
+            users.push_back(storeUser(move(record)));
+        }
+        rebuildUserIndex();
+    }
+    
+    
+    // Loads users from file or default data.
+    void loadUsers()
+    {
+        string text;
+        auto chunks = startLoadUsers(text);
+        finishLoadUsers(chunks);
+    }
+    
+    
+    void saveUsers()
+    {
+        ScopedTimer timer = timeOperation(TimedOperation::SaveUsers);
+        ostringstream out;
+        for (auto user : users)
+        {
+            out << roleToString(user->getRole()) << ";" << user->serialize() << "\n";
+        }
+        writer.writeSnapshot(usersFile, out.str());
+    }
+    
+    
+    // Opens the transaction log for appending. Past entries stay on disk.
+    void openTransactionLog()
+    {
+        if (!filesystem::exists(logFile))
+        {
+            cout << "Transaction log file not found. Starting new log." << endl;
+        }
+        writer.openLog(logFile);
+    }
+    
+    
+    // Appends a timestamped entry to the transaction log.
+    void logTransaction(const string & entry)
+    {
+        ScopedTimer timer = timeOperation(TimedOperation::LogTransaction);
+        lock_guard<mutex> lock(logMutex);
+        time_t now = time(0);
+        if (now != logStampTime)
+        {
+            logStampTime = now;
+            logStamp = "[" + getTimeString(now) + "] ";
+        }
+        writer.appendLog({ logStamp + entry });
+    }
+    
+    
+    // Logs several entries as one batch with a single flush.
+    void logTransactions(const vector<string> & entries)
+    {
+        string stamp = "[" + getTimeString(time(0)) + "] ";
+        vector<string> lines;
+        lines.reserve(entries.size());
+        for (const auto & entry : entries)
+        {
+            lines.push_back(stamp + entry);
+        }
+        lock_guard<mutex> lock(logMutex);
+        writer.appendLog(move(lines));
+    }
+    
+    
+    // Charges the overdue fines every fine-paying patron has accrued since
+    // the last sweep. Accounts are processed in parallel ranges on the
+    // worker pool; the charges are then logged as one batch and persisted
+    // with one write.
+    // Needs an exclusive Access.
+    FineSweepReport runFineSweep()
+    {
+        FineSweepReport report;
+        auto start = chrono::steady_clock::now();
+        time_t now = time(0);
+        struct Charge
+        {
+            int userId;
+            size_t loans;
+            double amount;
+        };
+        vector<Charge> charges;
+        mutex chargesMutex;
+        parallelFor(workerPool, users.size(), [this, now, &charges, &chargesMutex](size_t begin, size_t end)
+            {
+                vector<Charge> local;
+                for (size_t i = begin; i < end; i++)
+                {
+                    if (!users[i]->paysFines())
+                    {
+                        continue;
+                    }
+                    size_t loans = 0;
+                    double amount = users[i]->accrueOverdueFines(now, catalog, loans);
+                    if (loans > 0)
+                    {
+                        local.push_back(Charge{ users[i]->getUserId(), loans, amount });
+                    }
+                }
+                lock_guard<mutex> lock(chargesMutex);
+                charges.insert(charges.end(), local.begin(), local.end());
+            }
+        );
+        auto swept = chrono::steady_clock::now();
+        sort(charges.begin(), charges.end(), [](const Charge & a, const Charge & b) { return a.userId < b.userId; });
+        
+        vector<string> entries;
+        vector<int> chargedIds;
+        for (const auto & charge : charges)
+        {
+            ostringstream entry;
+            User * charged = findUserById(charge.userId);
+            entry << "Fine sweep: " << roleToString(charged->getRole()) << " " << charged->getUsername() << " charged "
+                  << charge.amount << " rupees for " << charge.loans << " overdue loan(s).";
+            entries.push_back(entry.str());
+            chargedIds.push_back(charge.userId);
+            report.loansCharged += charge.loans;
+            report.amount += charge.amount;
+        }
+        report.usersScanned = users.size();
+        report.usersCharged = charges.size();
+        ostringstream summary;
+        summary << fixed << setprecision(0) << "Fine sweep: " << report.usersCharged << " of " << report.usersScanned
+                << " users charged " << report.amount << " rupees in total.";
+        entries.push_back(summary.str());
+        logTransactions(entries);
+        persistUsers(chargedIds);
+        requireDurability();
+        auto end = chrono::steady_clock::now();
+        report.sweepMs = chrono::duration<double, milli>(swept - start).count();
+        report.totalMs = chrono::duration<double, milli>(end - start).count();
+        return report;
+    }
+    
+    
+    // Streams the transaction log from disk, once the entries still queued are written.
+    void viewTransactionLog(ostream & out)
+    {
+        waitForWrites();
+        out << "--------- Transaction Log ---------" << endl;
+        ifstream fin(logFile);
+        string line;
+        while (getline(fin, line))
+        {
+            if (!line.empty())
+            {
+                out << line << "\n";
+            }
+        }
+        out << "-------------------------------------" << endl;
+    }
+    
+    
+    // A new copy of a title that users are waiting for is lent to the first of them.
+    void addBookToLibrary(const Book & book)
+    {
+        size_t slot = catalog.append(book);
+        logTransaction("Book added: " + book.getTitle());
+        persistBook(book.getId());
+        serveQueue(catalog.titleOf(slot));
+    }
+    
+    
+    // Returns false if the book does not exist.
+    bool removeBookFromLibrary(int bookId)
+    {
+        size_t t = titleOfBook(bookId);
+        string title = getBookTitle(bookId);
+        if (!eraseBook(bookId))
+        {
+            return false;
+        }
+        logTransaction("Book removed (ID): " + to_string(bookId));
+        appendJournal("-B;" + to_string(bookId), true);
+        repointReservations(static_cast<uint32_t>(t), bookId, title);
+        return true;
+    }
+    
+    
+
+    BookRef findBookById(int id)
+    {
+        ScopedTimer timer = timeOperation(TimedOperation::FindBook);
+        size_t slot = catalog.slotOf(id);
+        if (slot == Catalog::npos)
+        {
+            return BookRef();
+        }
+        return BookRef(catalog, slot);
+    }
+    
+    
+    int generateBookId() const
+    {
+        int maxId = 0;
+        for (int id : catalog.idColumn())
+        {
+            maxId = max(maxId, id);
+        }
+        return maxId + 1;
+    }
+    
+    
+    // Creates a user in the pool for its role, indexes and persists it.
+    User * addUserToLibrary(UserRole role, int id, const string & uname, const string & pwd)
+    {
+        User * user = nullptr;
+        visitUserClass(role, [&](auto * userClass)
+            {
+                using UserClass = remove_pointer_t<decltype(userClass)>;
+                user = poolFor(userClass).add(UserClass(id, uname, pwd));
+            }
+        );
+        users.push_back(user);
+        userSlotById.emplace(user->getUserId(), users.size() - 1);
+        userSlotByName.emplace(user->getUsername(), users.size() - 1);
+        logTransaction("User added: " + user->getUsername());
+        persistUser(user->getUserId());
+        return user;
+    }
+    
+    
+    // Returns false if the user does not exist.
+    bool removeUserFromLibrary(int userId)
+    {
+        User * user = findUserById(userId);
+        if (!user)
+        {
+            return false;
+        }
+        logTransaction("User removed: " + user->getUsername());
+        eraseUser(userId);
+        appendJournal("-U;" + to_string(userId), false);
+        return true;
+    }
+    
+    
+    // Returns false (with the reason written to out) if the user does not
+    // exist, the new username or password cannot be stored, or the new
+    // username is taken.
+    bool updateUserInLibrary(int userId, const string & newUsername, const string & newPassword, ostream & out)
+    {
+        auto it = userSlotById.find(userId);
+        if (it == userSlotById.end())
+        {
+            out << "User with ID " << userId << " not found." << endl;
+            return false;
+        }
+        size_t slot = it->second;
+        User * user = users[slot];
+        if ((!newUsername.empty() && !checkAccountField(newUsername, "username", out))
+            || (!newPassword.empty() && !checkAccountField(newPassword, "password", out)))
+        {
+            return false;
+        }
+        if (!newUsername.empty() && newUsername != user->getUsername())
+        {
+            if (userSlotByName.count(newUsername))
+            {
+                out << "Username \"" << newUsername << "\" is already taken." << endl;
+                return false;
+            }
+            userSlotByName.erase(user->getUsername());
+            user->setUsername(newUsername);
+            userSlotByName.emplace(newUsername, slot);
+        }
+        if (!newPassword.empty())
+        {
+            user->setPassword(newPassword);
+        }
+        logTransaction("User updated: " + user->getUsername());
+        persistUser(userId);
+        return true;
+    }
+    
+    
+    User* findUserByUsername(const string & uname)
+    {
+        auto it = userSlotByName.find(uname);
+        if (it == userSlotByName.end())
+        {
+            return nullptr;
+        }
+        return users[it->second];
+    }
+    
+    
+    User* authenticateUser(const string & uname, const string & pwd)
+    {
+        ScopedTimer timer = timeOperation(TimedOperation::Authenticate);
+        User * user = findUserByUsername(trim(uname));
+        if (user != nullptr && user->checkPassword(trim(pwd)))
+        {
+            return user;
+        }
+        return nullptr;
+    }
+    
+    
+
+    // Starts timing one operation; the time is recorded when the returned
+    // timer goes out of scope.
+    ScopedTimer timeOperation(TimedOperation op)
+    {
+        static thread_local unsigned calls = 0;
+        unsigned every = PerformanceStats::sampleEvery(op);
+        if (!options.collectStats || (every > 1 && calls++ % every != 0))
+        {
+            return ScopedTimer(nullptr);
+        }
+        return ScopedTimer(&performance.histogram(op));
+    }
+    
+    
+    void printPerformanceStats(ostream & out) const
+    {
+        out << "\n********** Performance Stats **********\n";
+        if (!options.collectStats)
+        {
+            out << "Statistics are switched off (--no-stats)." << endl;
+            return;
+        }
+        performance.print(out);
+    }
+    
+    
+    // Locks one account at a time, so desk transactions only wait for the
+    // user being printed.
+    void printAllUsers(ostream & out)
+    {
+        out << "\n********** Library Users **********\n";
+        for (auto user : users)
+        {
+            ItemLocks locks(*this, {}, { user->getUserId() });
+            user->display(*this, out);
+        }
+    }
+    
+    
+    int generateUserId()
+    {
+        int maxId = 0;
+        for (auto user : users)
+        {
+            maxId = max(maxId, user->getUserId());
+        }
+        return maxId + 1;
+    }
+    
+    
+    User* findUserById(int id)
+    {
+        auto it = userSlotById.find(id);
+        if (it == userSlotById.end())
+        {
+            return nullptr;
+        }
+        return users[it->second];
+    }
+    
+    
+    size_t bookCount() const
+    {
+        return catalog.size();
+    }
+    
+    
+    size_t userCount() const
+    {
+        return users.size();
+    }
+    
+    
+    // Blocks allocated by the user pools.
+    size_t userPoolBlocks() const
+    {
+        return apply([](const auto &... pool) { return (pool.blockCount() + ...); }, pools);
+    }
+};
+
+
+// ========== Out-of-line Definitions for Display Functions ==========
+
+void User::display(const Library & lib, ostream & out) const
+{
+    out << "=====================================" << endl;
+    out << "User ID: " << userId << endl;
+    out << "Username: " << username << endl;
+    account.printAccountDetails(out);
+    lib.printReservations(this, out);
+    out << "=====================================" << endl;
+}
+
+template <typename Policy>
+void Patron<Policy>::display(const Library & lib, ostream & out) const
+{
+    out << "----- " << Policy::name << " Portal -----" << endl;
+    if constexpr (Policy::fineRate > 0)
+    {
+        time_t now = time(0);
+        double computedFine = 0;
+        for (const auto & record : account.getBorrowRecords())
+        {
+            int daysElapsed = static_cast<int>(difftime(now, record.borrowTimestamp) / 86400);
+            if (daysElapsed - Policy::maxDays > record.finedDays)
+            {
+                computedFine += (daysElapsed - Policy::maxDays - record.finedDays) * Policy::fineRate;
+            }
+        }
+        out << "User ID: " << userId << "\nUsername: " << username << endl;
+        account.printAccountDetails(out);
+        out << "Computed Overdue Fine (for active borrows): " << computedFine << " rupees" << endl;
+        lib.printReservations(this, out);
+        out << "-------------------------------------" << endl;
+    }
+    else
+    {
+        User::display(lib, out);
+    }
+}
+
+void Librarian::display(const Library & lib, ostream & out) const
+{
+    out << "----- Librarian Portal -----" << endl;
+    User::display(lib, out);
+}
+
+
+// ========== Implementation of Patron Member Functions ==========
+
+template <typename Policy>
+bool Patron<Policy>::checkBorrowLimits(const Library & lib, ostream & out) const
+{
+    if constexpr (Policy::fineRate > 0)
+    {
+        if (account.getFine() > 0)
+        {
+            out << "Outstanding fine of " << account.getFine() << " rupees. Please pay fine before borrowing." << endl;
+            return false;
+        }
+    }
+    if constexpr (Policy::overdueBlockDays > 0)
+    {
+        if (lib.hasLoanOverdueBy(getUserId(), Policy::overdueBlockDays))
+        {
+            out << "You have a book overdue by more than " << Policy::overdueBlockDays
+                << " days. You cannot borrow new books until you return it." << endl;
+            return false;
+        }
+    }
+    if (account.getBorrowRecords().size() >= Policy::maxBooks)
+    {
+        out << "Borrowing limit reached (" << Policy::maxBooks << " books maximum). No further books can be borrowed." << endl;
+        return false;
+    }
+    return true;
+}
+
+// Accepts a Book ID, or an ISBN or title to take any free copy of it.
+template <typename Policy>
+void Patron<Policy>::borrowBook(Library & lib)
+{
+    if (!checkBorrowLimits(lib, cout))
+    {
+        return;
+    }
+    cout << "Enter the Book ID, ISBN or title to borrow: ";
+    string answer;
+    cin >> ws;
+    getline(cin, answer);
+    answer = string(trimView(answer));
+    int bookId = 0;
+    auto parsed = from_chars(answer.data(), answer.data() + answer.size(), bookId);
+    bool numeric = parsed.ec == errc() && parsed.ptr == answer.data() + answer.size();
+    bool byId = numeric && lib.findBookById(bookId);
+    if (byId)
+    {
+        if (!lib.findLendableBook(bookId, cout))
+        {
+            return;
+        }
+    }
+    else
+    {
+        vector<uint32_t> titles = lib.findTitles(answer);
+        if (titles.empty())
+        {
+            cout << (numeric ? "Book not found." : "No book has that ISBN or title.") << endl;
+            return;
+        }
+        if (lib.findAvailableCopy(titles, cout) == 0)
+        {
+            return;
+        }
+    }
+    cout << "Enter number of days to borrow (maximum " << Policy::maxDays << "): ";
+    int days;
+    cin >> days;
+    if (byId)
+    {
+        borrowBook(lib, bookId, days, cout);
+    }
+    else
+    {
+        borrowTitle(lib, answer, days, cout);
+    }
+}
+
+template <typename Policy>
+bool Patron<Policy>::borrowBook(Library & lib, int bookId, int days, ostream & out)
+{
+    return borrowCopy(lib, bookId, days, nullptr, out);
+}
+
+// Each pass tries the lowest free copy. A copy someone else took first
+// has its bit cleared by then, so the next pass finds another one.
+template <typename Policy>
+bool Patron<Policy>::borrowTitle(Library & lib, const string & titleOrISBN, int days, ostream & out)
+{
+    vector<uint32_t> titles = lib.findTitles(titleOrISBN);
+    if (titles.empty())
+    {
+        out << "No book has the ISBN or title \"" << titleOrISBN << "\"." << endl;
+        return false;
+    }
+    while (true)
+    {
+        int bookId = lib.findAvailableCopy(titles, out);
+        if (bookId == 0)
+        {
+            return false;
+        }
+        bool taken = false;
+        bool borrowed = borrowCopy(lib, bookId, days, &taken, out);
+        if (borrowed)
+        {
+            out << "Your copy is Book ID " << bookId << ". Copies still available: " << lib.availableCopies(titles) << "." << endl;
+        }
+        if (!taken)
+        {
+            return borrowed;
+        }
+    }
+}
+
+template <typename Policy>
+bool Patron<Policy>::borrowCopy(Library & lib, int bookId, int days, bool * taken, ostream & out)
+{
+    ScopedTimer timer = lib.timeOperation(TimedOperation::Borrow);
+    Library::ItemLocks locks(lib, { bookId }, { getUserId() });
+    if (!checkBorrowLimits(lib, out))
+    {
+        return false;
+    }
+    BookRef book = lib.findBookById(bookId);
+    if (taken != nullptr && book && book.getBorrowedBy() != 0)
+    {
+        *taken = true;
+        return false;
+    }
+    book = lib.findLendableBook(bookId, out);
+    if (!book)
+    {
+        return false;
+    }
+    if (days < 1)
+    {
+        out << "Borrowing period must be at least 1 day." << endl;
+        return false;
+    }
+    if (days > Policy::maxDays)
+    {
+        out << "Borrowing period exceeds the maximum allowed for " << Policy::group << "." << endl;
+        return false;
+    }
+    lib.lendBook(book, this, days);
+    out << "Book \"" << book.getTitle() << "\" successfully borrowed for " << days << " days." << endl;
+    lib.logTransaction(string(Policy::name) + " " + getUsername() + " borrowed book \"" + book.getTitle() + "\" for " + to_string(days) + " days.");
+    lib.persistBook(book.getId());
+    lib.persistUser(getUserId());
+    return true;
+}
+
+template <typename Policy>
+void Patron<Policy>::reserveBook(Library & lib)
+{
+    cout << "Enter the Book ID to reserve: ";
+    int bookId;
+    cin >> bookId;
+    reserveBook(lib, bookId, cout);
+}
+
+// Reserving a copy joins the queue for its title: the next copy returned
+// goes to the first user in the queue.
+template <typename Policy>
+bool Patron<Policy>::reserveBook(Library & lib, int bookId, ostream & out)
+{
+    ScopedTimer timer = lib.timeOperation(TimedOperation::Reserve);
+    BookRef book = lib.findBookById(bookId);
+    if (!book)
+    {
+        out << "Book not found." << endl;
+        return false;
+    }
+    // Every copy of the title is locked, so none comes back while the queue is joined.
+    Library::ItemLocks locks(lib, lib.copiesOfTitle(book), { getUserId() });
+    // The copy is lent automatically later, so the user must be able to borrow now.
+    if (!checkBorrowLimits(lib, out))
+    {
+        return false;
+    }
+    if (lib.availableCopies({ book.getTitleId() }) > 0)
+    {
+        out << "A copy of \"" << book.getTitle() << "\" is available; borrow it instead of reserving." << endl;
+        return false;
+    }
+    for (const auto & record : account.getBorrowRecords())
+    {
+        if (lib.titleOfBook(record.bookId) == book.getTitleId())
+        {
+            out << "You have already borrowed a copy of this book; reservation not allowed." << endl;
+            return false;
+        }
+    }
+    size_t length = 0;
+    size_t position = lib.queuePosition(book, getUserId(), length);
+    if (position != 0)
+    {
+        out << "You have already reserved this book; you are number " << position << " of " << length << " in the queue." << endl;
+        return false;
+    }
+    position = lib.reserveBookFor(book, this);
+    out << "Book \"" << book.getTitle() << "\" reserved successfully. You are number " << position
+        << " in the queue; a copy will be automatically borrowed for you when it is your turn." << endl;
+    lib.logTransaction(string(Policy::name) + " " + getUsername() + " reserved book \"" + book.getTitle() + "\" (number " + to_string(position) + " in the queue).");
+    lib.persistUser(getUserId());
+    return true;
+}
+
+template <typename Policy>
+void Patron<Policy>::returnBook(Library & lib)
+{
+    lib.printBorrowedBooksByUser(this);
+    cout << "Enter the Book ID to return: ";
+    int bookId;
+    cin >> bookId;
+    returnBook(lib, bookId, cout);
+}
+
+// Roles that pay fines are charged for each day kept beyond the policy's
+// maximum (less the days the fine sweep already charged); other roles are
+// only told how late the book is against the period they chose.
+template <typename Policy>
+bool Patron<Policy>::returnBook(Library & lib, int bookId, ostream & out)
+{
+    ScopedTimer timer = lib.timeOperation(TimedOperation::Return);
+    Library::ItemLocks locks(lib, { bookId }, { getUserId() });
+    BookRef book = lib.findBookById(bookId);
+    if (!book)
+    {
+        out << "Book not found." << endl;
+        return false;
+    }
+    lib.lockReservingUser(book, locks);
+    const vector<BorrowRecord> & records = account.getBorrowRecords();
+    bool found = false;
+    int intendedDays = -1;
+    int finedDays = 0;
+    time_t borrowTime;
+    for (const auto & record : records)
+    {
+        if (record.bookId == book.getId())
+        {
+            intendedDays = record.borrowDays;
+            borrowTime = record.borrowTimestamp;
+            finedDays = record.finedDays;
+            found = true;
+            break;
+        }
+    }
+    if (!found)
+    {
+        out << "You did not borrow this book." << endl;
+        return false;
+    }
+    time_t now = time(0);
+    int elapsedDays = static_cast<int>(difftime(now, borrowTime) / 86400);
+    out << "Book was kept for " << elapsedDays << " days." << endl;
+    if constexpr (Policy::fineRate > 0)
+    {
+        if (elapsedDays > Policy::maxDays)
+        {
+            int overdue = elapsedDays - Policy::maxDays;
+            double fine = max(0, overdue - finedDays) * Policy::fineRate;
+            account.addFine(fine);
+            out << "Book is overdue by " << overdue << " days. Fine of " << fine << " rupees imposed";
+            if (finedDays > 0)
+            {
+                out << " (" << finedDays << " days were already charged by the fine sweep)";
+            }
+            out << "." << endl;
+        }
+    }
+    else
+    {
+        if (elapsedDays > intendedDays)
+        {
+            int overdue = elapsedDays - intendedDays;
+            out << "Book is overdue by " << overdue << " days. (No fine imposed for " << Policy::group << ")" << endl;
+            if (Policy::overdueBlockDays > 0 && overdue > Policy::overdueBlockDays)
+            {
+                out << "Warning: You have an overdue book for more than " << Policy::overdueBlockDays << " days." << endl;
+            }
+        }
+    }
+    User * reservingUser = lib.takeBackBook(book, this);
+    if (reservingUser != nullptr)
+    {
+        lib.persistUser(reservingUser->getUserId());
+        lib.logTransaction("Book \"" + book.getTitle() + "\" automatically borrowed by reserving user " + reservingUser->getUsername() + " for " + to_string(Library::reservedLoanDays(reservingUser)) + " days upon return.");
+        out << "The copy has been lent to the first user in the reservation queue." << endl;
+    }
+    out << "Book returned successfully." << endl;
+    string allowance = (Policy::fineRate > 0) ? "allowed: " + to_string(Policy::maxDays) : "intended: " + to_string(intendedDays);
+    lib.logTransaction(string(Policy::name) + " " + getUsername() + " returned book \"" + book.getTitle() + "\"; kept for " + to_string(elapsedDays) + " days (" + allowance + ").");
+    lib.persistBook(book.getId());
+    lib.persistUser(getUserId());
+    return true;
+}
+
+
+// ========== Implementation of Librarian Administrative Functions ==========
+// These change which books and users exist or the title data, so callers
+// hold an exclusive Library::Access.
+
+void Librarian::addBook(Library & lib)
+{
+    cin.ignore();
+    cout << "Enter title: ";
+    string title;
+    getline(cin, title);
+    cout << "Enter author: ";
+    string author;
+    getline(cin, author);
+    cout << "Enter publisher: ";
+    string publisher;
+    getline(cin, publisher);
+    cout << "Enter publication year: ";
+    int year;
+    cin >> year;
+    cin.ignore();
+    cout << "Enter ISBN: ";
+    string isbn;
+    getline(cin, isbn);
+    addBook(lib, title, author, publisher, year, isbn, cout);
+}
+
+bool Librarian::addBook(Library & lib, const string & title, const string & author, const string & publisher,
+                        int year, const string & isbn, ostream & out)
+{
+    Book newBook(lib.generateBookId(), title, author, publisher, year, isbn, BookStatus::Available);
+    lib.addBookToLibrary(newBook);
+    out << "Book added successfully." << endl;
+    return true;
+}
+
+void Librarian::removeBook(Library & lib)
+{
+    cout << "Enter Book ID to remove: ";
+    int id;
+    cin >> id;
+    removeBook(lib, id, cout);
+}
+
+bool Librarian::removeBook(Library & lib, int bookId, ostream & out)
+{
+    // A lent copy stays until it is returned, so its loan and due date never outlive it.
+    BookRef book = lib.findBookById(bookId);
+    if (book && book.getBorrowedBy() != 0)
+    {
+        out << "Book with ID " << bookId << " is on loan and cannot be removed until it is returned." << endl;
+        return false;
+    }
+    if (!lib.removeBookFromLibrary(bookId))
+    {
+        out << "Book with ID " << bookId << " not found." << endl;
+        return false;
+    }
+    return true;
+}
+
+void Librarian::updateBook(Library & lib)
+{
+    cout << "Enter Book ID to update: ";
+    int id;
+    cin >> id;
+    BookRef book = lib.findBookById(id);
+    if (!book)
+    {
+        cout << "Book not found." << endl;
+        return;
+    }
+    cin.ignore();
+    cout << "Updating book details. Press ENTER to skip a field." << endl;
+    if (book.getCopiesOfTitle() > 1)
+    {
+        cout << "Title, publisher and year are shared by all " << book.getCopiesOfTitle()
+             << " copies of this title; a new ISBN moves only this copy." << endl;
+    }
+    string newTitle, newPublisher, newYear, newISBN;
+    cout << "Current Title: " << book.getTitle() << ". New Title: ";
+    getline(cin, newTitle);
+    cout << "Current Publisher: " << book.getPublisher() << ". New Publisher: ";
+    getline(cin, newPublisher);
+    cout << "Current Year: " << book.getYear() << ". New Year: ";
+    getline(cin, newYear);
+    cout << "Current ISBN: " << book.getISBN() << ". New ISBN: ";
+    getline(cin, newISBN);
+    updateBook(lib, id, newTitle, newPublisher, newYear, newISBN, cout);
+}
+
+// Empty fields are left unchanged.
+bool Librarian::updateBook(Library & lib, int bookId, const string & newTitle, const string & newPublisher,
+                           const string & newYear, const string & newISBN, ostream & out)
+{
+    BookRef book = lib.findBookById(bookId);
+    if (!book)
+    {
+        out << "Book not found." << endl;
+        return false;
+    }
+    int year = 0;
+    if (!newYear.empty() && !parseNumber(newYear, year))
+    {
+        out << "Invalid year \"" << newYear << "\"." << endl;
+        return false;
+    }
+    // Relink first so the other changes apply to the copy's new title.
+    if (!newISBN.empty())
+    {
+        lib.relinkBook(book, newISBN);
+    }
+    if (!newTitle.empty())
+    {
+        book.updateTitle(newTitle);
+    }
+    if (!newPublisher.empty())
+    {
+        book.updatePublisher(newPublisher);
+    }
+    if (!newYear.empty())
+    {
+        book.updateYear(year);
+    }
+    out << "Book updated successfully." << endl;
+    lib.logTransaction("Librarian updated book (ID): " + to_string(bookId));
+    if (newTitle.empty() && newPublisher.empty() && newYear.empty())
+    {
+        lib.persistBook(bookId);
+    }
+    else
+    {
+        lib.persistTitle(bookId);
+    }
+    return true;
+}
+
+void Librarian::addUser(Library & lib)
+{
+    cout << "Enter user type (1 for Student, 2 for Faculty): ";
+    int type;
+    cin >> type;
+    cin.ignore();
+    cout << "Enter username: ";
+    string uname;
+    cin >> uname;
+    cout << "Enter password: ";
+    string pwd;
+    cin >> pwd;
+    addUser(lib, type, uname, pwd, cout);
+}
+
+// type is 1 for a student, 2 for faculty.
+bool Librarian::addUser(Library & lib, int type, const string & uname, const string & pwd, ostream & out)
+{
+    if (!checkAccountField(uname, "username", out) || !checkAccountField(pwd, "password", out))
+    {
+        return false;
+    }
+    if (lib.findUserByUsername(uname) != nullptr)
+    {
+        out << "Username \"" << uname << "\" is already taken." << endl;
+        return false;
+    }
+    if (type != 1 && type != 2)
+    {
+        out << "Invalid user type." << endl;
+        return false;
+    }
+    lib.addUserToLibrary(type == 1 ? UserRole::Student : UserRole::Faculty, lib.generateUserId(), uname, pwd);
+    out << "User added successfully." << endl;
+    return true;
+}
+
+void Librarian::removeUser(Library & lib)
+{
+    cout << "Enter User ID to remove: ";
+    int id;
+    if (!(cin >> id))
+    {
+        cout << "Invalid input for User ID. Please enter an integer." << endl;
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        return;
+    }
+    removeUser(lib, id, cout);
+}
+
+bool Librarian::removeUser(Library & lib, int userId, ostream & out)
+{
+    if (userId == this->getUserId())
+    {
+        out << "You cannot remove your own account." << endl;
+        return false;
+    }
+    // Copies lent to a removed user could never be returned, so loans must be returned first.
+    User * user = lib.findUserById(userId);
+    if (user && !user->getAccount().getBorrowRecords().empty())
+    {
+        out << "User with ID " << userId << " has " << user->getAccount().getBorrowRecords().size()
+            << " book(s) on loan and cannot be removed until they are returned." << endl;
+        return false;
+    }
+    if (!lib.removeUserFromLibrary(userId))
+    {
+        out << "User with ID " << userId << " not found." << endl;
+        return false;
+    }
+    out << "User removed successfully." << endl;
+    return true;
+}
+
+void Librarian::updateUser(Library & lib)
+{
+    cout << "Enter User ID to update: ";
+    int id;
+    if (!(cin >> id))
+    {
+        cout << "Invalid input for User ID. Please enter an integer." << endl;
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        return;
+    }
+    cin.ignore();
+    cout << "Enter new username (or press ENTER to leave unchanged): ";
+    string newUsername;
+    getline(cin, newUsername);
+    cout << "Enter new password (or press ENTER to leave unchanged): ";
+    string newPassword;
+    getline(cin, newPassword);
+    updateUser(lib, id, newUsername, newPassword, cout);
+}
+
+bool Librarian::updateUser(Library & lib, int userId, const string & newUsername, const string & newPassword, ostream & out)
+{
+    if (!lib.updateUserInLibrary(userId, trim(newUsername), newPassword, out))
+    {
+        return false;
+    }
+    out << "User updated successfully." << endl;
+    return true;
+}
+
+
+void Librarian::viewOverdueLoans(Library & lib)
+{
+    printOverdueLoans(lib, cout);
+    cout << "Show loans due in the next how many days? (0 to skip): ";
+    int days;
+    cin >> days;
+    if (days <= 0)
+    {
+        return;
+    }
+    printLoansDueWithin(lib, days, cout);
+}
+
+
+void Librarian::printOverdueLoans(Library & lib, ostream & out)
+{
+    time_t now = time(0);
+    vector<DueLoan> overdue = lib.overdueLoans();
+    out << "\n********** Overdue Loans **********\n";
+    if (overdue.empty())
+    {
+        out << "No overdue loans." << endl;
+    }
+    for (const auto & loan : overdue)
+    {
+        User * user = lib.findUserById(loan.userId);
+        out << "Book ID: " << loan.bookId << " (" << lib.getBookTitle(loan.bookId) << "), Borrower: "
+            << (user ? user->getUsername() : "ID " + to_string(loan.userId))
+            << ", Due: " << getTimeString(loan.due)
+            << ", Days Overdue: " << static_cast<int>(difftime(now, loan.due) / 86400) << endl;
+    }
+}
+
+
+void Librarian::printLoansDueWithin(Library & lib, int days, ostream & out)
+{
+    vector<DueLoan> upcoming = lib.loansDueWithin(days);
+    out << "\n********** Loans Due in the Next " << days << " Days **********\n";
+    if (upcoming.empty())
+    {
+        out << "No loans due." << endl;
+    }
+    for (const auto & loan : upcoming)
+    {
+        User * user = lib.findUserById(loan.userId);
+        out << "Book ID: " << loan.bookId << " (" << lib.getBookTitle(loan.bookId) << "), Borrower: "
+            << (user ? user->getUsername() : "ID " + to_string(loan.userId))
+            << ", Due: " << getTimeString(loan.due) << endl;
+    }
+}
+
+
+void printFineSweepReport(const FineSweepReport & report, ostream & out)
+{
+    ios::fmtflags savedFlags = out.flags();
+    streamsize savedPrecision = out.precision();
+    out << fixed << setprecision(0) << "Fine sweep: " << report.usersCharged << " of " << report.usersScanned
+        << " users charged " << report.amount << " rupees for " << report.loansCharged << " overdue loans." << endl;
+    double usersPerSec = report.sweepMs > 0 ? report.usersScanned / (report.sweepMs / 1000) : 0;
+    out << setprecision(1) << "Swept in " << report.sweepMs << " ms (" << setprecision(0) << usersPerSec
+        << " users/sec), " << setprecision(1) << report.totalMs << " ms including logging and saving." << endl;
+    out.flags(savedFlags);
+    out.precision(savedPrecision);
+}
+
+
+void Librarian::runFineSweep(Library & lib)
+{
+    printFineSweepReport(lib.runFineSweep(), cout);
+}
+
+
+// Function: registerUser()
+// Creates a student (role 1) or faculty (role 2) account for self-registration.
+// Needs an exclusive Library::Access. Returns false if the username or
+// password cannot be stored or the username is taken.
+bool registerUser(Library & lib, int role, const string & uname, const string & pwd, ostream & out)
+{
+    if (!checkAccountField(uname, "username", out) || !checkAccountField(pwd, "password", out))
+    {
+        out << "Registration failed." << endl;
+        return false;
+    }
+    if (lib.findUserByUsername(uname) != nullptr)
+    {
+        out << "Username \"" << uname << "\" is already taken. Registration failed." << endl;
+        return false;
+    }
+    if (role != 1 && role != 2)
+    {
+        out << "Invalid role. Registration failed." << endl;
+        return false;
+    }
+    lib.addUserToLibrary(role == 1 ? UserRole::Student : UserRole::Faculty, lib.generateUserId(), uname, pwd);
+    out << "Registration successful. Please log in with your new credentials." << endl;
+    return true;
+}
+
+
+// ========== Portal Menus ==========
+
+// Function: searchBooks()
+// Asks for search words and prints the best matching titles.
+// viewerId as for Library::printBookPage().
+void searchBooks(Library & lib, int viewerId)
+{
+    cin.ignore();
+    cout << "Enter words from the title, author, publisher or ISBN (the start of a word is enough): ";
+    string query;
+    getline(cin, query);
+    lib.printSearchResults(query, viewerId, Library::searchLimit, cout);
+}
+
+
+// Function: browseBooks()
+// Shows the title listing a page at a time until the user goes back.
+// viewerId as for Library::printBookPage().
+void browseBooks(Library & lib, int viewerId)
+{
+    size_t pageSize = 20;
+    ListingPage page = lib.printBookPage(viewerId, numeric_limits<int>::min(), pageSize, cout);
+    while (page.titles > 0)
+    {
+        cout << "[n] Next  [p] Previous  [a <Book ID>] Start after Book ID  [s <size>] Page size  [q] Back: ";
+        string command;
+        if (!(cin >> command))
+        {
+            return;
+        }
+        char c = static_cast<char>(tolower(static_cast<unsigned char>(command[0])));
+        if (c == 'q')
+        {
+            return;
+        }
+        if (c == 'n' || c == 'p')
+        {
+            if (c == 'n' ? !page.more : !page.previous)
+            {
+                cout << (c == 'n' ? "This is the last page." : "This is the first page.") << endl;
+                continue;
+            }
+            page = (c == 'n') ? lib.printBookPage(viewerId, page.lastId, pageSize, cout)
+                              : lib.printBookPageBefore(viewerId, page.firstId, pageSize, cout);
+        }
+        else if (c == 'a' || c == 's')
+        {
+            int value;
+            if (!(cin >> value) || (c == 's' && value < 1))
+            {
+                cin.clear();
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                cout << (c == 'a' ? "Invalid Book ID." : "Invalid page size.") << endl;
+                continue;
+            }
+            if (c == 's')
+            {
+                pageSize = value;
+            }
+            // A new page size redraws from the first title of this page.
+            ListingPage next = lib.printBookPage(viewerId, (c == 'a') ? value : page.firstId - 1, pageSize, cout);
+            if (next.titles > 0)
+            {
+                page = next;
+            }
+        }
+        else
+        {
+            cout << "Invalid option. Please try again." << endl;
+        }
+    }
+}
+
+
+void userPortalMenu(User * user, Library & lib)
+{
+    int choice;
+    do
+    {
+        cout << "\n----- User Portal -----" << endl;
+        cout << "1. View Book List" << endl;
+        cout << "2. Borrow Book" << endl;
+        cout << "3. Reserve Book" << endl;
+        cout << "4. Return Book" << endl;
+        cout << "5. View Account Details" << endl;
+        cout << "6. Pay Fine" << endl;
+        cout << "7. Search Books" << endl;
+        cout << "8. Logout" << endl;
+        cout << "Enter your choice: ";
+        cin >> choice;
+        
+        // The console is the only client, so each action simply runs alone.
+        Library::Access access(lib, AccessMode::Exclusive);
+        switch (choice)
+        {
+            case 1:
+            {
+                browseBooks(lib, user->getUserId());
+                break;
+            }
+            case 2:
+            {
+                user->borrowBook(lib);
+                break;
+            }
+            case 3:
+            {
+                user->reserveBook(lib);
+                break;
+            }
+            case 4:
+            {
+                user->returnBook(lib);
+                break;
+            }
+            case 5:
+            {
+                user->display(lib, cout);
+                break;
+            }
+            case 6:
+            {
+                lib.payFine(user, cout);
+                break;
+            }
+            case 7:
+            {
+                searchBooks(lib, user->getUserId());
+                break;
+            }
+            case 8:
+            {
+                cout << "Logging out..." << endl;
+                break;
+            }
+            default:
+            {
+                cout << "Invalid option. Please try again." << endl;
+                break;
+            }
+        }
+        
+    } while (choice != 8);
+}
+
+
+void librarianPortalMenu(Librarian * libUser, Library & lib)
+{
+    int choice;
+    do
+    {
+        cout << "\n----- Librarian Portal -----" << endl;
+        cout << "1. Add Book" << endl;
+        cout << "2. Remove Book" << endl;
+        cout << "3. Update Book" << endl;
+        cout << "4. Add User" << endl;
+        cout << "5. Remove User" << endl;
+        cout << "6. Update User" << endl;
+        cout << "7. View All Books" << endl;
+        cout << "8. View All Users" << endl;
+        cout << "9. View Transaction Log" << endl;
+        cout << "10. View Overdue Loans" << endl;
+        cout << "11. Run Fine Sweep" << endl;
+        cout << "12. Performance Stats" << endl;
+        cout << "13. Logout" << endl;
+        cout << "Enter your choice: ";
+        cin >> choice;
+        
+        Library::Access access(lib, AccessMode::Exclusive);
+        switch (choice)
+        {
+            case 1:
+            {
+                libUser->addBook(lib);
+                break;
+            }
+            case 2:
+            {
+                libUser->removeBook(lib);
+                break;
+            }
+            case 3:
+            {
+                libUser->updateBook(lib);
+                break;
+            }
+            case 4:
+            {
+                libUser->addUser(lib);
+                break;
+            }
+            case 5:
+            {
+                libUser->removeUser(lib);
+                break;
+            }
+            case 6:
+            {
+                libUser->updateUser(lib);
+                break;
+            }
+            case 7:
+            {
+                browseBooks(lib, 0);
+                break;
+            }
+            case 8:
+            {
+                lib.printAllUsers(cout);
+                break;
+            }
+            case 9:
+            {
+                lib.viewTransactionLog(cout);
+                break;
+            }
+            case 10:
+            {
+                libUser->viewOverdueLoans(lib);
+                break;
+            }
+            case 11:
+            {
+                libUser->runFineSweep(lib);
+                break;
+            }
+            case 12:
+            {
+                lib.printPerformanceStats(cout);
+                break;
+            }
+            case 13:
+            {
+                cout << "Logging out..." << endl;
+                break;
+            }
+            default:
+            {
+                cout << "Invalid option. Please try again." << endl;
+                break;
+            }
+        }
+        
+    } while (choice != 13);
+}
+
+
+// ========== Role Selection and Login/Registration ==========
+
+void displayRoleSelectionMenu()
+{
+    cout << "\n========================================" << endl;
+    cout << "         Library Management System      " << endl;
+    cout << "========================================" << endl;
+    cout << "Select your role:" << endl;
+    cout << "1. Student" << endl;
+    cout << "2. Faculty" << endl;
+    cout << "3. Librarian" << endl;
+    cout << "4. Exit" << endl;
+    cout << "Enter your choice: ";
+}
+
+
+void registrationProcess(Library & lib, int role)
+{
+    cin.ignore();
+    cout << "\n=== Registration ===" << endl;
+    cout << "Enter desired username (no spaces): ";
+    string uname;
+    cin >> uname;
+    cout << "Enter password: ";
+    string pwd;
+    cin >> pwd;
+    cout << "Confirm password: ";
+    string cpwd;
+    cin >> cpwd;
+    if (pwd != cpwd)
+    {
+        cout << "Passwords do not match. Registration failed." << endl;
+        return;
+    }
+    Library::Access access(lib, AccessMode::Exclusive);
+    registerUser(lib, role, uname, pwd, cout);
+}
+
+
+void loginProcess(Library & lib, int role)
+{
+    cin.ignore();
+    cout << "\n=== Login ===" << endl;
+    cout << "Enter username: ";
+    string uname;
+    cin >> uname;
+    cout << "Enter password: ";
+    string pwd;
+    cin >> pwd;
+    User * user = nullptr;
+    {
+        Library::Access access(lib, AccessMode::Shared);
+        user = lib.authenticateUser(uname, pwd);
+    }
+    if (user != nullptr)
+    {
+        if (role == 1 && user->getRole() == UserRole::Student)
+        {
+            cout << "Login successful. Welcome, " << user->getUsername() << "!" << endl;
+            userPortalMenu(user, lib);
+        }
+        else if (role == 2 && user->getRole() == UserRole::Faculty)
+        {
+            cout << "Login successful. Welcome, " << user->getUsername() << "!" << endl;
+            userPortalMenu(user, lib);
+        }
+        else if (role == 3 && user->getRole() == UserRole::Librarian)
+        {
+            cout << "Login successful. Welcome, Librarian!" << endl;
+            librarianPortalMenu(static_cast<Librarian*>(user), lib);
+        }
+        else
+        {
+            cout << "Your account does not match the selected role." << endl;
         }
     }
     else
     {
-        book->updateStatus(BookStatus::Available);
-        book->updateBorrowedBy(0);
+        cout << "Invalid credentials." << endl;
+    }
+}
+
+
+// ========== Command Sessions ==========
+
+// Class: CommandSession
+// Runs library operations for one server client or batch script from text
+// commands, one per line (for example "BORROW 12 7"). A session starts logged out; LOGIN picks
+// the account that later commands act for. Each command holds the
+// Library::Access its table entry names, so circulation and views from many
+// sessions run side by side and only administrative changes run alone.
+class CommandSession
+{
+private:
+    // Who may run a command.
+    enum class Role
+    {
+        Anyone,         // Also before LOGIN.
+        LoggedIn,
+        Patron,         // Students and faculty.
+        Librarian
+    };
+    
+    
+    typedef bool (CommandSession::*Handler)(User * user, string_view args, ostream & out);
+    
+    
+    struct Command
+    {
+        const char * name;
+        const char * usage;
+        Role role;
+        AccessMode access;
+        Handler handler;
+    };
+    
+    
+    Library & lib;
+    int userId;                 // Logged-in user, or 0.
+    bool closed;                // Set by QUIT.
+    bool shutdownRequested;     // Set by SHUTDOWN.
+    
+    
+    static const vector<Command> & commands()
+    {
+        static const vector<Command> table = {
+            { "HELP", "HELP", Role::Anyone, AccessMode::Shared, &CommandSession::help },
+            { "LOGIN", "LOGIN <username> <password>", Role::Anyone, AccessMode::Shared, &CommandSession::login },
+            { "REGISTER", "REGISTER student|faculty <username> <password>", Role::Anyone, AccessMode::Exclusive, &CommandSession::registerAccount },
+            { "INFO", "INFO", Role::Anyone, AccessMode::Shared, &CommandSession::info },
+            { "QUIT", "QUIT", Role::Anyone, AccessMode::Shared, &CommandSession::quit },
+            { "LOGOUT", "LOGOUT", Role::LoggedIn, AccessMode::Shared, &CommandSession::logout },
+            { "ACCOUNT", "ACCOUNT", Role::LoggedIn, AccessMode::Shared, &CommandSession::account },
+            { "BOOKS", "BOOKS [afterBookId] [pageSize]", Role::Patron, AccessMode::Shared, &CommandSession::books },
+            { "SEARCH", "SEARCH <words>", Role::LoggedIn, AccessMode::Shared, &CommandSession::search },
+            { "BORROW", "BORROW <bookId> <days>", Role::Patron, AccessMode::Shared, &CommandSession::borrow },
+            { "BORROWTITLE", "BORROWTITLE <days> <ISBN or title>", Role::Patron, AccessMode::Shared, &CommandSession::borrowTitle },
+            { "RESERVE", "RESERVE <bookId>", Role::Patron, AccessMode::Shared, &CommandSession::reserve },
+            { "RETURN", "RETURN <bookId>", Role::Patron, AccessMode::Shared, &CommandSession::giveBack },
+            { "PAYFINE", "PAYFINE", Role::Patron, AccessMode::Shared, &CommandSession::payFine },
+            { "ADDBOOK", "ADDBOOK <title>;<author>;<publisher>;<year>;<ISBN>", Role::Librarian, AccessMode::Exclusive, &CommandSession::addBook },
+            { "REMOVEBOOK", "REMOVEBOOK <bookId>", Role::Librarian, AccessMode::Exclusive, &CommandSession::removeBook },
+            { "UPDATEBOOK", "UPDATEBOOK <bookId>;<title>;<publisher>;<year>;<ISBN> (empty fields stay unchanged)", Role::Librarian, AccessMode::Exclusive, &CommandSession::updateBook },
+            { "ADDUSER", "ADDUSER student|faculty <username> <password>", Role::Librarian, AccessMode::Exclusive, &CommandSession::addUser },
+            { "REMOVEUSER", "REMOVEUSER <userId>", Role::Librarian, AccessMode::Exclusive, &CommandSession::removeUser },
+            { "UPDATEUSER", "UPDATEUSER <userId>;<username>;<password> (empty fields stay unchanged)", Role::Librarian, AccessMode::Exclusive, &CommandSession::updateUser },
+            { "ALLBOOKS", "ALLBOOKS [afterBookId] [pageSize]", Role::Librarian, AccessMode::Shared, &CommandSession::allBooks },
+            { "ALLUSERS", "ALLUSERS", Role::Librarian, AccessMode::Shared, &CommandSession::allUsers },
+            { "LOG", "LOG", Role::Librarian, AccessMode::Shared, &CommandSession::transactionLog },
+            { "OVERDUE", "OVERDUE [days]", Role::Librarian, AccessMode::Shared, &CommandSession::overdue },
+            { "FINESWEEP", "FINESWEEP", Role::Librarian, AccessMode::Exclusive, &CommandSession::fineSweep },
+            { "STATS", "STATS", Role::Librarian, AccessMode::Shared, &CommandSession::stats },
+            { "SHUTDOWN", "SHUTDOWN", Role::Librarian, AccessMode::Shared, &CommandSession::shutdown }
+        };
+        return table;
+    }
+    
+    
+    static bool allowed(Role role, const User * user)
+    {
+        switch (role)
+        {
+            case Role::Anyone:
+                return true;
+            case Role::LoggedIn:
+                return user != nullptr;
+            case Role::Patron:
+                return user != nullptr && user->getRole() != UserRole::Librarian;
+            case Role::Librarian:
+                return user != nullptr && user->getRole() == UserRole::Librarian;
+        }
+        return false;
+    }
+    
+    
+    // Reports a malformed command.
+    static bool fail(ostream & out, const string & error)
+    {
+        out << "Error: " << error << "." << endl;
+        return false;
+    }
+    
+    
+    // Parses "student" or "faculty" into the console's role number (1 or 2).
+    static bool parseUserType(string_view word, int & type)
+    {
+        string lower(trimView(word));
+        transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return tolower(c); });
+        type = (lower == "student") ? 1 : (lower == "faculty") ? 2 : 0;
+        return type != 0;
+    }
+    
+    
+    bool help(User * user, string_view, ostream & out)
+    {
+        out << "Commands:" << endl;
+        for (const auto & command : commands())
+        {
+            if (allowed(command.role, user))
+            {
+                out << "  " << command.usage << endl;
+            }
+        }
+        return true;
+    }
+    
+    
+    bool login(User *, string_view args, ostream & out)
+    {
+        FieldReader reader(args);
+        string_view uname, pwd;
+        string error;
+        if (!reader.next(uname, "username", error, ' ') || !reader.next(pwd, "password", error, ' '))
+        {
+            return fail(out, error);
+        }
+        User * found = lib.authenticateUser(string(uname), string(pwd));
+        if (found == nullptr)
+        {
+            out << "Invalid credentials." << endl;
+            return false;
+        }
+        userId = found->getUserId();
+        out << "Login successful. Welcome, " << found->getUsername() << "!" << endl;
+        return true;
+    }
+    
+    
+    bool registerAccount(User *, string_view args, ostream & out)
+    {
+        FieldReader reader(args);
+        string_view type, uname, pwd;
+        string error;
+        int role = 0;
+        if (!reader.next(type, "user type", error, ' ') || !reader.next(uname, "username", error, ' ')
+            || !reader.next(pwd, "password", error, ' '))
+        {
+            return fail(out, error);
+        }
+        if (!parseUserType(type, role))
+        {
+            return fail(out, "user type must be student or faculty");
+        }
+        return registerUser(lib, role, string(uname), string(pwd), out);
+    }
+    
+    
+    bool info(User *, string_view, ostream & out)
+    {
+        out << "Books: " << lib.bookCount() << endl;
+        out << "Users: " << lib.userCount() << endl;
+        return true;
+    }
+    
+    
+    bool quit(User *, string_view, ostream & out)
+    {
+        closed = true;
+        out << "Goodbye!" << endl;
+        return true;
+    }
+    
+    
+    bool logout(User *, string_view, ostream & out)
+    {
+        userId = 0;
+        out << "Logging out..." << endl;
+        return true;
+    }
+    
+    
+    bool account(User * user, string_view, ostream & out)
+    {
+        Library::ItemLocks locks(lib, {}, { user->getUserId() });
+        user->display(lib, out);
+        return true;
+    }
+    
+    
+    // Shared by BOOKS and ALLBOOKS: "[afterBookId] [pageSize]".
+    bool bookPage(int viewerId, const char * verb, string_view args, ostream & out)
+    {
+        int afterId = numeric_limits<int>::min();
+        int pageSize = 20;
+        FieldReader reader(args);
+        string error;
+        if (!args.empty() && (!reader.nextNumber(afterId, "book ID", error, ' ')
+            || (!reader.atEnd() && !reader.nextNumber(pageSize, "page size", error, ' '))))
+        {
+            return fail(out, error);
+        }
+        if (pageSize < 1)
+        {
+            return fail(out, "page size must be at least 1");
+        }
+        ListingPage page = lib.printBookPage(viewerId, afterId, pageSize, out);
+        if (page.more)
+        {
+            out << "Next page: " << verb << " " << page.lastId << " " << pageSize << endl;
+        }
+        return true;
+    }
+    
+    
+    bool books(User * user, string_view args, ostream & out)
+    {
+        return bookPage(user->getUserId(), "BOOKS", args, out);
+    }
+    
+    
+    // Librarians get the listing view with every copy ID.
+    bool search(User * user, string_view args, ostream & out)
+    {
+        if (trimView(args).empty())
+        {
+            return fail(out, "missing search words");
+        }
+        int viewerId = (user->getRole() == UserRole::Librarian) ? 0 : user->getUserId();
+        lib.printSearchResults(string(args), viewerId, Library::searchLimit, out);
+        return true;
+    }
+    
+    
+    bool borrow(User * user, string_view args, ostream & out)
+    {
+        FieldReader reader(args);
+        int bookId, days;
+        string error;
+        if (!reader.nextNumber(bookId, "book ID", error, ' ') || !reader.nextNumber(days, "number of days", error, ' '))
+        {
+            return fail(out, error);
+        }
+        return user->borrowBook(lib, bookId, days, out);
+    }
+    
+    
+    bool borrowTitle(User * user, string_view args, ostream & out)
+    {
+        FieldReader reader(args);
+        int days;
+        string error;
+        if (!reader.nextNumber(days, "number of days", error, ' '))
+        {
+            return fail(out, error);
+        }
+        string_view key = reader.atEnd() ? string_view() : trimView(reader.remainder());
+        if (key.empty())
+        {
+            return fail(out, "missing ISBN or title");
+        }
+        return user->borrowTitle(lib, string(key), days, out);
+    }
+    
+    
+    bool reserve(User * user, string_view args, ostream & out)
+    {
+        int bookId;
+        string error;
+        if (!FieldReader(args).nextNumber(bookId, "book ID", error, ' '))
+        {
+            return fail(out, error);
+        }
+        return user->reserveBook(lib, bookId, out);
+    }
+    
+    
+    bool giveBack(User * user, string_view args, ostream & out)
+    {
+        int bookId;
+        string error;
+        if (!FieldReader(args).nextNumber(bookId, "book ID", error, ' '))
+        {
+            return fail(out, error);
+        }
+        return user->returnBook(lib, bookId, out);
+    }
+    
+    
+    bool payFine(User * user, string_view, ostream & out)
+    {
+        return lib.payFine(user, out);
+    }
+    
+    
+    bool addBook(User * user, string_view args, ostream & out)
+    {
+        FieldReader reader(args);
+        string_view title, author, publisher, isbn;
+        int year;
+        string error;
+        if (!reader.next(title, "title", error) || !reader.next(author, "author", error)
+            || !reader.next(publisher, "publisher", error) || !reader.nextNumber(year, "year", error)
+            || !reader.next(isbn, "ISBN", error))
+        {
+            return fail(out, error);
+        }
+        return static_cast<Librarian*>(user)->addBook(lib, string(trimView(title)), string(trimView(author)),
+                                                      string(trimView(publisher)), year, string(trimView(isbn)), out);
+    }
+    
+    
+    bool removeBook(User * user, string_view args, ostream & out)
+    {
+        int bookId;
+        string error;
+        if (!FieldReader(args).nextNumber(bookId, "book ID", error, ' '))
+        {
+            return fail(out, error);
+        }
+        return static_cast<Librarian*>(user)->removeBook(lib, bookId, out);
+    }
+    
+    
+    bool updateBook(User * user, string_view args, ostream & out)
+    {
+        FieldReader reader(args);
+        int bookId;
+        string_view title, publisher, year, isbn;
+        string error;
+        if (!reader.nextNumber(bookId, "book ID", error) || !reader.next(title, "title", error)
+            || !reader.next(publisher, "publisher", error) || !reader.next(year, "year", error)
+            || !reader.next(isbn, "ISBN", error))
+        {
+            return fail(out, error);
+        }
+        return static_cast<Librarian*>(user)->updateBook(lib, bookId, string(trimView(title)), string(trimView(publisher)),
+                                                         string(trimView(year)), string(trimView(isbn)), out);
+    }
+    
+    
+    bool addUser(User * user, string_view args, ostream & out)
+    {
+        FieldReader reader(args);
+        string_view type, uname, pwd;
+        string error;
+        int userType = 0;
+        if (!reader.next(type, "user type", error, ' ') || !reader.next(uname, "username", error, ' ')
+            || !reader.next(pwd, "password", error, ' '))
+        {
+            return fail(out, error);
+        }
+        if (!parseUserType(type, userType))
+        {
+            return fail(out, "user type must be student or faculty");
+        }
+        return static_cast<Librarian*>(user)->addUser(lib, userType, string(uname), string(pwd), out);
+    }
+    
+    
+    bool removeUser(User * user, string_view args, ostream & out)
+    {
+        int id;
+        string error;
+        if (!FieldReader(args).nextNumber(id, "user ID", error, ' '))
+        {
+            return fail(out, error);
+        }
+        return static_cast<Librarian*>(user)->removeUser(lib, id, out);
+    }
+    
+    
+    bool updateUser(User * user, string_view args, ostream & out)
+    {
+        FieldReader reader(args);
+        int id;
+        string_view uname, pwd;
+        string error;
+        if (!reader.nextNumber(id, "user ID", error) || !reader.next(uname, "username", error)
+            || !reader.next(pwd, "password", error))
+        {
+            return fail(out, error);
+        }
+        return static_cast<Librarian*>(user)->updateUser(lib, id, string(uname), string(trimView(pwd)), out);
+    }
+    
+    
+    bool allBooks(User *, string_view args, ostream & out)
+    {
+        return bookPage(0, "ALLBOOKS", args, out);
+    }
+    
+    
+    bool allUsers(User *, string_view, ostream & out)
+    {
+        lib.printAllUsers(out);
+        return true;
+    }
+    
+    
+    bool transactionLog(User *, string_view, ostream & out)
+    {
+        lib.viewTransactionLog(out);
+        return true;
+    }
+    
+    
+    bool overdue(User * user, string_view args, ostream & out)
+    {
+        int days = 0;
+        string error;
+        if (!args.empty() && !FieldReader(args).nextNumber(days, "number of days", error, ' '))
+        {
+            return fail(out, error);
+        }
+        Librarian * librarian = static_cast<Librarian*>(user);
+        librarian->printOverdueLoans(lib, out);
+        if (days > 0)
+        {
+            librarian->printLoansDueWithin(lib, days, out);
+        }
+        return true;
+    }
+    
+    
+    bool fineSweep(User *, string_view, ostream & out)
+    {
+        printFineSweepReport(lib.runFineSweep(), out);
+        return true;
+    }
+    
+    
+    bool stats(User *, string_view, ostream & out)
+    {
+        lib.printPerformanceStats(out);
+        return true;
+    }
+    
+    
+    bool shutdown(User *, string_view, ostream & out)
+    {
+        shutdownRequested = true;
+        out << "Server shutting down." << endl;
+        return true;
+    }
+    
+    
+public:
+    explicit CommandSession(Library & library)
+    : lib(library)
+    , userId(0)
+    , closed(false)
+    , shutdownRequested(false)
+    {
+    }
+    
+    
+    // Returns a command line's verb as the table names it: upper case, with
+    // any '-' or '_' dropped ("add-book" is ADDBOOK).
+    static string verbOf(string_view line)
+    {
+        line = trimView(line);
+        string verb;
+        for (char c : line.substr(0, line.find(' ')))
+        {
+            if (c != '-' && c != '_')
+            {
+                verb += static_cast<char>(toupper(static_cast<unsigned char>(c)));
+            }
+        }
+        return verb;
+    }
+    
+    
+    // Runs one command line, writing its output to out.
+    // Returns false if the command was malformed, not allowed or refused.
+    bool execute(string_view line, ostream & out)
+    {
+        line = trimView(line);
+        if (line.empty())
+        {
+            return fail(out, "empty command; type HELP for a list");
+        }
+        size_t space = line.find(' ');
+        string verb = verbOf(line);
+        string_view args = (space == string_view::npos) ? string_view() : trimView(line.substr(space + 1));
+        
+        const vector<Command> & table = commands();
+        auto command = find_if(table.begin(), table.end(), [&verb](const Command & c) { return verb == c.name; });
+        if (command == table.end())
+        {
+            return fail(out, "unknown command \"" + verb + "\"; type HELP for a list");
+        }
+        
+        Library::Access access(lib, command->access);
+        // Re-resolved every time: a librarian may have removed the account.
+        User * user = (userId != 0) ? lib.findUserById(userId) : nullptr;
+        if (userId != 0 && user == nullptr)
+        {
+            userId = 0;
+            out << "Your account no longer exists; you have been logged out." << endl;
+        }
+        if (!allowed(command->role, user))
+        {
+            return fail(out, user == nullptr ? "please LOGIN first" : verb + " is not available to your account");
+        }
+        return (this->*command->handler)(user, args, out);
+    }
+    
+    
+    bool isClosed() const
+    {
+        return closed;
+    }
+    
+    
+    bool wantsShutdown() const
+    {
+        return shutdownRequested;
+    }
+};
+
+
+// ========== Server Mode ==========
+// "--serve <socket>" runs the library for many clients at once over a local
+// Unix-domain socket, one thread per connection. The protocol is line based:
+// the client sends one command per line (see CommandSession) and each reply
+// is the command's output followed by a status line, ".OK" or ".ERR".
+// Output lines that start with '.' are sent with an extra '.' in front.
+
+atomic<bool> serverStopRequested(false);    // Set by SIGINT/SIGTERM or SHUTDOWN.
+
+
+extern "C" void handleStopSignal(int)
+{
+    serverStopRequested = true;
+}
+
+
+// Function: writeAll()
+// Sends all of data. Returns false if the connection is gone.
+bool writeAll(int fd, string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data.remove_prefix(sent);
+    }
+    return true;
+}
+
+
+// Class: SocketLineReader
+// Reads newline-terminated lines from a socket through a buffer.
+class SocketLineReader
+{
+private:
+    int fd;
+    string buffer;
+    size_t start;   // First unread byte in buffer.
+    
+public:
+    explicit SocketLineReader(int socket)
+    : fd(socket)
+    , start(0)
+    {
+    }
+    
+    
+    // Reads the next line without its line ending. Returns false at the end
+    // of the stream or on an error.
+    bool readLine(string & line)
+    {
+        while (true)
+        {
+            size_t end = buffer.find('\n', start);
+            if (end != string::npos)
+            {
+                size_t length = end - start;
+                if (length > 0 && buffer[end - 1] == '\r')
+                {
+                    length--;
+                }
+                line.assign(buffer, start, length);
+                start = end + 1;
+                return true;
+            }
+            buffer.erase(0, start);
+            start = 0;
+            char chunk[4096];
+            ssize_t got = recv(fd, chunk, sizeof(chunk), 0);
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                return false;
+            }
+            buffer.append(chunk, got);
+        }
+    }
+};
+
+
+// Function: frameResponse()
+// Appends one command's output and its status line to reply.
+void frameResponse(const string & output, bool ok, string & reply)
+{
+    size_t pos = 0;
+    while (pos < output.size())
+    {
+        size_t end = output.find('\n', pos);
+        if (end == string::npos)
+        {
+            end = output.size();
+        }
+        if (output[pos] == '.')
+        {
+            reply += '.';
+        }
+        reply.append(output, pos, end - pos);
+        reply += '\n';
+        pos = end + 1;
+    }
+    reply += ok ? ".OK\n" : ".ERR\n";
+}
+
+
+// Function: readResponse()
+// Reads one framed reply into body (with the framing removed).
+// Returns false if the connection closed first.
+bool readResponse(SocketLineReader & reader, string & body, bool & ok)
+{
+    body.clear();
+    string line;
+    while (reader.readLine(line))
+    {
+        if (line == ".OK" || line == ".ERR")
+        {
+            ok = (line == ".OK");
+            return true;
+        }
+        body.append(line, (!line.empty() && line[0] == '.') ? 1 : 0, string::npos);
+        body += '\n';
+    }
+    return false;
+}
+
+
+// Function: connectToServer()
+// Opens a connection to a server socket. Returns -1 (after printing why) on failure.
+int connectToServer(const string & socketPath)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+    {
+        cout << "Socket path too long: " << socketPath << endl;
+        return -1;
+    }
+    strcpy(addr.sun_path, socketPath.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        cout << "Cannot connect to " << socketPath << ": " << strerror(errno) << endl;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+
+// Function: serveClient()
+// Runs one client's session until it sends QUIT or disconnects.
+void serveClient(Library & lib, int fd)
+{
+    CommandSession session(lib);
+    SocketLineReader reader(fd);
+    ostringstream out;
+    string line;
+    string reply;
+    while (!session.isClosed() && reader.readLine(line))
+    {
+        out.str("");
+        bool ok = session.execute(line, out);
+        reply.clear();
+        frameResponse(out.str(), ok, reply);
+        if (!writeAll(fd, reply))
+        {
+            break;
+        }
+        if (session.wantsShutdown())
+        {
+            serverStopRequested = true;
+        }
+    }
+}
+
+
+// Function: runServer()
+// Accepts clients on socketPath until SIGINT, SIGTERM or a librarian's
+// SHUTDOWN, then closes the remaining connections and returns.
+int runServer(Library & lib, const string & socketPath)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+    {
+        cout << "Socket path too long: " << socketPath << endl;
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0
+        || listen(listener, SOMAXCONN) < 0)
+    {
+        cout << "Cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+        if (listener >= 0)
+        {
+            close(listener);
+        }
+        return 1;
+    }
+    signal(SIGINT, handleStopSignal);
+    signal(SIGTERM, handleStopSignal);
+    cout << "Serving on " << socketPath << " (Ctrl+C to stop)." << endl;
+    
+    mutex clientsMutex;
+    condition_variable clientsDone;
+    set<int> clientFds;         // Open connections.
+    while (!serverStopRequested)
+    {
+        pollfd ready = { listener, POLLIN, 0 };
+        if (poll(&ready, 1, 200) <= 0)
+        {
+            continue;   // Timeout or signal: check the stop flag again.
+        }
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            continue;
+        }
+        lock_guard<mutex> lock(clientsMutex);
+        clientFds.insert(fd);
+        thread([&lib, &clientsMutex, &clientsDone, &clientFds, fd]()
+            {
+                serveClient(lib, fd);
+                {
+                    lock_guard<mutex> lock(clientsMutex);
+                    clientFds.erase(fd);
+                    clientsDone.notify_all();
+                }
+                close(fd);
+            }
+        ).detach();
+    }
+    close(listener);
+    unlink(socketPath.c_str());
+    
+    // Wake clients blocked in recv() and wait for their sessions to end.
+    unique_lock<mutex> lock(clientsMutex);
+    for (int fd : clientFds)
+    {
+        ::shutdown(fd, SHUT_RDWR);
+    }
+    clientsDone.wait(lock, [&clientFds]() { return clientFds.empty(); });
+    cout << "Server stopped." << endl;
+    return 0;
+}
+
+
+// Function: runClient()
+// "--client <socket>": sends each line of standard input to the server and
+// prints the replies.
+int runClient(const string & socketPath)
+{
+    int fd = connectToServer(socketPath);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    SocketLineReader reader(fd);
+    bool interactive = isatty(STDIN_FILENO);
+    string line, body;
+    bool ok = true;
+    while (true)
+    {
+        if (interactive)
+        {
+            cout << "lms> " << flush;
+        }
+        if (!getline(cin, line))
+        {
+            break;
+        }
+        if (!writeAll(fd, line + "\n") || !readResponse(reader, body, ok))
+        {
+            cout << "Connection closed by the server." << endl;
+            break;
+        }
+        cout << body << flush;
+        string verb = line.substr(0, line.find(' '));
+        transform(verb.begin(), verb.end(), verb.begin(), [](unsigned char c) { return toupper(c); });
+        if (verb == "QUIT")
+        {
+            break;
+        }
+    }
+    close(fd);
+    return ok ? 0 : 1;
+}
+
+
+// Struct: LoadPhaseResult
+struct LoadPhaseResult
+{
+    size_t requests = 0;
+    size_t refused = 0;         // Replies with ".ERR" (e.g. a copy someone else holds).
+    size_t failedClients = 0;   // Connections that could not log in or broke off.
+    double seconds = 0;
+    vector<double> latenciesUs;
+};
+
+
+// Function: runLoadPhase()
+// Runs `clients` connections for `seconds`. Client N logs in as student
+// "loadN" and repeats: borrow a random copy (returning it at once when that
+// worked) and, every fourth round, view its account.
+LoadPhaseResult runLoadPhase(const string & socketPath, int clients, double seconds, int bookCount)
+{
+    LoadPhaseResult result;
+    mutex resultMutex;
+    vector<thread> threads;
+    auto deadline = chrono::steady_clock::now() + chrono::duration<double>(seconds);
+    auto start = chrono::steady_clock::now();
+    for (int c = 1; c <= clients; c++)
+    {
+        threads.emplace_back([&, c]()
+            {
+                LoadPhaseResult local;
+                int fd = connectToServer(socketPath);
+                if (fd < 0)
+                {
+                    lock_guard<mutex> lock(resultMutex);
+                    result.failedClients++;
+                    return;
+                }
+                SocketLineReader reader(fd);
+                string body;
+                bool ok = false;
+                bool connected = writeAll(fd, "LOGIN load" + to_string(c) + " load\n") && readResponse(reader, body, ok) && ok;
+                mt19937 rng(c);
+                uniform_int_distribution<int> bookDist(1, max(1, bookCount));
+                auto request = [&](const string & command)
+                {
+                    auto sent = chrono::steady_clock::now();
+                    connected = writeAll(fd, command) && readResponse(reader, body, ok);
+                    local.latenciesUs.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - sent).count());
+                    local.requests++;
+                    local.refused += ok ? 0 : 1;
+                    return connected && ok;
+                };
+                for (int round = 0; connected && chrono::steady_clock::now() < deadline; round++)
+                {
+                    int bookId = bookDist(rng);
+                    if (request("BORROW " + to_string(bookId) + " 7\n"))
+                    {
+                        request("RETURN " + to_string(bookId) + "\n");
+                    }
+                    if (connected && round % 4 == 0)
+                    {
+                        request("ACCOUNT\n");
+                    }
+                }
+                if (connected)
+                {
+                    writeAll(fd, "QUIT\n");
+                    readResponse(reader, body, ok);
+                }
+                close(fd);
+                lock_guard<mutex> lock(resultMutex);
+                result.requests += local.requests;
+                result.refused += local.refused;
+                result.failedClients += connected ? 0 : 1;
+                result.latenciesUs.insert(result.latenciesUs.end(), local.latenciesUs.begin(), local.latenciesUs.end());
+            }
+        );
+    }
+    for (auto & t : threads)
+    {
+        t.join();
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+
+// Function: runLoadTest()
+// "--load-test <socket> [maxClients] [seconds]": registers the load
+// students if needed, then measures throughput and latency for 1, 2, 4, ...
+// maxClients concurrent clients.
+int runLoadTest(const string & socketPath, int maxClients, double seconds)
+{
+    int fd = connectToServer(socketPath);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    SocketLineReader reader(fd);
+    string body;
+    bool ok = false;
+    int bookCount = 0;
+    if (writeAll(fd, "INFO\n") && readResponse(reader, body, ok))
+    {
+        bookCount = atoi(body.c_str() + body.find(':') + 1);
+    }
+    for (int c = 1; c <= maxClients; c++)
+    {
+        // Fails harmlessly if the account already exists.
+        writeAll(fd, "REGISTER student load" + to_string(c) + " load\n");
+        readResponse(reader, body, ok);
+    }
+    writeAll(fd, "QUIT\n");
+    readResponse(reader, body, ok);
+    close(fd);
+    
+    cout << "Books: " << bookCount << ", " << seconds << " s per step" << endl;
+    cout << setw(10) << "clients" << setw(12) << "requests" << setw(12) << "req/s" << setw(12) << "mean us"
+         << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(10) << "refused" << endl;
+    for (int clients = 1; clients <= maxClients; clients *= 2)
+    {
+        LoadPhaseResult result = runLoadPhase(socketPath, clients, seconds, bookCount);
+        vector<double> & lat = result.latenciesUs;
+        double mean = 0;
+        for (double x : lat)
+        {
+            mean += x;
+        }
+        mean = lat.empty() ? 0 : mean / lat.size();
+        sort(lat.begin(), lat.end());
+        double p50 = lat.empty() ? 0 : lat[lat.size() / 2];
+        double p99 = lat.empty() ? 0 : lat[min(lat.size() - 1, lat.size() * 99 / 100)];
+        cout << setw(10) << clients << setw(12) << result.requests << setw(12) << fixed << setprecision(0)
+             << result.requests / result.seconds << setw(12) << setprecision(1) << mean << setw(12) << p50
+             << setw(12) << p99 << setw(10) << result.refused << endl;
+        if (result.failedClients > 0)
+        {
+            cout << "  " << result.failedClients << " client(s) could not log in or lost the connection." << endl;
+        }
+    }
+    return 0;
+}
+
+
+// ========== Batch Mode ==========
+// "--batch <script>" runs a command script without prompts: one
+// CommandSession command per line, as a single session, so LOGIN and LOGOUT
+// switch accounts along the way. Blank lines and lines starting with '#'
+// are skipped; QUIT or SHUTDOWN ends the script. A summary of throughput
+// and per-command latency follows the output.
+
+// Struct: BatchCommandStats
+// Latency samples for one command verb.
+struct BatchCommandStats
+{
+    string verb;
+    vector<double> micros;
+    size_t failed = 0;
+};
+
+
+// Function: printBatchSummary()
+// Prints the totals and a latency table with one row per verb, in the
+// order the verbs first appeared.
+void printBatchSummary(vector<BatchCommandStats> & stats, double seconds, ostream & out)
+{
+    size_t total = 0;
+    size_t failed = 0;
+    for (const auto & entry : stats)
+    {
+        total += entry.micros.size();
+        failed += entry.failed;
+    }
+    ios::fmtflags savedFlags = out.flags();
+    streamsize savedPrecision = out.precision();
+    out << "\n========== Batch Summary ==========" << endl;
+    out << "Commands: " << total << " (" << total - failed << " succeeded, " << failed << " failed) in "
+        << fixed << setprecision(3) << seconds << " s, " << setprecision(0) << (seconds > 0 ? total / seconds : 0) << " ops/s" << endl;
+    out << left << setw(12) << "command" << right << setw(10) << "count" << setw(10) << "failed" << setw(12) << "mean us"
+        << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "max us" << endl;
+    for (auto & entry : stats)
+    {
+        vector<double> & lat = entry.micros;
+        sort(lat.begin(), lat.end());
+        double sum = 0;
+        for (double x : lat)
+        {
+            sum += x;
+        }
+        out << left << setw(12) << entry.verb << right << setw(10) << lat.size() << setw(10) << entry.failed
+            << setprecision(1) << setw(12) << sum / lat.size() << setw(12) << lat[lat.size() / 2]
+            << setw(12) << lat[min(lat.size() - 1, lat.size() * 99 / 100)] << setw(12) << lat.back() << endl;
+    }
+    out.flags(savedFlags);
+    out.precision(savedPrecision);
+}
+
+
+// Function: runBatch()
+// Runs the script at path ("-" reads standard input). Command output goes
+// to out unless quiet. Returns 1 if the script cannot be opened.
+int runBatch(Library & lib, const string & path, bool quiet, ostream & out)
+{
+    ifstream file;
+    if (path != "-")
+    {
+        file.open(path);
+        if (!file)
+        {
+            out << "Cannot open script: " << path << endl;
+            return 1;
+        }
+    }
+    istream & in = (path == "-") ? cin : file;
+    CommandSession session(lib);
+    vector<BatchCommandStats> stats;
+    unordered_map<string, size_t> statsByVerb;
+    ostringstream reply;
+    string line;
+    auto batchStart = chrono::steady_clock::now();
+    while (!session.isClosed() && !session.wantsShutdown() && getline(in, line))
+    {
+        string_view command = trimView(line);
+        if (command.empty() || command[0] == '#')
+        {
+            continue;
+        }
+        reply.str("");
+        auto start = chrono::steady_clock::now();
+        bool ok = session.execute(command, reply);
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        if (!quiet)
+        {
+            out << "> " << command << '\n' << reply.str();
+        }
+        string verb = CommandSession::verbOf(command);
+        auto it = statsByVerb.find(verb);
+        if (it == statsByVerb.end())
+        {
+            it = statsByVerb.emplace(verb, stats.size()).first;
+            stats.push_back(BatchCommandStats{ verb, {}, 0 });
+        }
+        stats[it->second].micros.push_back(micros);
+        if (!ok)
+        {
+            stats[it->second].failed++;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - batchStart).count();
+    printBatchSummary(stats, seconds, out);
+    return 0;
+}
+
+
+// ========== Benchmarks ==========
+
+// Creates an empty scratch directory for benchmark data files.
+string makeBenchDir(const string & name)
+{
+    filesystem::path dir = filesystem::temp_directory_path() / ("lms_bench_" + name + "_" + to_string(time(0)));
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+    return dir.string();
+}
+
+
+// Stream buffer that discards everything, for timing reports without the terminal.
+struct NullBuffer : streambuf
+{
+    int overflow(int c) override
+    {
+        return c;
+    }
+};
+
+
+// Returns synthetic copy number id (5 copies per title).
+Book syntheticBook(int id)
+{
+    int titleNo = (id - 1) / 5;
+    return Book(id, "Synthetic Title " + to_string(titleNo), "Author " + to_string(titleNo % 997),
+                "Publisher " + to_string(titleNo % 31), 1950 + titleNo % 70, to_string(9780000000000LL + titleNo));
+}
+
+
+// Writes a synthetic books.txt in the one-line-per-copy format.
+void writeSyntheticBooks(const string & dir, int copies)
+{
+    ofstream fout(dir + "/books.txt");
+    for (int id = 1; id <= copies; id++)
+    {
+        fout << syntheticBook(id).serialize() << "\n";
+    }
+}
+
+
+// Writes a synthetic users.txt with the given number of students.
+void writeSyntheticUsers(const string & dir, int count)
+{
+    ofstream fout(dir + "/users.txt");
+    for (int id = 1; id <= count; id++)
+    {
+        Student student(id, "user" + to_string(id), "pw" + to_string(id));
+        fout << "Student;" << student.serialize() << "\n";
+    }
+}
+
+
+// Benchmark: findBookById / findUserById latency as the catalog grows.
+void benchLookup(int maxCopies)
+{
+    const int lookups = 1000000;
+    cout << setw(12) << "copies" << setw(12) << "users" << setw(16) << "book ns/op" << setw(16) << "user ns/op" << endl;
+    for (int copies = 1000; copies <= maxCopies; copies *= 10)
+    {
+        int userCount = max(100, copies / 10);
+        string dir = makeBenchDir("lookup");
+        writeSyntheticBooks(dir, copies);
+        writeSyntheticUsers(dir, userCount);
+        {
+            LibraryOptions options;
+            options.dataDir = dir;
+            Library lib(options);
+            mt19937 rng(42);
+            vector<int> bookIds(lookups);
+            vector<int> userIds(lookups);
+            uniform_int_distribution<int> bookDist(1, copies);
+            uniform_int_distribution<int> userDist(1, userCount);
+            for (int i = 0; i < lookups; i++)
+            {
+                bookIds[i] = bookDist(rng);
+                userIds[i] = userDist(rng);
+            }
+            
+            long long checksum = 0;
+            auto start = chrono::steady_clock::now();
+            for (int id : bookIds)
+            {
+                checksum += lib.findBookById(id).getYear();
+            }
+            auto mid = chrono::steady_clock::now();
+            for (int id : userIds)
+            {
+                checksum += lib.findUserById(id)->getUserId();
+            }
+            auto end = chrono::steady_clock::now();
+            
+            double bookNs = chrono::duration<double, nano>(mid - start).count() / lookups;
+            double userNs = chrono::duration<double, nano>(end - mid).count() / lookups;
+            cout << setw(12) << copies << setw(12) << userCount << setw(16) << fixed << setprecision(1) << bookNs
+                 << setw(16) << userNs << "   (checksum " << checksum << ")" << endl;
+        }
+        filesystem::remove_all(dir);
+    }
+}
+
+
+// Benchmark: authenticateUser throughput for a large user base.
+void benchLogin(int accounts)
+{
+    const int logins = 1000000;
+    string dir = makeBenchDir("login");
+    writeSyntheticBooks(dir, 1000);
+    writeSyntheticUsers(dir, accounts);
+    {
+        LibraryOptions options;
+        options.dataDir = dir;
+        auto loadStart = chrono::steady_clock::now();
+        Library lib(options);
+        double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - loadStart).count();
+        cout << "Loaded " << lib.userCount() << " users in " << fixed << setprecision(1) << loadMs << " ms ("
+             << lib.userPoolBlocks() << " pool blocks)" << endl;
+        mt19937 rng(7);
+        uniform_int_distribution<int> userDist(1, accounts);
+        vector<pair<string, string>> credentials;
+        credentials.reserve(logins);
+        for (int i = 0; i < logins; i++)
+        {
+            int id = userDist(rng);
+            // Every fourth attempt uses a wrong password.
+            credentials.emplace_back("user" + to_string(id), (i % 4 == 3) ? "wrong" : "pw" + to_string(id));
+        }
+        
+        int succeeded = 0;
+        auto start = chrono::steady_clock::now();
+        for (const auto & c : credentials)
+        {
+            if (lib.authenticateUser(c.first, c.second) != nullptr)
+            {
+                succeeded++;
+            }
+        }
+        auto end = chrono::steady_clock::now();
+        
+        double seconds = chrono::duration<double>(end - start).count();
+        cout << "Accounts: " << accounts << ", login attempts: " << logins << " (" << succeeded << " succeeded)" << endl;
+        cout << "Throughput: " << fixed << setprecision(0) << logins / seconds << " logins/s, "
+             << setprecision(1) << seconds * 1e9 / logins << " ns/login" << endl;
+    }
+    filesystem::remove_all(dir);
+}
+
+
+// Benchmark: cost of persisting one circulation change (one book + one user record)
+// with full snapshot rewrites versus the write-ahead journal (with and without
+// an fsync per group commit), writing on the caller's thread ("inline")
+// versus the BackgroundWriter ("thread"). "commits" counts the groups the
+// writer needed, including the final drain.
+void benchPersist(int maxCopies)
+{
+    struct PersistCase
+    {
+        const char * name;
+        PersistenceMode mode;
+        bool journalSync;
+    };
+    PersistCase cases[] = {
+        { "snapshot", PersistenceMode::Snapshot, false },
+        { "journal", PersistenceMode::Journaled, false },
+        { "journal+fsync", PersistenceMode::Journaled, true }
+    };
+    cout << setw(12) << "copies" << setw(15) << "mode" << setw(9) << "writer" << setw(8) << "ops" << setw(16) << "median us/op"
+         << setw(16) << "mean us/op" << setw(10) << "commits" << endl;
+    for (int copies = 1000; copies <= maxCopies; copies *= 10)
+    {
+        for (const auto & c : cases)
+        {
+            for (bool background : { false, true })
+            {
+                string dir = makeBenchDir("persist");
+                writeSyntheticBooks(dir, copies);
+                writeSyntheticUsers(dir, 1000);
+                {
+                    LibraryOptions options;
+                    options.dataDir = dir;
+                    options.persistence = c.mode;
+                    options.journalSync = c.journalSync;
+                    options.backgroundWrites = background;
+                    Library lib(options);
+                    lib.waitForWrites();
+                    uint64_t commitsBefore = lib.groupCommits();
+                    int ops = (c.mode == PersistenceMode::Snapshot) ? max(10, 200000 / copies) : (c.journalSync ? 500 : 5000);
+                    mt19937 rng(3);
+                    uniform_int_distribution<int> bookDist(1, copies);
+                    vector<double> samples;
+                    samples.reserve(ops);
+                    for (int i = 0; i < ops; i++)
+                    {
+                        auto start = chrono::steady_clock::now();
+                        {
+                            Library::Access access(lib, AccessMode::Shared);
+                            lib.persistBook(bookDist(rng));
+                            lib.persistUser(1 + i % 1000);
+                        }
+                        auto end = chrono::steady_clock::now();
+                        samples.push_back(chrono::duration<double, micro>(end - start).count());
+                    }
+                    lib.waitForWrites();
+                    double total = 0;
+                    for (double x : samples)
+                    {
+                        total += x;
+                    }
+                    nth_element(samples.begin(), samples.begin() + ops / 2, samples.end());
+                    cout << setw(12) << copies << setw(15) << c.name << setw(9) << (background ? "thread" : "inline")
+                         << setw(8) << ops << setw(16) << fixed << setprecision(1) << samples[ops / 2]
+                         << setw(16) << total / ops << setw(10) << lib.groupCommits() - commitsBefore << endl;
+                }
+                filesystem::remove_all(dir);
+            }
+        }
+    }
+}
+
+
+// Benchmark: logTransaction cost on top of an existing history, per flush
+// policy. The time includes waiting for the writer to finish the entries.
+void benchTransactionLog(int historyLines)
+{
+    const int events = 100000;
+    struct PolicyCase
+    {
+        const char * name;
+        FlushPolicy policy;
+        bool sync;
+        int events;
+    };
+    PolicyCase cases[] = {
+        { "every", FlushPolicy::EveryRecord, false, events },
+        { "batch:64", FlushPolicy::Batched, false, events },
+        { "exit", FlushPolicy::OnClose, false, events },
+        { "every+fsync", FlushPolicy::EveryRecord, true, 200 }
+    };
+    cout << "History: " << historyLines << " existing log lines" << endl;
+    cout << setw(14) << "policy" << setw(10) << "events" << setw(14) << "ns/event" << endl;
+    for (const auto & c : cases)
+    {
+        string dir = makeBenchDir("txlog");
+        writeSyntheticBooks(dir, 1000);
+        writeSyntheticUsers(dir, 100);
+        {
+            ofstream fout(dir + "/transactions.txt");
+            for (int i = 0; i < historyLines; i++)
+            {
+                fout << "[Thu Jan  1 00:00:00 2026] Student user" << i % 100 << " borrowed book \"Synthetic Title " << i % 200 << "\" for 7 days.\n";
+            }
+        }
+        {
+            LibraryOptions options;
+            options.dataDir = dir;
+            options.logFlush = c.policy;
+            options.logSync = c.sync;
+            Library lib(options);
+            auto start = chrono::steady_clock::now();
+            for (int i = 0; i < c.events; i++)
+            {
+                lib.logTransaction("Student user" + to_string(i % 100) + " returned book \"Synthetic Title 1\"; kept for 3 days (allowed: 15).");
+            }
+            lib.waitForWrites();
+            auto end = chrono::steady_clock::now();
+            cout << setw(14) << c.name << setw(10) << c.events << setw(14) << fixed << setprecision(0)
+                 << chrono::duration<double, nano>(end - start).count() / c.events << endl;
+        }
+        filesystem::remove_all(dir);
+    }
+}
+
+
+// Benchmark: catalog startup time, text parsing versus the binary snapshot.
+void benchStartup(int copies)
+{
+    string dir = makeBenchDir("startup");
+    writeSyntheticBooks(dir, copies);
+    writeSyntheticUsers(dir, 1000);
+    Catalog books;
+    ThreadPool pool;
+    readTextCatalog(dir + "/books.txt", books, pool);
+    {
+        ofstream fout(dir + "/books.bin", ios::binary);
+        writeBinaryCatalog(fout, books);
+        ofstream textOut(dir + "/books_v2.txt");
+        writeTextCatalog(textOut, books);
+    }
+    cout << "Copies: " << copies << ", books.txt " << filesystem::file_size(dir + "/books.txt") / 1024
+         << " KiB (one line per copy), version 2 " << filesystem::file_size(dir + "/books_v2.txt") / 1024
+         << " KiB, books.bin " << filesystem::file_size(dir + "/books.bin") / 1024 << " KiB" << endl;
+    
+    auto timeMs = [](auto fn)
+    {
+        auto start = chrono::steady_clock::now();
+        fn();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    };
+    cout << fixed << setprecision(1);
+    
+    double textMs = timeMs([&]() { readTextCatalog(dir + "/books.txt", books, pool); });
+    cout << setw(40) << left << "Parse one-line-per-copy books.txt:" << right << setw(10) << textMs << " ms" << endl;
+    
+    double textV2Ms = timeMs([&]() { readTextCatalog(dir + "/books_v2.txt", books, pool); });
+    cout << setw(40) << left << "Parse version 2 books.txt:" << right << setw(10) << textV2Ms << " ms" << endl;
+    
+    string error;
+    long long checksum = 0;
+    double mapMs = timeMs([&]()
+        {
+            MappedCatalog catalog;
+            catalog.open(dir + "/books.bin", error);
+            for (size_t i = 0; i < catalog.size(); i++)
+            {
+                uint32_t t = catalog.titleOf(i);
+                checksum += catalog.year(t) + catalog.title(t).size();
+            }
+        }
+    );
+    cout << setw(40) << left << "mmap books.bin and scan in place:" << right << setw(10) << mapMs << " ms   (checksum " << checksum << ")" << endl;
+    
+    double binMs = timeMs([&]() { readBinaryCatalog(dir + "/books.bin", books, error); });
+    cout << setw(40) << left << "mmap books.bin into a Catalog:" << right << setw(10) << binMs << " ms" << endl;
+    
+    for (CatalogFormat format : { CatalogFormat::Text, CatalogFormat::Binary })
+    {
+        LibraryOptions options;
+        options.dataDir = dir;
+        options.catalogFormat = format;
+        unique_ptr<Library> lib;
+        double ctorMs = timeMs([&]() { lib.reset(new Library(options)); });
+        string label = string("Library() startup, ") + (format == CatalogFormat::Text ? "text" : "binary") + " catalog:";
+        cout << setw(40) << left << label << right << setw(10) << ctorMs << " ms" << endl;
     }
-    account.removeBorrowedBook(book->getId());
-    cout << "Book returned successfully." << endl;
-    lib.logTransaction("Student " + getUsername() + " returned book \"" + book->getTitle() + "\"; kept for " + to_string(elapsedDays) + " days (allowed: " + to_string(allowedDays) + ").");
-    lib.saveBooks();
+    filesystem::remove_all(dir);
 }
 
 
-// ========== Implementation of Faculty Member Functions ==========
-
-void Faculty::borrowBook(Library & lib)
+// Reference parser matching the old istringstream/getline/stoi implementation,
+// used only to give benchParse a baseline.
+long long legacyParseLine(const string & line)
 {
-    time_t now = time(0);
-    for (const auto & record : getAccount().getBorrowRecords())
+    istringstream iss(line);
+    string token;
+    long long checksum = 0;
+    while (getline(iss, token, ';'))
     {
-        double diff = difftime(now, record.borrowTimestamp);
-        if (diff > (record.borrowDays + 60) * 86400)
+        if (!token.empty() && isdigit(static_cast<unsigned char>(token[0])))
         {
-            cout << "You have a book overdue by more than 60 days. You cannot borrow new books until you return it." << endl;
-            return;
+            istringstream recordStream(token);
+            string part;
+            while (getline(recordStream, part, ','))
+            {
+                checksum += stoll(part);
+            }
+        }
+        else
+        {
+            checksum += token.size();
         }
     }
-    if (account.getBorrowRecords().size() >= (size_t)maxBooks)
-    {
-        cout << "Borrowing limit reached (" << maxBooks << " books maximum)." << endl;
-        return;
-    }
-    cout << "Enter the Book ID to borrow: ";
-    int bookId;
-    cin >> bookId;
-    Book* book = lib.findBookById(bookId);
-    if (!book)
-    {
-        cout << "Book not found." << endl;
-        return;
-    }
-    if (book->getBorrowedBy() != 0)
-    {
-        cout << "Book is not available." << endl;
-        return;
-    }
-    cout << "Enter number of days to borrow (maximum " << maxDays << "): ";
-    int days;
-    cin >> days;
-    if (days > maxDays)
-    {
-        cout << "Borrowing period exceeds the maximum allowed for faculty." << endl;
-        return;
-    }
-    book->updateStatus(BookStatus::Borrowed);
-    book->updateBorrowedBy(this->getUserId());
-    account.addBorrowedBook(book->getId(), days);
-    cout << "Book \"" << book->getTitle() << "\" successfully borrowed for " << days << " days." << endl;
-    lib.logTransaction("Faculty " + getUsername() + " borrowed book \"" + book->getTitle() + "\" for " + to_string(days) + " days.");
-    lib.saveBooks();
+    return checksum;
 }
 
-void Faculty::reserveBook(Library & lib)
+
+// Benchmark: text record parse throughput (MB/s) for books and users.
+// Returns false if any record failed to parse.
+bool benchParse(int copies)
 {
-    cout << "Enter the Book ID to reserve: ";
-    int bookId;
-    cin >> bookId;
-    Book* book = lib.findBookById(bookId);
-    if (!book)
-    {
-        cout << "Book not found." << endl;
-        return;
-    }
-    if (book->getStatus() != BookStatus::Borrowed)
-    {
-        cout << "You can only reserve a book that is currently borrowed." << endl;
-        return;
-    }
-    if (book->getReservedBy() != 0)
-    {
-        cout << "Book is already reserved by another user." << endl;
-        return;
+    string dir = makeBenchDir("parse");
+    writeSyntheticBooks(dir, copies);
+    writeSyntheticUsers(dir, copies / 5);
+    {
+        // Give every fifth user two open loans so account records are exercised too.
+        LibraryOptions options;
+        options.dataDir = dir;
+        Library lib(options);
+        for (int id = 1; id <= copies / 5; id += 5)
+        {
+            lib.findUserById(id)->getAccount().addBorrowedBook(id, 7);
+            lib.findUserById(id)->getAccount().addBorrowedBook(id + 1, 14);
+        }
     }
-    if (book->getBorrowedBy() == this->getUserId())
+    // The Library saved books.txt in the title/copy format; the one-line-per-copy file is what is timed.
+    writeSyntheticBooks(dir, copies);
+    
+    bool parsed = true;
+    for (const char * file : { "books.txt", "users.txt" })
     {
-        cout << "You have already borrowed this book; reservation not allowed." << endl;
-        return;
+        vector<string> lines;
+        size_t bytes = 0;
+        {
+            ifstream fin(dir + "/" + file);
+            string line;
+            while (getline(fin, line))
+            {
+                bytes += line.size() + 1;
+                lines.push_back(line);
+            }
+        }
+        bool isBooks = string(file) == "books.txt";
+        string error;
+        size_t failures = 0;
+        auto start = chrono::steady_clock::now();
+        if (isBooks)
+        {
+            Book book;
+            for (const auto & line : lines)
+            {
+                failures += !book.deserialize(line, error);
+            }
+        }
+        else
+        {
+            Student student;
+            for (const auto & line : lines)
+            {
+                failures += !student.deserialize(string_view(line).substr(line.find(';') + 1), error);
+            }
+        }
+        auto mid = chrono::steady_clock::now();
+        long long checksum = 0;
+        for (const auto & line : lines)
+        {
+            checksum += legacyParseLine(line);
+        }
+        auto end = chrono::steady_clock::now();
+        
+        double mb = bytes / 1e6;
+        double newSec = chrono::duration<double>(mid - start).count();
+        double oldSec = chrono::duration<double>(end - mid).count();
+        cout << file << ": " << lines.size() << " records, " << fixed << setprecision(1) << mb << " MB"
+             << (failures ? " (" + to_string(failures) + " failed)" : string()) << endl;
+        cout << "  FieldReader:  " << setw(8) << mb / newSec << " MB/s" << endl;
+        cout << "  istringstream:" << setw(8) << mb / oldSec << " MB/s   (checksum " << checksum << ")" << endl;
+        if (failures)
+        {
+            cout << "  Last error: " << error << endl;
+            parsed = false;
+        }
     }
-    book->updateReservedBy(this->getUserId());
-    book->updateStatus(BookStatus::Reserved);
-    cout << "Book \"" << book->getTitle() << "\" reserved successfully. It will be automatically borrowed for you upon return." << endl;
-    lib.logTransaction("Faculty " + getUsername() + " reserved book \"" + book->getTitle() + "\".");
-    lib.saveBooks();
+    filesystem::remove_all(dir);
+    return parsed;
 }
 
-void Faculty::returnBook(Library & lib)
+
+// Benchmark: cold-start time of Library() by worker thread count.
+void benchLoad(int copies)
 {
-    lib.printBorrowedBooksByUser(this);
-    cout << "Enter the Book ID to return: ";
-    int bookId;
-    cin >> bookId;
-    Book* book = lib.findBookById(bookId);
-    if (!book)
-    {
-        cout << "Book not found." << endl;
-        return;
-    }
-    vector<BorrowRecord> records = account.getBorrowRecords();
-    bool found = false;
-    int intendedDays = -1;
-    time_t borrowTime;
-    for (const auto & record : records)
-    {
-        if (record.bookId == book->getId())
+    string dir = makeBenchDir("load");
+    writeSyntheticBooks(dir, copies);
+    writeSyntheticUsers(dir, copies / 5);
+    // The first load rewrites the legacy files in the current format, so
+    // every thread count below then parses the same files.
+    {
+        LibraryOptions options;
+        options.dataDir = dir;
+        Library warmUp(options);
+    }
+    size_t cores = max(1u, thread::hardware_concurrency());
+    cout << "Copies: " << copies << ", users: " << copies / 5 << ", hardware threads: " << cores << endl;
+    cout << setw(10) << "threads" << setw(14) << "startup ms" << setw(10) << "speedup" << endl;
+    double baseline = 0;
+    for (size_t threads = 1; threads <= max<size_t>(cores, 4); threads *= 2)
+    {
+        LibraryOptions options;
+        options.dataDir = dir;
+        options.threads = threads;
+        auto start = chrono::steady_clock::now();
+        unique_ptr<Library> lib(new Library(options));
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (threads == 1)
         {
-            intendedDays = record.borrowDays;
-            borrowTime = record.borrowTimestamp;
-            found = true;
-            break;
+            baseline = ms;
         }
+        cout << setw(10) << threads << setw(14) << fixed << setprecision(1) << ms << setw(9) << setprecision(2) << baseline / ms << "x" << endl;
     }
-    if (!found)
-    {
-        cout << "You did not borrow this book." << endl;
-        return;
+    filesystem::remove_all(dir);
+}
+
+
+// Scan benchmark: the same three scans (books borrowed by one user, highest
+// book ID, available copies) over a vector<Book> and over a Catalog.
+void benchScan(int copies)
+{
+    vector<Book> rows;
+    rows.reserve(copies);
+    mt19937 rng(42);
+    uniform_int_distribution<int> userDist(1, max(1, copies / 5));
+    for (int id = 1; id <= copies; id++)
+    {
+        Book book(id, "Synthetic Title " + to_string(id / 5), "Author " + to_string(id % 997), "Publisher " + to_string(id % 101), 1950 + id % 70, "978" + to_string(1000000 + id / 5));
+        if (id % 3 == 0)
+        {
+            book.updateStatus(BookStatus::Borrowed);
+            book.updateBorrowedBy(userDist(rng));
+        }
+        rows.push_back(book);
     }
-    time_t now = time(0);
-    int elapsedDays = static_cast<int>(difftime(now, borrowTime) / 86400);
-    cout << "Book was kept for " << elapsedDays << " days." << endl;
-    if (elapsedDays > intendedDays)
+    Catalog catalog;
+    catalog.assign(vector<Book>(rows));
+    
+    const int passes = 20;
+    int target = userDist(rng);
+    long long checksum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
     {
-        int overdue = elapsedDays - intendedDays;
-        cout << "Book is overdue by " << overdue << " days. (No fine imposed for faculty)" << endl;
-        if (overdue > 60)
+        int maxId = 0;
+        for (const auto & book : rows)
         {
-            cout << "Warning: You have an overdue book for more than 60 days." << endl;
+            checksum += book.getBorrowedBy() == target;
+            maxId = max(maxId, book.getId());
+            checksum += book.getStatus() == BookStatus::Available;
         }
+        checksum += maxId;
     }
-    if (book->getReservedBy() != 0)
+    auto mid = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
     {
-        User* reservingUser = lib.findUserById(book->getReservedBy());
-        if (reservingUser != nullptr)
+        int maxId = 0;
+        for (int borrowedBy : catalog.borrowerColumn())
         {
-            int defaultDays = 30;
-            book->updateStatus(BookStatus::Borrowed);
-            book->updateBorrowedBy(reservingUser->getUserId());
-            book->updateReservedBy(0);
-            reservingUser->getAccount().addBorrowedBook(book->getId(), defaultDays);
-            lib.logTransaction("Book \"" + book->getTitle() + "\" automatically borrowed by reserving user " + reservingUser->getUsername() + " for " + to_string(defaultDays) + " days upon return.");
-            cout << "Book reserved for you has been automatically borrowed upon return." << endl;
+            checksum -= borrowedBy == target;
         }
-        else
+        for (int id : catalog.idColumn())
         {
-            book->updateStatus(BookStatus::Available);
-            book->updateBorrowedBy(0);
+            maxId = max(maxId, id);
         }
-    }
-    else
-    {
-        book->updateStatus(BookStatus::Available);
-        book->updateBorrowedBy(0);
-    }
-    account.removeBorrowedBook(book->getId());
-    cout << "Book returned successfully." << endl;
-    lib.logTransaction("Faculty " + getUsername() + " returned book \"" + book->getTitle() + "\"; kept for " + to_string(elapsedDays) + " days (intended: " + to_string(intendedDays) + ").");
-    lib.saveBooks();
+        for (BookStatus status : catalog.statusColumn())
+        {
+            checksum -= status == BookStatus::Available;
+        }
+        checksum -= maxId;
+    }
+    auto end = chrono::steady_clock::now();
+    
+    double rowMs = chrono::duration<double, milli>(mid - start).count() / passes;
+    double columnMs = chrono::duration<double, milli>(end - mid).count() / passes;
+    double rowBytes = double(copies) * sizeof(Book);
+    double columnBytes = double(copies) * (2 * sizeof(int) + sizeof(BookStatus));
+    cout << "Copies: " << copies << ", passes: " << passes << (checksum == 0 ? "" : " (checksum mismatch)") << endl;
+    cout << setw(16) << "layout" << setw(14) << "ms/pass" << setw(16) << "Mcopies/s" << setw(18) << "bytes touched" << endl;
+    cout << setw(16) << "vector<Book>" << setw(14) << fixed << setprecision(2) << rowMs << setw(16) << copies / rowMs / 1000 << setw(18) << setprecision(0) << rowBytes << endl;
+    cout << setw(16) << "Catalog" << setw(14) << setprecision(2) << columnMs << setw(16) << copies / columnMs / 1000 << setw(18) << setprecision(0) << columnBytes << endl;
+    cout << "Speedup: " << setprecision(2) << rowMs / columnMs << "x" << endl;
 }
 
 
-// ========== Implementation of Librarian Administrative Functions ==========
-
-void Librarian::addBook(Library & lib)
+// Footprint report: memory and file size of the one-record-per-copy layout
+// (vector<Book>, one line per copy) against the normalized Catalog.
+void benchFootprint(int copies)
 {
-    int newId = lib.generateBookId();
-    cin.ignore();
-    cout << "Enter title: ";
-    string title;
-    getline(cin, title);
-    cout << "Enter author: ";
-    string author;
-    getline(cin, author);
-    cout << "Enter publisher: ";
-    string publisher;
-    getline(cin, publisher);
-    cout << "Enter publication year: ";
-    int year;
-    cin >> year;
-    cin.ignore();
-    cout << "Enter ISBN: ";
-    string isbn;
-    getline(cin, isbn);
-    Book newBook(newId, title, author, publisher, year, isbn, BookStatus::Available);
-    lib.addBookToLibrary(newBook);
-    cout << "Book added successfully." << endl;
+    vector<Book> rows;
+    rows.reserve(copies);
+    for (int id = 1; id <= copies; id++)
+    {
+        rows.push_back(syntheticBook(id));
+    }
+    unordered_map<int, size_t> rowIndex;
+    rowIndex.reserve(rows.size());
+    size_t rowBytes = rows.capacity() * sizeof(Book);
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        const Book & book = rows[i];
+        rowIndex.emplace(book.getId(), i);
+        rowBytes += stringHeapBytes(book.getTitle()) + stringHeapBytes(book.getAuthor())
+                  + stringHeapBytes(book.getPublisher()) + stringHeapBytes(book.getISBN());
+    }
+    rowBytes += hashTableBytes(rowIndex);
+    
+    Catalog catalog;
+    catalog.assign(vector<Book>(rows));
+    size_t catalogBytes = catalog.footprintBytes();
+    
+    string dir = makeBenchDir("footprint");
+    writeSyntheticBooks(dir, copies);
+    {
+        ofstream textOut(dir + "/books_v2.txt");
+        writeTextCatalog(textOut, catalog);
+        ofstream binOut(dir + "/books.bin", ios::binary);
+        writeBinaryCatalog(binOut, catalog);
+    }
+    
+    cout << "Copies: " << copies << ", titles: " << catalog.titleCount() << endl;
+    cout << fixed << setprecision(1);
+    auto row = [copies](const string & label, double bytes)
+    {
+        cout << setw(36) << left << label << right << setw(12) << bytes / (1024 * 1024) << " MiB"
+             << setw(12) << bytes / copies << " B/copy" << endl;
+    };
+    cout << "In memory (records, strings and ID index):" << endl;
+    row("  vector<Book>", rowBytes);
+    row("  Catalog (titles + copy columns)", catalogBytes);
+    cout << "On disk:" << endl;
+    row("  books.txt, one line per copy", filesystem::file_size(dir + "/books.txt"));
+    row("  books.txt, version 2", filesystem::file_size(dir + "/books_v2.txt"));
+    row("  books.bin", filesystem::file_size(dir + "/books.bin"));
+    filesystem::remove_all(dir);
 }
 
-void Librarian::removeBook(Library & lib)
-{
-    cout << "Enter Book ID to remove: ";
-    int id;
-    cin >> id;
-    lib.removeBookFromLibrary(id);
-}
 
-void Librarian::updateBook(Library & lib)
+// Benchmark: the librarian's "View All Users" report as the catalog grows.
+// A quarter of the copies are on loan and half of those are reserved, so
+// every user holds a few items; output goes to a null stream.
+void benchAccounts(int maxCopies)
 {
-    cout << "Enter Book ID to update: ";
-    int id;
-    cin >> id;
-    Book* book = lib.findBookById(id);
-    if (!book)
-    {
-        cout << "Book not found." << endl;
-        return;
-    }
-    cin.ignore();
-    cout << "Updating book details. Press ENTER to skip a field." << endl;
-    cout << "Current Title: " << book->getTitle() << ". New Title: ";
-    string input;
-    getline(cin, input);
-    if (!input.empty())
-    {
-        book->updateTitle(input);
-    }
-    cout << "Current Publisher: " << book->getPublisher() << ". New Publisher: ";
-    getline(cin, input);
-    if (!input.empty())
-    {
-        book->updatePublisher(input);
-    }
-    cout << "Current Year: " << book->getYear() << ". New Year: ";
-    getline(cin, input);
-    if (!input.empty())
+    cout << setw(12) << "copies" << setw(12) << "users" << setw(16) << "report ms" << setw(16) << "us/user" << endl;
+    for (int copies = 1000; copies <= maxCopies; copies *= 10)
     {
-        book->updateYear(stoi(input));
+        int userCount = max(100, copies / 10);
+        string dir = makeBenchDir("accounts");
+        writeSyntheticBooks(dir, copies);
+        writeSyntheticUsers(dir, userCount);
+        {
+            LibraryOptions options;
+            options.dataDir = dir;
+            Library lib(options);
+            for (int id = 4; id <= copies; id += 4)
+            {
+                User * borrower = lib.findUserById(id / 4 % userCount + 1);
+                lib.lendBook(lib.findBookById(id), borrower, 14);
+                if (id % 8 == 0)
+                {
+                    lib.reserveBookFor(lib.findBookById(id), lib.findUserById(id / 8 % userCount + 1));
+                }
+            }
+            
+            NullBuffer null;
+            ostream discard(&null);
+            auto start = chrono::steady_clock::now();
+            lib.printAllUsers(discard);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            cout << setw(12) << copies << setw(12) << userCount << setw(16) << fixed << setprecision(1) << ms
+                 << setw(16) << setprecision(2) << ms * 1000 / userCount << endl;
+        }
+        filesystem::remove_all(dir);
     }
-    cout << "Current ISBN: " << book->getISBN() << ". New ISBN: ";
-    getline(cin, input);
-    if (!input.empty())
-    {
-        book->updateISBN(input);
+}
+
+
+// Benchmark: server throughput as concurrent clients scale. Starts a server
+// on a synthetic catalog in this process and runs the load generator on it.
+void benchServer(int maxClients)
+{
+    string dir = makeBenchDir("server");
+    writeSyntheticBooks(dir, 100000);
+    writeSyntheticUsers(dir, 10000);
+    {
+        LibraryOptions options;
+        options.dataDir = dir;
+        Library lib(options);
+        string socketPath = dir + "/lms.sock";
+        serverStopRequested = false;
+        thread server([&lib, &socketPath]() { runServer(lib, socketPath); });
+        for (int i = 0; i < 250 && !filesystem::exists(socketPath); i++)
+        {
+            this_thread::sleep_for(chrono::milliseconds(20));
+        }
+        runLoadTest(socketPath, maxClients, 2.0);
+        serverStopRequested = true;
+        server.join();
     }
-    cout << "Book updated successfully." << endl;
-    lib.logTransaction("Librarian updated book (ID): " + to_string(id));
-    lib.saveBooks();
+    filesystem::remove_all(dir);
 }
 
-void Librarian::addUser(Library & lib)
+
+// Benchmark: borrow/return latency while a librarian lists every book.
+// One thread prints "View All Books" to a null stream over and over while
+// two desk threads borrow and return copies. In "locked" mode the listing
+// also holds every book lock, as listings did before they read snapshots.
+void benchSnapshot(int copies)
 {
-    int newId = lib.generateUserId();
-    cout << "Enter user type (1 for Student, 2 for Faculty): ";
-    int type;
-    cin >> type;
-    cin.ignore();
-    cout << "Enter username: ";
-    string uname;
-    cin >> uname;
-    cout << "Enter password: ";
-    string pwd;
-    cin >> pwd;
-    User * newUser = nullptr;
-    if (type == 1)
+    const double seconds = 2.0;
+    const int deskThreads = 2;
+    string dir = makeBenchDir("snapshot");
+    writeSyntheticBooks(dir, copies);
+    writeSyntheticUsers(dir, 1000);
+    cout << "Copies: " << copies << ", desk threads: " << deskThreads << ", " << seconds << " s per mode" << endl;
+    cout << setw(10) << "mode" << setw(10) << "listings" << setw(14) << "ms/listing" << setw(12) << "desk ops"
+         << setw(12) << "ops/s" << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "max us" << endl;
+    for (bool locked : { true, false })
     {
-        newUser = new Student(newId, uname, pwd);
+        {
+            LibraryOptions options;
+            options.dataDir = dir;
+            options.persistence = PersistenceMode::Journaled;
+            options.checkpointInterval = SIZE_MAX;   // Keep checkpoints out of the measurement.
+            Library lib(options);
+            atomic<bool> stop(false);
+            int listings = 0;
+            double listingMs = 0;
+            thread lister([&]()
+                {
+                    NullBuffer null;
+                    ostream discard(&null);
+                    while (!stop)
+                    {
+                        auto start = chrono::steady_clock::now();
+                        {
+                            Library::Access access(lib, AccessMode::Shared);
+                            if (locked)
+                            {
+                                Library::ItemLocks locks(lib, LockScope::AllBooks);
+                                lib.printAllTitles(0, discard);
+                            }
+                            else
+                            {
+                                lib.printAllTitles(0, discard);
+                            }
+                        }
+                        listingMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                        listings++;
+                    }
+                }
+            );
+            vector<vector<double>> latencies(deskThreads);
+            vector<thread> desks;
+            for (int w = 0; w < deskThreads; w++)
+            {
+                desks.emplace_back([&, w]()
+                    {
+                        NullBuffer null;
+                        ostream discard(&null);
+                        User * student = lib.findUserById(w + 1);
+                        mt19937 rng(w);
+                        uniform_int_distribution<int> bookDist(0, copies / deskThreads - 1);
+                        auto end = chrono::steady_clock::now() + chrono::duration<double>(seconds);
+                        while (chrono::steady_clock::now() < end)
+                        {
+                            int bookId = bookDist(rng) * deskThreads + w + 1;
+                            for (bool borrowing : { true, false })
+                            {
+                                auto start = chrono::steady_clock::now();
+                                {
+                                    Library::Access access(lib, AccessMode::Shared);
+                                    if (borrowing)
+                                    {
+                                        student->borrowBook(lib, bookId, 14, discard);
+                                    }
+                                    else
+                                    {
+                                        student->returnBook(lib, bookId, discard);
+                                    }
+                                }
+                                latencies[w].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+                            }
+                        }
+                    }
+                );
+            }
+            for (auto & desk : desks)
+            {
+                desk.join();
+            }
+            stop = true;
+            lister.join();
+            vector<double> all;
+            for (const auto & samples : latencies)
+            {
+                all.insert(all.end(), samples.begin(), samples.end());
+            }
+            sort(all.begin(), all.end());
+            double p50 = all.empty() ? 0 : all[all.size() / 2];
+            double p99 = all.empty() ? 0 : all[min(all.size() - 1, all.size() * 99 / 100)];
+            cout << setw(10) << (locked ? "locked" : "snapshot") << setw(10) << listings << setw(14) << fixed << setprecision(1)
+                 << (listings ? listingMs / listings : 0) << setw(12) << all.size() << setw(12) << setprecision(0) << all.size() / seconds
+                 << setw(12) << setprecision(1) << p50 << setw(12) << p99 << setw(12) << (all.empty() ? 0 : all.back()) << endl;
+        }
+        filesystem::remove(dir + "/journal.wal");
     }
-    else if (type == 2)
-    {
-        newUser = new Faculty(newId, uname, pwd);
+    filesystem::remove_all(dir);
+}
+
+
+// Benchmark: ranked title search against a linear substring scan of the
+// copies. Each query runs through printSearchResults() into a null stream.
+void benchSearch(int copies)
+{
+    const int rounds = 200;
+    const vector<pair<string, string>> queries = {
+        { "title word", "title 12345" },
+        { "author", "author 421" },
+        { "prefix", "1234" },
+        { "ISBN", "9780000012345" },
+        { "every title", "synth" },
+        { "no match", "zebra" },
+    };
+    string dir = makeBenchDir("search");
+    writeSyntheticBooks(dir, copies);
+    writeSyntheticUsers(dir, 100);
+    vector<Book> rows;
+    rows.reserve(copies);
+    for (int id = 1; id <= copies; id++)
+    {
+        rows.push_back(syntheticBook(id));
+    }
+    {
+        LibraryOptions options;
+        options.dataDir = dir;
+        auto start = chrono::steady_clock::now();
+        Library lib(options);
+        auto loaded = chrono::steady_clock::now();
+        NullBuffer null;
+        ostream discard(&null);
+        lib.printSearchResults("title", 0, Library::searchLimit, discard);
+        auto indexed = chrono::steady_clock::now();
+        cout << "Copies: " << copies << ", loaded in " << fixed << setprecision(1)
+             << chrono::duration<double, milli>(loaded - start).count() << " ms, index ready "
+             << chrono::duration<double, milli>(indexed - loaded).count() << " ms later" << endl;
+        cout << setw(14) << "query" << setw(16) << "text" << setw(10) << "matches" << setw(14) << "index us"
+             << setw(14) << "scan us" << endl;
+        for (const auto & query : queries)
+        {
+            size_t matched = 0;
+            auto indexStart = chrono::steady_clock::now();
+            for (int r = 0; r < rounds; r++)
+            {
+                matched = lib.printSearchResults(query.second, 0, Library::searchLimit, discard);
+            }
+            double indexUs = chrono::duration<double, micro>(chrono::steady_clock::now() - indexStart).count() / rounds;
+            
+            // The baseline checks every copy's fields for the lower-cased query text.
+            string needle = query.second;
+            transform(needle.begin(), needle.end(), needle.begin(), [](unsigned char c) { return tolower(c); });
+            size_t scanned = 0;
+            const int scanRounds = 3;
+            auto scanStart = chrono::steady_clock::now();
+            for (int r = 0; r < scanRounds; r++)
+            {
+                scanned = 0;
+                for (const Book & book : rows)
+                {
+                    for (string text : { book.getTitle(), book.getAuthor(), book.getPublisher(), book.getISBN() })
+                    {
+                        transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return tolower(c); });
+                        if (text.find(needle) != string::npos)
+                        {
+                            scanned++;
+                            break;
+                        }
+                    }
+                }
+            }
+            double scanUs = chrono::duration<double, micro>(chrono::steady_clock::now() - scanStart).count() / scanRounds;
+            cout << setw(14) << query.first << setw(16) << query.second << setw(10) << matched << setw(14) << setprecision(1)
+                 << indexUs << setw(14) << scanUs << "   (scan hits " << scanned << " copies)" << endl;
+        }
     }
-    else
-    {
-        cout << "Invalid user type." << endl;
-        return;
+    filesystem::remove_all(dir);
+}
+
+
+// Benchmark: typo-tolerant search throughput with each similarity kernel
+// this CPU supports. Queries are synthetic titles, or just their numbers,
+// with one random edit (a deleted, replaced or swapped character); "found"
+// counts the queries whose intended title is among the results. Whole
+// titles share most trigrams with every other title, so they stress the
+// counting and the heap; numbers leave few candidates, so the kernel's
+// scan of every title dominates.
+void benchFuzzy(int copies)
+{
+    const int queryCount = 300;
+    const size_t limit = Library::searchLimit;
+    vector<Book> rows;
+    rows.reserve(copies);
+    for (int id = 1; id <= copies; id++)
+    {
+        rows.push_back(syntheticBook(id));
+    }
+    Catalog catalog;
+    catalog.assign(move(rows));
+    auto start = chrono::steady_clock::now();
+    catalog.rebuildSearchIndex();
+    double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    
+    cout << "Copies: " << copies << ", titles: " << catalog.titleCount() << ", trigram index built in " << fixed
+         << setprecision(1) << buildMs << " ms, top " << limit << " per query" << endl;
+    cout << setw(10) << "queries" << setw(10) << "kernel" << setw(12) << "queries/s" << setw(14) << "us/query"
+         << setw(10) << "found" << endl;
+    int titleCount = (copies + 4) / 5;
+    for (bool wholeTitles : { true, false })
+    {
+        mt19937 rng(7);
+        uniform_int_distribution<int> titleDist(0, titleCount - 1);
+        vector<pair<string, string>> queries;     // Query, intended title.
+        for (int i = 0; i < queryCount; i++)
+        {
+            int titleNo = titleDist(rng);
+            string title = syntheticBook(titleNo * 5 + 1).getTitle();
+            string query = wholeTitles ? title : to_string(titleNo);
+            if (query.size() < 2)
+            {
+                queries.emplace_back(query, title);
+                continue;
+            }
+            size_t pos = uniform_int_distribution<size_t>(0, query.size() - 2)(rng);
+            switch (i % 3)
+            {
+                case 0:
+                    query.erase(pos, 1);
+                    break;
+                case 1:
+                    query[pos] = wholeTitles ? static_cast<char>('a' + rng() % 26) : static_cast<char>('0' + rng() % 10);
+                    break;
+                default:
+                    swap(query[pos], query[pos + 1]);
+                    break;
+            }
+            queries.emplace_back(query, title);
+        }
+        for (const SimilarityKernel & kernel : similarityKernels())
+        {
+            int found = 0;
+            uint64_t checksum = 0;
+            start = chrono::steady_clock::now();
+            for (const auto & query : queries)
+            {
+                for (uint32_t t : catalog.fuzzySearch(query.first, limit, kernel))
+                {
+                    checksum = checksum * 31 + t;
+                    found += catalog.titleAt(t).title == query.second;
+                }
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << setw(10) << (wholeTitles ? "titles" : "numbers") << setw(10) << kernel.name << setw(12) << setprecision(0)
+                 << queryCount / seconds << setw(14) << setprecision(1) << seconds * 1e6 / queryCount << setw(10) << found
+                 << "   (checksum " << checksum << ")" << endl;
+        }
     }
-    lib.addUserToLibrary(newUser);
-    cout << "User added successfully." << endl;
 }
 
-void Librarian::removeUser(Library & lib)
+
+// Struct: SuiteResult
+// One operation measured at one catalog size by "--bench suite".
+struct SuiteResult
 {
-    cout << "Enter User ID to remove: ";
-    int id;
-    if (!(cin >> id))
+    int copies;
+    int users;
+    string operation;
+    size_t ops;
+    double meanMicros;
+    double p50Micros;
+    double p99Micros;
+    double opsPerSecond;
+};
+
+
+// Function: summarizeSamples()
+// Turns per-operation latencies (in microseconds) into a SuiteResult.
+SuiteResult summarizeSamples(int copies, int users, const string & operation, vector<double> samples)
+{
+    SuiteResult result{ copies, users, operation, samples.size(), 0, 0, 0, 0 };
+    if (samples.empty())
     {
-        cout << "Invalid input for User ID. Please enter an integer." << endl;
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        return;
+        return result;
     }
-    if (id == this->getUserId())
+    double total = 0;
+    for (double x : samples)
     {
-        cout << "You cannot remove your own account." << endl;
-        return;
+        total += x;
     }
-    lib.removeUserFromLibrary(id);
+    sort(samples.begin(), samples.end());
+    result.meanMicros = total / samples.size();
+    result.p50Micros = samples[samples.size() / 2];
+    result.p99Micros = samples[min(samples.size() - 1, samples.size() * 99 / 100)];
+    result.opsPerSecond = total > 0 ? samples.size() * 1e6 / total : 0;
+    return result;
 }
 
-void Librarian::updateUser(Library & lib)
+
+// Function: writeSuiteResults()
+// Writes the results as one JSON document or as CSV with a header row.
+void writeSuiteResults(const vector<SuiteResult> & results, const string & format, ostream & out)
 {
-    cout << "Enter User ID to update: ";
-    int id;
-    if (!(cin >> id))
+    out << fixed << setprecision(3);
+    if (format == "csv")
     {
-        cout << "Invalid input for User ID. Please enter an integer." << endl;
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        out << "copies,users,operation,ops,mean_us,p50_us,p99_us,ops_per_sec\n";
+        for (const auto & r : results)
+        {
+            out << r.copies << ',' << r.users << ',' << r.operation << ',' << r.ops << ',' << r.meanMicros << ','
+                << r.p50Micros << ',' << r.p99Micros << ',' << r.opsPerSecond << '\n';
+        }
+        out.flush();
         return;
     }
-    cin.ignore();
-    cout << "Enter new username (or press ENTER to leave unchanged): ";
-    string newUsername;
-    getline(cin, newUsername);
-    cout << "Enter new password (or press ENTER to leave unchanged): ";
-    string newPassword;
-    getline(cin, newPassword);
-    lib.updateUserInLibrary(id, newUsername, newPassword);
-    cout << "User updated successfully." << endl;
+#ifdef __VERSION__
+    const char * compiler = __VERSION__;
+#else
+    const char * compiler = "unknown";
+#endif
+    out << "{\n  \"benchmark\": \"suite\",\n  \"compiler\": \"" << compiler << "\",\n  \"persistence\": \"journal\",\n"
+        << "  \"timestamp\": " << time(0) << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const SuiteResult & r = results[i];
+        out << "    { \"copies\": " << r.copies << ", \"users\": " << r.users << ", \"operation\": \"" << r.operation
+            << "\", \"ops\": " << r.ops << ", \"mean_us\": " << r.meanMicros << ", \"p50_us\": " << r.p50Micros
+            << ", \"p99_us\": " << r.p99Micros << ", \"ops_per_sec\": " << r.opsPerSecond << " }"
+            << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+    out << "  ]\n}" << endl;
 }
 
 
-// ========== Portal Menus ==========
-
-void userPortalMenu(User * user, Library & lib)
+// Benchmark suite: load, save, lookup, authentication, borrow, reserve,
+// listing (every title, and one page of 20) and return against Library on
+// synthetic catalogs of 10k copies up to maxCopies (x10 per step), with one
+// user per ten copies (1k to 1M).
+// Results are machine-readable (JSON or CSV) so runs from different builds
+// can be compared; progress goes to stderr. Circulation runs with the
+// journal and no checkpoints, so each operation costs the same at every size.
+void benchSuite(int maxCopies, const string & format, ostream & out)
 {
-    int choice;
-    do
-    {
-        cout << "\n----- User Portal -----" << endl;
-        cout << "1. View Book List" << endl;
-        cout << "2. Borrow Book" << endl;
-        cout << "3. Reserve Book" << endl;
-        cout << "4. Return Book" << endl;
-        cout << "5. View Account Details" << endl;
-        cout << "6. Pay Fine" << endl;
-        cout << "7. Logout" << endl;
-        cout << "Enter your choice: ";
-        cin >> choice;
+    const int lookups = 1000000;
+    const int lookupBatch = 100;    // Lookups are timed in batches; one sample is the batch's mean.
+    const int logins = 100000;
+    vector<SuiteResult> results;
+    NullBuffer null;
+    ostream discard(&null);
+    for (int copies = 10000; copies <= maxCopies; copies *= 10)
+    {
+        int users = min(1000000, max(1000, copies / 10));
+        int repeats = copies <= 100000 ? 5 : 1;
+        cerr << "Measuring " << copies << " copies, " << users << " users..." << endl;
+        string dir = makeBenchDir("suite");
+        writeSyntheticBooks(dir, copies);
+        writeSyntheticUsers(dir, users);
+        ofstream(dir + "/transactions.txt");
+        LibraryOptions options;
+        options.dataDir = dir;
+        options.persistence = PersistenceMode::Journaled;
+        options.checkpointInterval = SIZE_MAX;
         
-        switch (choice)
+        // The first load rewrites the legacy files in the current format.
         {
-            case 1:
-            {
-                lib.printBooksForUser(user->getUserId());
-                break;
-            }
-            case 2:
+            Library warmUp(options);
+        }
+        vector<double> samples;
+        for (int i = 0; i < repeats; i++)
+        {
+            auto start = chrono::steady_clock::now();
+            Library lib(options);
+            samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        }
+        results.push_back(summarizeSamples(copies, users, "load", samples));
+        
+        {
+            Library lib(options);
+            mt19937 rng(16);
+            
+            samples.clear();
+            for (int i = 0; i < repeats; i++)
             {
-                user->borrowBook(lib);
-                break;
+                auto start = chrono::steady_clock::now();
+                {
+                    Library::Access access(lib, AccessMode::Exclusive);
+                    lib.checkpoint();
+                }
+                lib.waitForWrites();
+                samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
             }
-            case 3:
+            results.push_back(summarizeSamples(copies, users, "save", samples));
+            
+            uniform_int_distribution<int> bookDist(1, copies);
+            uniform_int_distribution<int> userDist(1, users);
+            samples.clear();
+            size_t found = 0;
             {
-                if (dynamic_cast<Student*>(user))
+                Library::Access access(lib, AccessMode::Shared);
+                for (int i = 0; i < lookups; i += lookupBatch)
                 {
-                    static_cast<Student*>(user)->reserveBook(lib);
+                    auto start = chrono::steady_clock::now();
+                    for (int j = 0; j < lookupBatch; j++)
+                    {
+                        found += lib.findBookById(bookDist(rng)) ? 1 : 0;
+                    }
+                    samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / lookupBatch);
                 }
-                else if (dynamic_cast<Faculty*>(user))
+            }
+            results.push_back(summarizeSamples(copies, users, "lookup-book", samples));
+            results.back().ops = lookups;
+            samples.clear();
+            {
+                Library::Access access(lib, AccessMode::Shared);
+                for (int i = 0; i < lookups; i += lookupBatch)
                 {
-                    static_cast<Faculty*>(user)->reserveBook(lib);
+                    auto start = chrono::steady_clock::now();
+                    for (int j = 0; j < lookupBatch; j++)
+                    {
+                        found += lib.findUserById(userDist(rng)) ? 1 : 0;
+                    }
+                    samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / lookupBatch);
                 }
-                break;
             }
-            case 4:
+            results.push_back(summarizeSamples(copies, users, "lookup-user", samples));
+            results.back().ops = lookups;
+            if (found != static_cast<size_t>(2 * lookups))
             {
-                user->returnBook(lib);
-                break;
+                cerr << "Warning: " << 2 * lookups - found << " lookups found nothing." << endl;
             }
-            case 5:
+            
+            vector<pair<string, string>> credentials;
+            for (int i = 0; i < 1000; i++)
             {
-                user->display(lib);
-                break;
+                int id = userDist(rng);
+                credentials.emplace_back("user" + to_string(id), "pw" + to_string(id));
             }
-            case 6:
+            samples.clear();
+            for (int i = 0; i < logins; i++)
             {
-                double fine = user->getAccount().getFine();
-                if (fine > 0)
+                const auto & login = credentials[i % credentials.size()];
+                auto start = chrono::steady_clock::now();
+                {
+                    Library::Access access(lib, AccessMode::Shared);
+                    lib.authenticateUser(login.first, login.second);
+                }
+                samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            }
+            results.push_back(summarizeSamples(copies, users, "authenticate", samples));
+            
+            // Users 1..n each borrow one copy; users n+1..2n reserve the
+            // copies of the second half; the first half are returned.
+            int n = min(users / 2, 20000);
+            int spacing = copies / n;
+            auto timeCirculation = [&](const string & operation, int first, int last, function<bool(int)> op)
                 {
-                    cout << "Paying fine of " << fine << " rupees." << endl;
-                    user->getAccount().resetFine();
-                    if (dynamic_cast<Student*>(user))
+                    vector<double> opSamples;
+                    for (int k = first; k <= last; k++)
                     {
-                        user->getAccount().resetBorrowTimestamps();
+                        auto start = chrono::steady_clock::now();
+                        bool ok;
+                        {
+                            Library::Access access(lib, AccessMode::Shared);
+                            ok = op(k);
+                        }
+                        opSamples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+                        if (!ok)
+                        {
+                            cerr << "Warning: " << operation << " " << k << " failed." << endl;
+                        }
                     }
-                    cout << "Fine cleared." << endl;
+                    results.push_back(summarizeSamples(copies, users, operation, opSamples));
+                };
+            timeCirculation("borrow", 1, n, [&](int k)
+                {
+                    return lib.findUserById(k)->borrowBook(lib, k * spacing, 14, discard);
                 }
-                else
+            );
+            // A title can only be reserved while every copy is lent out, so
+            // the other copies of the reserved titles are lent first, untimed.
+            for (int k = n / 2 + 1; k <= n; k++)
+            {
+                for (int bookId : lib.copiesOfTitle(lib.findBookById(k * spacing)))
                 {
-                    cout << "No fine due." << endl;
+                    BookRef copy = lib.findBookById(bookId);
+                    if (copy.getBorrowedBy() == 0)
+                    {
+                        lib.lendBook(copy, lib.findUserById(k), 14);
+                    }
                 }
-                break;
             }
-            case 7:
+            timeCirculation("reserve", n / 2 + 1, n, [&](int k)
+                {
+                    return lib.findUserById(n + k)->reserveBook(lib, k * spacing, discard);
+                }
+            );
+            
+            samples.clear();
+            for (int i = 0; i < repeats; i++)
             {
-                cout << "Logging out..." << endl;
-                break;
+                auto start = chrono::steady_clock::now();
+                {
+                    Library::Access access(lib, AccessMode::Shared);
+                    lib.printAllTitles(0, discard);
+                }
+                samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
             }
-            default:
+            results.push_back(summarizeSamples(copies, users, "listing", samples));
+            samples.clear();
+            for (int i = 0; i < 1000; i++)
             {
-                cout << "Invalid option. Please try again." << endl;
-                break;
+                int afterId = bookDist(rng);
+                auto start = chrono::steady_clock::now();
+                {
+                    Library::Access access(lib, AccessMode::Shared);
+                    lib.printBookPage(1, afterId, 20, discard);
+                }
+                samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
             }
+            results.push_back(summarizeSamples(copies, users, "listing-page", samples));
+            
+            timeCirculation("return", 1, n / 2, [&](int k)
+                {
+                    return lib.findUserById(k)->returnBook(lib, k * spacing, discard);
+                }
+            );
         }
-        
-    } while (choice != 7);
+        filesystem::remove_all(dir);
+    }
+    writeSuiteResults(results, format, out);
 }
 
 
-void librarianPortalMenu(Librarian * libUser, Library & lib)
+// Entry point for "--bench <name> [args]".
+int runBenchmarks(int argc, char * argv[])
 {
-    int choice;
-    do
+    string name = argc > 2 ? argv[2] : "";
+    if (name == "lookup")
     {
-        cout << "\n----- Librarian Portal -----" << endl;
-        cout << "1. Add Book" << endl;
-        cout << "2. Remove Book" << endl;
-        cout << "3. Update Book" << endl;
-        cout << "4. Add User" << endl;
-        cout << "5. Remove User" << endl;
-        cout << "6. Update User" << endl;
-        cout << "7. View All Books" << endl;
-        cout << "8. View All Users" << endl;
-        cout << "9. View Transaction Log" << endl;
-        cout << "10. Logout" << endl;
-        cout << "Enter your choice: ";
-        cin >> choice;
-        
-        switch (choice)
+        int maxCopies = argc > 3 ? atoi(argv[3]) : 1000000;
+        benchLookup(maxCopies);
+        return 0;
+    }
+    if (name == "login")
+    {
+        int accounts = argc > 3 ? atoi(argv[3]) : 100000;
+        benchLogin(accounts);
+        return 0;
+    }
+    if (name == "persist")
+    {
+        int maxCopies = argc > 3 ? atoi(argv[3]) : 100000;
+        benchPersist(maxCopies);
+        return 0;
+    }
+    if (name == "txlog")
+    {
+        int historyLines = argc > 3 ? atoi(argv[3]) : 1000000;
+        benchTransactionLog(historyLines);
+        return 0;
+    }
+    if (name == "startup")
+    {
+        int copies = argc > 3 ? atoi(argv[3]) : 1000000;
+        benchStartup(copies);
+        return 0;
+    }
+    if (name == "parse")
+    {
+        int copies = argc > 3 ? atoi(argv[3]) : 1000000;
+        return benchParse(copies) ? 0 : 1;
+    }
+    if (name == "load")
+    {
+        int copies = argc > 3 ? atoi(argv[3]) : 1000000;
+        benchLoad(copies);
+        return 0;
+    }
+    if (name == "scan")
+    {
+        int copies = argc > 3 ? atoi(argv[3]) : 1000000;
+        benchScan(copies);
+        return 0;
+    }
+    if (name == "accounts")
+    {
+        int maxCopies = argc > 3 ? atoi(argv[3]) : 1000000;
+        benchAccounts(maxCopies);
+        return 0;
+    }
+    if (name == "footprint")
+    {
+        int copies = argc > 3 ? atoi(argv[3]) : 1000000;
+        benchFootprint(copies);
+        return 0;
+    }
+    if (name == "server")
+    {
+        int maxClients = argc > 3 ? atoi(argv[3]) : 32;
+        benchServer(maxClients);
+        return 0;
+    }
+    if (name == "suite")
+    {
+        int maxCopies = argc > 3 ? atoi(argv[3]) : 1000000;
+        string format = argc > 4 ? argv[4] : "json";
+        if (format != "json" && format != "csv")
         {
-            case 1:
+            cout << "Unknown result format: " << format << " (expected json or csv)" << endl;
+            return 1;
+        }
+        if (argc > 5)
+        {
+            ofstream results(argv[5]);
+            if (!results)
             {
-                libUser->addBook(lib);
-                break;
+                cout << "Cannot write results to " << argv[5] << endl;
+                return 1;
             }
-            case 2:
+            benchSuite(maxCopies, format, results);
+        }
+        else
+        {
+            benchSuite(maxCopies, format, cout);
+        }
+        return 0;
+    }
+    if (name == "snapshot")
+    {
+        int copies = argc > 3 ? atoi(argv[3]) : 100000;
+        benchSnapshot(copies);
+        return 0;
+    }
+    if (name == "search")
+    {
+        int copies = argc > 3 ? atoi(argv[3]) : 1000000;
+        benchSearch(copies);
+        return 0;
+    }
+    if (name == "fuzzy")
+    {
+        int copies = argc > 3 ? atoi(argv[3]) : 1000000;
+        benchFuzzy(copies);
+        return 0;
+    }
+    cout << "Usage: " << argv[0] << " --bench lookup [maxCopies]" << endl;
+    cout << "       " << argv[0] << " --bench login [accounts]" << endl;
+    cout << "       " << argv[0] << " --bench persist [maxCopies]" << endl;
+    cout << "       " << argv[0] << " --bench txlog [historyLines]" << endl;
+    cout << "       " << argv[0] << " --bench startup [copies]" << endl;
+    cout << "       " << argv[0] << " --bench parse [copies]" << endl;
+    cout << "       " << argv[0] << " --bench load [copies]" << endl;
+    cout << "       " << argv[0] << " --bench scan [copies]" << endl;
+    cout << "       " << argv[0] << " --bench footprint [copies]" << endl;
+    cout << "       " << argv[0] << " --bench accounts [maxCopies]" << endl;
+    cout << "       " << argv[0] << " --bench server [maxClients]" << endl;
+    cout << "       " << argv[0] << " --bench snapshot [copies]" << endl;
+    cout << "       " << argv[0] << " --bench search [copies]" << endl;
+    cout << "       " << argv[0] << " --bench fuzzy [copies]" << endl;
+    cout << "       " << argv[0] << " --bench suite [maxCopies] [json|csv] [resultsFile]" << endl;
+    return 1;
+}
+
+
+// ========== Main Function ==========
+
+int main(int argc, char * argv[])
+{
+    if (argc > 1 && string(argv[1]) == "--bench")
+    {
+        return runBenchmarks(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--convert-catalog")
+    {
+        if (argc != 5)
+        {
+            cout << "Usage: " << argv[0] << " --convert-catalog text2bin|bin2text <input> <output>" << endl;
+            return 1;
+        }
+        return convertCatalog(argv[2], argv[3], argv[4]);
+    }
+    if (argc > 1 && string(argv[1]) == "--client")
+    {
+        if (argc != 3)
+        {
+            cout << "Usage: " << argv[0] << " --client <socket>" << endl;
+            return 1;
+        }
+        return runClient(argv[2]);
+    }
+    if (argc > 1 && string(argv[1]) == "--load-test")
+    {
+        if (argc < 3)
+        {
+            cout << "Usage: " << argv[0] << " --load-test <socket> [maxClients] [seconds]" << endl;
+            return 1;
+        }
+        int maxClients = argc > 3 ? max(1, atoi(argv[3])) : 32;
+        double seconds = argc > 4 ? max(0.1, atof(argv[4])) : 2.0;
+        return runLoadTest(argv[2], maxClients, seconds);
+    }
+    LibraryOptions options;
+    bool fineSweepOnly = false;     // "--fine-sweep": run the sweep and exit.
+    string servePath;               // "--serve <socket>": serve clients instead of the console.
+    string scriptPath;              // "--batch <script>": run a command script instead of the console.
+    bool quiet = false;             // "--quiet": batch mode prints only the summary.
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--persistence" && i + 1 < argc)
+        {
+            string mode = argv[++i];
+            if (mode == "snapshot")
             {
-                libUser->removeBook(lib);
-                break;
+                options.persistence = PersistenceMode::Snapshot;
             }
-            case 3:
+            else if (mode == "journal")
             {
-                libUser->updateBook(lib);
-                break;
+                options.persistence = PersistenceMode::Journaled;
             }
-            case 4:
+            else
             {
-                libUser->addUser(lib);
-                break;
+                cout << "Unknown persistence mode: " << mode << " (expected snapshot or journal)" << endl;
+                return 1;
             }
-            case 5:
+        }
+        else if (arg == "--log-flush" && i + 1 < argc)
+        {
+            string policy = argv[++i];
+            if (policy == "every")
             {
-                libUser->removeUser(lib);
-                break;
+                options.logFlush = FlushPolicy::EveryRecord;
             }
-            case 6:
+            else if (policy == "exit")
             {
-                libUser->updateUser(lib);
-                break;
+                options.logFlush = FlushPolicy::OnClose;
             }
-            case 7:
+            else if (policy.compare(0, 6, "batch:") == 0 && atoi(policy.c_str() + 6) > 0)
             {
-                lib.printAllBooks();
-                break;
+                options.logFlush = FlushPolicy::Batched;
+                options.logFlushBatch = atoi(policy.c_str() + 6);
             }
-            case 8:
+            else
             {
-                lib.printAllUsers();
-                break;
+                cout << "Unknown log flush policy: " << policy << " (expected every, batch:N or exit)" << endl;
+                return 1;
             }
-            case 9:
+        }
+        else if (arg == "--catalog-format" && i + 1 < argc)
+        {
+            string format = argv[++i];
+            if (format == "text")
             {
-                lib.viewTransactionLog();
-                break;
+                options.catalogFormat = CatalogFormat::Text;
             }
-            case 10:
+            else if (format == "binary")
             {
-                cout << "Logging out..." << endl;
-                break;
+                options.catalogFormat = CatalogFormat::Binary;
             }
-            default:
+            else
             {
-                cout << "Invalid option. Please try again." << endl;
-                break;
+                cout << "Unknown catalog format: " << format << " (expected text or binary)" << endl;
+                return 1;
             }
         }
-        
-    } while (choice != 10);
-}
-
-
-// ========== Role Selection and Login/Registration ==========
-
-void displayRoleSelectionMenu()
-{
-    cout << "\n========================================" << endl;
-    cout << "         Library Management System      " << endl;
-    cout << "========================================" << endl;
-    cout << "Select your role:" << endl;
-    cout << "1. Student" << endl;
-    cout << "2. Faculty" << endl;
-    cout << "3. Librarian" << endl;
-    cout << "4. Exit" << endl;
-    cout << "Enter your choice: ";
-}
-
-
-void registrationProcess(Library & lib, int role)
-{
-    cin.ignore();
-    cout << "\n=== Registration ===" << endl;
-    cout << "Enter desired username (no spaces): ";
-    string uname;
-    cin >> uname;
-    cout << "Enter password: ";
-    string pwd;
-    cin >> pwd;
-    cout << "Confirm password: ";
-    string cpwd;
-    cin >> cpwd;
-    if (pwd != cpwd)
-    {
-        cout << "Passwords do not match. Registration failed." << endl;
-        return;
-    }
-    int newId = lib.generateUserId();
-    User * newUser = nullptr;
-    if (role == 1)
-    {
-        newUser = new Student(newId, uname, pwd);
-    }
-    else if (role == 2)
-    {
-        newUser = new Faculty(newId, uname, pwd);
-    }
-    lib.addUserToLibrary(newUser);
-    cout << "Registration successful. Please log in with your new credentials." << endl;
-}
-
-
-void loginProcess(Library & lib, int role)
-{
-    cin.ignore();
-    cout << "\n=== Login ===" << endl;
-    cout << "Enter username: ";
-    string uname;
-    cin >> uname;
-    cout << "Enter password: ";
-    string pwd;
-    cin >> pwd;
-    User * user = lib.authenticateUser(uname, pwd);
-    if (user != nullptr)
-    {
-        if (role == 1 && dynamic_cast<Student*>(user))
+        else if (arg == "--threads" && i + 1 < argc)
         {
-            cout << "Login successful. Welcome, " << user->getUsername() << "!" << endl;
-            userPortalMenu(user, lib);
+            options.threads = max(0, atoi(argv[++i]));
         }
-        else if (role == 2 && dynamic_cast<Faculty*>(user))
+        else if (arg == "--log-fsync")
         {
-            cout << "Login successful. Welcome, " << user->getUsername() << "!" << endl;
-            userPortalMenu(user, lib);
+            options.logSync = true;
         }
-        else if (role == 3 && dynamic_cast<Librarian*>(user))
+        else if (arg == "--journal-fsync")
         {
-            cout << "Login successful. Welcome, Librarian!" << endl;
-            librarianPortalMenu(dynamic_cast<Librarian*>(user), lib);
+            options.journalSync = true;
+        }
+        else if (arg == "--sync-writes")
+        {
+            options.backgroundWrites = false;
+        }
+        else if (arg == "--fine-sweep")
+        {
+            fineSweepOnly = true;
+        }
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            servePath = argv[++i];
+        }
+        else if (arg == "--batch" && i + 1 < argc)
+        {
+            scriptPath = argv[++i];
+        }
+        else if (arg == "--quiet")
+        {
+            quiet = true;
+        }
+        else if (arg == "--no-stats")
+        {
+            options.collectStats = false;
         }
         else
         {
-            cout << "Your account does not match the selected role." << endl;
+            cout << "Unknown option: " << arg << endl;
+            return 1;
         }
     }
-    else
+    Library lib(options);
+    if (fineSweepOnly)
     {
-        cout << "Invalid credentials." << endl;
+        Library::Access access(lib, AccessMode::Exclusive);
+        printFineSweepReport(lib.runFineSweep(), cout);
+        return 0;
+    }
+    if (!servePath.empty())
+    {
+        return runServer(lib, servePath);
+    }
+    if (!scriptPath.empty())
+    {
+        return runBatch(lib, scriptPath, quiet, cout);
     }
-}
-
-
-// ========== Main Function ==========
-
-int main()
-{
-    Library lib;
     int roleChoice;
     while (true)
     {